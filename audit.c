@@ -0,0 +1,266 @@
+/*********************************************************************************
+* audit.c
+* Finds public keys whose moduli share a prime factor, with a batch GCD over
+* the whole collection
+* Usage guide in README.md
+*********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batchgcd.h"
+#include "numtheory.h"
+#include "rsa.h"
+#include "stats.h"
+
+#define OPTIONS "i:o:T:t:j:vh"
+
+typedef struct {                                        // the keys and every modulus the batch GCD flagged
+  char **paths;
+  uint64_t count;
+  uint64_t cap;
+  uint64_t hits;
+  uint64_t hit_cap;
+  uint64_t *hit_index;
+  mpz_t *hit_n;
+  mpz_t *hit_g;
+} audit_t;
+
+static void audit_hit(void *arg, uint64_t index, mpz_t n, mpz_t g) {   // keeps a flagged modulus until every one is known
+  audit_t *a = (audit_t *)arg;
+  if (a->hits == a->hit_cap) {
+    a->hit_cap = a->hit_cap == 0 ? 16 : 2 * a->hit_cap;
+    a->hit_index = (uint64_t *)realloc(a->hit_index, a->hit_cap * sizeof(uint64_t));
+    a->hit_n = (mpz_t *)realloc(a->hit_n, a->hit_cap * sizeof(mpz_t));
+    a->hit_g = (mpz_t *)realloc(a->hit_g, a->hit_cap * sizeof(mpz_t));
+  }
+  a->hit_index[a->hits] = index;
+  mpz_init_set(a->hit_n[a->hits], n);
+  mpz_init_set(a->hit_g[a->hits], g);
+  a->hits += 1;
+}
+
+//
+// Writes one line per flagged key: its path and a prime factor in hex, or
+// "duplicate" and the path of a key with the same modulus. A key whose
+// primes are both shared has g = n; its factors are then found by a plain
+// gcd with the other flagged keys, which are few.
+//
+static void audit_report(audit_t *a, FILE *outfile) {
+  mpz_t d;
+  mpz_init(d);
+  for (uint64_t i = 0; i < a->hits; i++) {
+    const char *path = a->paths[a->hit_index[i]];
+    if (mpz_cmp(a->hit_g[i], a->hit_n[i]) != 0) {
+      gmp_fprintf(outfile, "%s\t%Zx\n", path, a->hit_g[i]);
+      continue;
+    }
+    const char *same = NULL;                            // a key with an identical modulus, if no factor turns up
+    bool found = false;
+    for (uint64_t j = 0; j < a->hits && !found; j++) {
+      if (j == i) {
+        continue;
+      }
+      gcd(d, a->hit_n[i], a->hit_n[j]);
+      if (mpz_cmp_ui(d, 1) != 0 && mpz_cmp(d, a->hit_n[i]) != 0) {
+        gmp_fprintf(outfile, "%s\t%Zx\n", path, d);
+        found = true;
+      } else if (same == NULL && mpz_cmp(a->hit_n[i], a->hit_n[j]) == 0) {
+        same = a->paths[a->hit_index[j]];
+      }
+    }
+    if (!found && same != NULL) {
+      fprintf(outfile, "%s\tduplicate\t%s\n", path, same);
+    } else if (!found) {
+      gmp_fprintf(outfile, "%s\t%Zx\n", path, a->hit_g[i]);
+    }
+  }
+  mpz_clear(d);
+}
+
+static bool audit_add(audit_t *a, batchgcd_t *bg, const char *path, mpz_t n, mpz_t e, mpz_t s, char **username) {   // reads one public key file into the batch
+  FILE *pub_fs = fopen(path, "r");
+  if (pub_fs == NULL) {
+    gmp_fprintf(stderr, "cannot open public key file %s\n", path);
+    return false;
+  }
+  uint64_t start = stats_start();
+  bool ok = rsa_read_pub(n, e, s, username, pub_fs);
+  stats_stop(STATS_KEY_LOAD, start, 1);
+  fclose(pub_fs);
+  if (!ok || mpz_cmp_ui(n, 2) < 0) {
+    gmp_fprintf(stderr, "cannot read public key file %s\n", path);
+    return false;
+  }
+  if (!batchgcd_add(bg, n)) {
+    gmp_fprintf(stderr, "cannot write tree level file\n");
+    return false;
+  }
+  if (a->count == a->cap) {
+    a->cap = a->cap == 0 ? 64 : 2 * a->cap;
+    a->paths = (char **)realloc(a->paths, a->cap * sizeof(char *));
+  }
+  a->paths[a->count++] = strdup(path);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char *list_file = NULL;                               // file listing public key files; default stdin without arguments
+  char *out_file = NULL;                                // default output: stdout
+  char *tree_dir = ".";                                 // default directory for tree levels
+  uint64_t threads = 1;                                 // default num of worker threads
+  char *stats_file = NULL;                              // JSON counters, or NULL for none
+  int verbose = 0;                                      // verbose set to false
+  int opt = 0;
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'i':                                           // specify file listing the public key files
+      list_file = optarg;
+      break;
+    case 'o':                                           // specify file to write the report to
+      out_file = optarg;
+      break;
+    case 'T':                                           // specify directory for tree levels
+      tree_dir = optarg;
+      break;
+    case 't':                                           // specify num of worker threads and exit if input is invalid
+      threads = strtoul(optarg, NULL, 10);
+      if (threads < 1 || threads > 1024) {
+        gmp_fprintf(stderr, "number of threads must be within 1-1024, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'j':                                           // report counters and timings as JSON
+      stats_file = optarg;
+      break;
+    case 'v':                                           // enable verbose output
+      verbose = 1;
+      break;
+    case 'h':                                           // prints program usage and synopsis
+      gmp_fprintf(
+          stderr,
+          "Usage: ./audit [options] [pubfile ...]\n  ./audit finds public keys "
+          "whose moduli share a prime factor\n  with any other key given, "
+          "using a batch GCD over all of them.\n  Each compromised key is "
+          "written as its path and a shared factor in hex,\n  or \"duplicate\" "
+          "and the path of a key with the same modulus.\n  Exits with 2 if any "
+          "key is compromised.\n    -i <list>   : Read public key file "
+          "paths, one per line, from <list>.\n                  Default: stdin "
+          "when no files are given.\n    -o <outfile>: Write the report to "
+          "<outfile>. Default: stdout\n    -T <dir>    : Keep tree levels in "
+          "<dir> while they are needed. Default: .\n    -t <threads>: Build "
+          "each tree level on <threads> threads. Default: 1\n    -j <file>   : "
+          "Write counters and phase timings as JSON to <file>, - for stderr.\n"
+          "    -v          : Enable verbose output.\n    -h          : Display "
+          "program synopsis and usage.\n");
+      return 0;
+    default:                                            // prints -h output and exit program on bad option
+      gmp_fprintf(
+          stderr,
+          "Usage: ./audit [options] [pubfile ...]\n  ./audit finds public keys "
+          "whose moduli share a prime factor\n  with any other key given, "
+          "using a batch GCD over all of them.\n  Each compromised key is "
+          "written as its path and a shared factor in hex,\n  or \"duplicate\" "
+          "and the path of a key with the same modulus.\n  Exits with 2 if any "
+          "key is compromised.\n    -i <list>   : Read public key file "
+          "paths, one per line, from <list>.\n                  Default: stdin "
+          "when no files are given.\n    -o <outfile>: Write the report to "
+          "<outfile>. Default: stdout\n    -T <dir>    : Keep tree levels in "
+          "<dir> while they are needed. Default: .\n    -t <threads>: Build "
+          "each tree level on <threads> threads. Default: 1\n    -j <file>   : "
+          "Write counters and phase timings as JSON to <file>, - for stderr.\n"
+          "    -v          : Enable verbose output.\n    -h          : Display "
+          "program synopsis and usage.\n");
+      return 1;
+    }
+  }
+  if (stats_file != NULL) {
+    stats_enable();
+  }
+  FILE *list = NULL;
+  if (list_file != NULL || optind == argc) {
+    list = list_file == NULL || strcmp(list_file, "-") == 0 ? stdin : fopen(list_file, "r");
+    if (list == NULL) {
+      gmp_fprintf(stderr, "cannot open specified list file\n");
+      return 1;
+    }
+  }
+  FILE *outfile = out_file == NULL ? stdout : fopen(out_file, "w");
+  if (outfile == NULL) {
+    gmp_fprintf(stderr, "cannot open specified output file\n");
+    if (list != NULL && list != stdin) {
+      fclose(list);
+    }
+    return 1;
+  }
+
+  batchgcd_t bg;
+  if (!batchgcd_init(&bg, tree_dir, threads, verbose)) {
+    gmp_fprintf(stderr, "cannot create tree level files in %s\n", tree_dir);
+    if (list != NULL && list != stdin) {
+      fclose(list);
+    }
+    if (outfile != stdout) {
+      fclose(outfile);
+    }
+    batchgcd_clear(&bg);
+    return 1;
+  }
+  audit_t a;
+  memset(&a, 0, sizeof(a));
+  bool failed = false;
+  mpz_t n, e, s;
+  mpz_inits(n, e, s, NULL);
+  char *username = NULL;
+  for (int i = optind; i < argc; i++) {                 // files named on the command line come first
+    failed |= !audit_add(&a, &bg, argv[i], n, e, s, &username);
+  }
+  if (list != NULL) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, list)) != -1) {   // one path per line; blank lines are skipped
+      if (len > 0 && line[len - 1] == '\n') {
+        line[len - 1] = '\0';
+      }
+      if (line[0] != '\0') {
+        failed |= !audit_add(&a, &bg, line, n, e, s, &username);
+      }
+    }
+    free(line);
+    if (list != stdin) {
+      fclose(list);
+    }
+  }
+  free(username);
+  mpz_clears(n, e, s, NULL);
+
+  if (!batchgcd_run(&bg, audit_hit, &a)) {
+    gmp_fprintf(stderr, "cannot write or read tree level files in %s\n", tree_dir);
+    failed = true;
+  }
+  audit_report(&a, outfile);
+  if (verbose == 1) {                                   // verbose output
+    gmp_fprintf(stderr, "%lu of %lu keys share a factor\n", a.hits, a.count);
+  }
+  uint64_t hits = a.hits;
+  for (uint64_t i = 0; i < a.hits; i++) {
+    mpz_clears(a.hit_n[i], a.hit_g[i], NULL);
+  }
+  for (uint64_t i = 0; i < a.count; i++) {
+    free(a.paths[i]);
+  }
+  free(a.paths);
+  free(a.hit_index);
+  free(a.hit_n);
+  free(a.hit_g);
+  batchgcd_clear(&bg);
+  if (outfile != stdout) {
+    fclose(outfile);
+  }
+  if (stats_file != NULL) {
+    stats_write(stats_file, "audit");
+  }
+  return hits > 0 ? 2 : failed ? 1 : 0;
+}
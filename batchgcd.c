@@ -0,0 +1,351 @@
+/*********************************************************************************
+* batchgcd.c
+* Bernstein's batch GCD over many moduli, with disk-backed tree levels
+*********************************************************************************/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "batchgcd.h"
+#include "numtheory.h"
+#include "stats.h"
+
+typedef struct {                                          // one worker's share of a level
+  batchgcd_t *bg;
+  batchgcd_level_t *in;                                   // children for a product level, parents for a remainder level
+  batchgcd_level_t *prod;                                 // remainder levels: the product level at the same depth
+  batchgcd_level_t *out;                                  // the level being written; NULL at the leaves
+  uint64_t shard;                                         // worker number, and the shard of out it writes
+  uint64_t first;                                         // nodes [first, last) of the level
+  uint64_t last;
+  bool ok;
+  uint64_t hits;                                          // leaves: moduli found sharing a factor
+  uint64_t hit_cap;
+  uint64_t *hit_index;
+  mpz_t *hit_g;
+} batchgcd_job_t;
+
+static double now(void) {                                 // monotonic clock, in seconds
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void level_init(batchgcd_level_t *lv, uint64_t shards, uint64_t count) {   // an empty level with room for count nodes
+  lv->count = 0;
+  lv->cap = count < 64 ? 64 : count;
+  lv->shards = shards;
+  lv->files = (FILE **)calloc(shards, sizeof(FILE *));
+  lv->offsets = (uint64_t *)malloc(lv->cap * sizeof(uint64_t));
+  lv->shard = (uint16_t *)malloc(lv->cap * sizeof(uint16_t));
+}
+
+static void level_clear(batchgcd_level_t *lv) {
+  for (uint64_t t = 0; t < lv->shards; t++) {
+    if (lv->files[t] != NULL) {
+      fclose(lv->files[t]);
+    }
+  }
+  free(lv->files);
+  free(lv->offsets);
+  free(lv->shard);
+  lv->files = NULL;
+  lv->offsets = NULL;
+  lv->shard = NULL;
+  lv->count = 0;
+}
+
+static FILE *shard_create(const char *dir) {              // an anonymous read-write file in dir
+  size_t len = strlen(dir) + 18;
+  char *path = (char *)malloc(len);
+  snprintf(path, len, "%s/batchgcd.XXXXXX", dir);
+  int fd = mkstemp(path);
+  if (fd >= 0) {
+    unlink(path);                                         // gone from dir already; the space is freed on fclose
+  }
+  free(path);
+  FILE *file = fd < 0 ? NULL : fdopen(fd, "w+");
+  if (fd >= 0 && file == NULL) {
+    close(fd);
+  }
+  return file;
+}
+
+static bool node_write(FILE *file, uint64_t *pos, mpz_t x) {   // appends a node at *pos and moves *pos past it
+  size_t len = 0;
+  uint8_t *bytes = (uint8_t *)mpz_export(NULL, &len, 1, 1, 1, 0, x);
+  uint8_t head[8];
+  for (int i = 0; i < 8; i++) {
+    head[i] = (uint8_t)((uint64_t)len >> (56 - 8 * i));
+  }
+  bool ok = fwrite(head, 1, 8, file) == 8 && fwrite(bytes, 1, len, file) == len;
+  *pos += 8 + len;
+  free(bytes);
+  return ok;
+}
+
+static bool pread_all(int fd, uint8_t *buf, size_t len, uint64_t off) {
+  while (len > 0) {
+    ssize_t got = pread(fd, buf, len, off);
+    if (got <= 0) {
+      return false;
+    }
+    buf += got;
+    len -= got;
+    off += got;
+  }
+  return true;
+}
+
+static bool node_read(batchgcd_level_t *lv, uint64_t i, mpz_t x, uint8_t **buf, size_t *buf_cap) {   // loads node i; buf is grown as needed
+  int fd = fileno(lv->files[lv->shard[i]]);
+  uint8_t head[8];
+  if (!pread_all(fd, head, 8, lv->offsets[i])) {
+    return false;
+  }
+  uint64_t len = 0;
+  for (int j = 0; j < 8; j++) {
+    len = len << 8 | head[j];
+  }
+  if (len > *buf_cap) {
+    free(*buf);
+    *buf_cap = len;
+    *buf = (uint8_t *)malloc(len);
+  }
+  if (!pread_all(fd, *buf, len, lv->offsets[i] + 8)) {
+    return false;
+  }
+  mpz_import(x, len, 1, 1, 1, 0, *buf);
+  return true;
+}
+
+static void job_hit(batchgcd_job_t *job, uint64_t index, mpz_t g) {   // records a leaf with a shared factor
+  if (job->hits == job->hit_cap) {
+    job->hit_cap = job->hit_cap == 0 ? 16 : 2 * job->hit_cap;
+    job->hit_index = (uint64_t *)realloc(job->hit_index, job->hit_cap * sizeof(uint64_t));
+    job->hit_g = (mpz_t *)realloc(job->hit_g, job->hit_cap * sizeof(mpz_t));
+  }
+  job->hit_index[job->hits] = index;
+  mpz_init_set(job->hit_g[job->hits], g);
+  job->hits += 1;
+}
+
+static void *product_worker(void *arg) {                  // node j is the product of children 2j and 2j + 1
+  batchgcd_job_t *job = (batchgcd_job_t *)arg;
+  batchgcd_level_t *in = job->in;
+  batchgcd_level_t *out = job->out;
+  FILE *file = out->files[job->shard];
+  uint8_t *buf = NULL;
+  size_t buf_cap = 0;
+  uint64_t pos = 0;
+  mpz_t a, b;
+  mpz_inits(a, b, NULL);
+  for (uint64_t j = job->first; j < job->last && job->ok; j++) {
+    uint64_t start = stats_start();
+    job->ok = node_read(in, 2 * j, a, &buf, &buf_cap);
+    if (job->ok && 2 * j + 1 < in->count) {               // an odd last child moves up unchanged
+      job->ok = node_read(in, 2 * j + 1, b, &buf, &buf_cap);
+      mpz_mul(a, a, b);
+    }
+    out->offsets[j] = pos;
+    out->shard[j] = (uint16_t)job->shard;
+    job->ok = job->ok && node_write(file, &pos, a);
+    stats_stop(STATS_TREE_PRODUCT, start, 1);
+  }
+  job->ok = job->ok && fflush(file) == 0;
+  mpz_clears(a, b, NULL);
+  free(buf);
+  return NULL;
+}
+
+static void *remainder_worker(void *arg) {                // node j is its parent's remainder mod the square of its product
+  batchgcd_job_t *job = (batchgcd_job_t *)arg;
+  batchgcd_level_t *prod = job->prod;
+  batchgcd_level_t *out = job->out;
+  FILE *file = out != NULL ? out->files[job->shard] : NULL;
+  uint8_t *buf = NULL;
+  size_t buf_cap = 0;
+  uint64_t pos = 0;
+  uint64_t parent = UINT64_MAX;                           // the parent node held in r
+  mpz_t r, x, sq, g;
+  mpz_inits(r, x, sq, g, NULL);
+  numtheory_ws_t ws;
+  numtheory_ws_init(&ws, 0);
+  for (uint64_t j = job->first; j < job->last && job->ok; j++) {
+    uint64_t start = stats_start();
+    if (j / 2 != parent) {                                // siblings share their parent, so it is read once
+      parent = j / 2;
+      job->ok = node_read(job->in, parent, r, &buf, &buf_cap);
+    }
+    job->ok = job->ok && node_read(prod, j, x, &buf, &buf_cap);
+    if (!job->ok) {
+      break;
+    }
+    mpz_mul(sq, x, x);
+    mpz_mod(sq, r, sq);
+    if (out != NULL) {
+      out->offsets[j] = pos;
+      out->shard[j] = (uint16_t)job->shard;
+      job->ok = node_write(file, &pos, sq);
+    } else {                                              // a leaf: (P mod n^2) / n = (P / n) mod n
+      mpz_divexact(sq, sq, x);
+      gcd_ws(g, sq, x, &ws);
+      if (mpz_cmp_ui(g, 1) != 0) {
+        job_hit(job, j, g);
+      }
+    }
+    stats_stop(STATS_TREE_REMAINDER, start, 1);
+  }
+  if (file != NULL) {
+    job->ok = job->ok && fflush(file) == 0;
+  }
+  numtheory_ws_clear(&ws);
+  mpz_clears(r, x, sq, g, NULL);
+  free(buf);
+  return NULL;
+}
+
+//
+// Builds count nodes of a level on up to bg->threads workers, each writing
+// a contiguous run of nodes to its own shard. out is NULL at the leaves,
+// whose results are left in the jobs instead; the caller frees the jobs.
+//
+static batchgcd_job_t *run_level(batchgcd_t *bg, uint64_t count, batchgcd_level_t *in, batchgcd_level_t *prod, batchgcd_level_t *out, void *(*worker)(void *), uint64_t *jobs_out, bool *ok) {
+  uint64_t threads = bg->threads < count ? bg->threads : count;
+  threads = threads < 1 ? 1 : threads;
+  *ok = true;
+  if (out != NULL) {
+    level_init(out, threads, count);
+    out->count = count;
+    for (uint64_t t = 0; t < threads && *ok; t++) {
+      out->files[t] = shard_create(bg->dir);
+      *ok = out->files[t] != NULL;
+    }
+  }
+  batchgcd_job_t *jobs = (batchgcd_job_t *)calloc(threads, sizeof(batchgcd_job_t));
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (uint64_t t = 0; t < threads; t++) {
+    jobs[t].bg = bg;
+    jobs[t].in = in;
+    jobs[t].prod = prod;
+    jobs[t].out = out;
+    jobs[t].shard = t;
+    jobs[t].first = count * t / threads;
+    jobs[t].last = count * (t + 1) / threads;
+    jobs[t].ok = *ok;
+    pthread_create(&tids[t], NULL, worker, &jobs[t]);
+  }
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+    *ok = *ok && jobs[t].ok;
+  }
+  free(tids);
+  *jobs_out = threads;
+  return jobs;
+}
+
+bool batchgcd_init(batchgcd_t *bg, const char *dir, uint64_t threads, int verbose) {   // the leaves are one shard, appended to in order
+  bg->dir = dir;
+  bg->threads = threads < 1 ? 1 : threads > UINT16_MAX ? UINT16_MAX : threads;
+  bg->verbose = verbose;
+  level_init(&bg->leaves, 1, 0);
+  bg->leaves.files[0] = shard_create(dir);
+  return bg->leaves.files[0] != NULL;
+}
+
+bool batchgcd_add(batchgcd_t *bg, mpz_t n) {              // appends a modulus to the leaves
+  batchgcd_level_t *lv = &bg->leaves;
+  if (lv->count == lv->cap) {
+    lv->cap *= 2;
+    lv->offsets = (uint64_t *)realloc(lv->offsets, lv->cap * sizeof(uint64_t));
+    lv->shard = (uint16_t *)realloc(lv->shard, lv->cap * sizeof(uint16_t));
+  }
+  uint64_t pos = lv->count == 0 ? 0 : (uint64_t)ftello(lv->files[0]);
+  lv->offsets[lv->count] = pos;
+  lv->shard[lv->count] = 0;
+  if (!node_write(lv->files[0], &pos, n)) {              // not a leaf, so indices stay those of the moduli added
+    return false;
+  }
+  lv->count += 1;
+  return true;
+}
+
+bool batchgcd_run(batchgcd_t *bg, batchgcd_report_t report, void *arg) {   // product tree up, remainder tree down, gcds at the leaves
+  if (bg->leaves.count < 2 || fflush(bg->leaves.files[0]) != 0) {   // a single modulus shares nothing
+    return bg->leaves.count < 2;
+  }
+  uint64_t depth = 1;                                     // levels above the leaves
+  while ((bg->leaves.count - 1) >> depth != 0) {
+    depth += 1;
+  }
+  batchgcd_level_t *prods = (batchgcd_level_t *)calloc(depth + 1, sizeof(batchgcd_level_t));
+  prods[0] = bg->leaves;
+  bool ok = true;
+  uint64_t threads = 0;
+  for (uint64_t k = 1; k <= depth && ok; k++) {           // product tree, leaves up to the root
+    double t = now();
+    uint64_t count = (prods[k - 1].count + 1) / 2;
+    free(run_level(bg, count, &prods[k - 1], NULL, &prods[k], product_worker, &threads, &ok));
+    if (bg->verbose) {
+      fprintf(stderr, "product level %lu: %lu nodes, %.1f sec\n", k, count, now() - t);
+    }
+  }
+
+  batchgcd_level_t rems[2];                               // the remainder level being read, then the one being written
+  rems[0] = prods[depth];                                 // the root's remainder is the root itself
+  bool root_owned = true;                                 // rems[0] is still prods[depth], cleared with the products
+  for (uint64_t k = depth - 1; k >= 1 && ok; k--) {       // remainder tree, root down to the level above the leaves
+    double t = now();
+    free(run_level(bg, prods[k].count, &rems[0], &prods[k], &rems[1], remainder_worker, &threads, &ok));
+    if (!root_owned) {
+      level_clear(&rems[0]);
+    }
+    level_clear(&prods[k + 1]);                           // every level above k is no longer needed
+    rems[0] = rems[1];
+    root_owned = false;
+    if (bg->verbose) {
+      fprintf(stderr, "remainder level %lu: %lu nodes, %.1f sec\n", k, prods[k].count, now() - t);
+    }
+  }
+
+  if (ok) {                                               // the leaves, in index order: jobs hold contiguous runs
+    double t = now();
+    batchgcd_job_t *jobs = run_level(bg, bg->leaves.count, &rems[0], &bg->leaves, NULL, remainder_worker, &threads, &ok);
+    uint8_t *buf = NULL;
+    size_t buf_cap = 0;
+    mpz_t n;
+    mpz_init(n);
+    for (uint64_t i = 0; i < threads; i++) {
+      for (uint64_t h = 0; h < jobs[i].hits; h++) {
+        if (ok && node_read(&bg->leaves, jobs[i].hit_index[h], n, &buf, &buf_cap)) {
+          report(arg, jobs[i].hit_index[h], n, jobs[i].hit_g[h]);
+        }
+        mpz_clear(jobs[i].hit_g[h]);
+      }
+      free(jobs[i].hit_index);
+      free(jobs[i].hit_g);
+    }
+    mpz_clear(n);
+    free(buf);
+    free(jobs);
+    if (bg->verbose) {
+      fprintf(stderr, "leaves: %lu moduli, %.1f sec\n", bg->leaves.count, now() - t);
+    }
+  }
+  if (!root_owned) {
+    level_clear(&rems[0]);
+  }
+  for (uint64_t k = 1; k <= depth; k++) {                 // levels the descent did not reach, after an error
+    if (prods[k].files != NULL) {
+      level_clear(&prods[k]);
+    }
+  }
+  free(prods);
+  return ok;
+}
+
+void batchgcd_clear(batchgcd_t *bg) {                     // the tree levels are freed by batchgcd_run
+  level_clear(&bg->leaves);
+}
@@ -0,0 +1,64 @@
+/*********************************************************************************
+* batchgcd.h
+* Interface for batchgcd.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// One level of a product or remainder tree, kept on disk. The level is split
+// into one shard file per thread that wrote it, each holding a contiguous run
+// of nodes as a u64 big-endian byte length then the big-endian magnitude.
+// Shard files are unlinked as soon as they are made, so nothing is left
+// behind; nodes are read back with pread, from any number of threads at once.
+//
+typedef struct {
+  uint64_t count;                          // nodes in the level
+  uint64_t cap;                            // capacity of offsets and shard
+  uint64_t shards;                         // shard files
+  FILE **files;                            // the shard files
+  uint64_t *offsets;                       // byte offset of every node in its shard
+  uint16_t *shard;                         // shard of every node
+} batchgcd_level_t;
+
+//
+// Settings and the moduli of a batch GCD.
+//
+typedef struct {
+  const char *dir;                         // directory holding the tree levels while they are needed
+  uint64_t threads;                        // nodes of one level worked on at the same time
+  int verbose;                             // reports each level and its time on stderr
+  batchgcd_level_t leaves;                 // the moduli, in the order added
+} batchgcd_t;
+
+//
+// Called for every modulus that shares a factor with another one, in the
+// order the moduli were added. g is the gcd of n and the product of every
+// other modulus: a shared prime, or n itself when both of its primes are
+// shared (for instance with a duplicate of n).
+//
+typedef void (*batchgcd_report_t)(void *arg, uint64_t index, mpz_t n, mpz_t g);
+
+bool batchgcd_init(batchgcd_t *bg, const char *dir, uint64_t threads, int verbose);   // starts an empty batch; false if no file can be made in dir
+
+bool batchgcd_add(batchgcd_t *bg, mpz_t n);                            // appends a modulus of at least 2; false on a write error, leaving it out
+
+//
+// Finds every modulus sharing a factor with another with Bernstein's batch
+// GCD: a product tree P over the moduli, then a remainder tree taking P mod
+// n^2 down to each leaf, where gcd((P mod n^2) / n, n) is the factor n shares.
+// Each level is built from the one before it by up to threads workers and
+// written to disk, so memory holds only the nodes being worked on.
+//
+// report: called for every modulus with a shared factor.
+// arg: passed through to report.
+// returns: false if a tree level could not be written or read.
+//
+bool batchgcd_run(batchgcd_t *bg, batchgcd_report_t report, void *arg);
+
+void batchgcd_clear(batchgcd_t *bg);                                   // closes every level file
@@ -0,0 +1,460 @@
+/*********************************************************************************
+* benchmark.c
+* Benchmark suite for the numtheory and rsa primitives and the file paths.
+* Prints one JSON document on stdout and a readable table on stderr.
+* Run with "make bench"
+*********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "keyfile.h"
+#include "mont.h"
+#include "montvec.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "rsa.h"
+
+#define OPTIONS "b:t:o:h"
+#define BENCH_MIN_SAMPLES 3                                 // every function runs at least this many times
+#define BENCH_MAX_SAMPLES 1000000
+#define BENCH_FILE_BYTES 65536                              // plaintext size for the file-level runs
+#define BENCH_HYBRID_BYTES (4 << 20)                        // plaintext size for the hybrid runs, where one RSA operation is amortised
+#define BENCH_BATCH 64                                      // messages per batch call
+
+typedef struct {                                            // inputs shared by every function timed at one key size
+  uint64_t bits;
+  mpz_t p, q, n, e;                                         // a key pair with e = 65537
+  rsa_priv_t priv;
+  rsa_priv_t priv_nocrt;                                    // the same key without CRT values
+  mpz_t m, c, s, o;                                         // message, ciphertext, signature, scratch output
+  mpz_t a, b, d;                                            // random full-size operands and exponent
+  mont_ctx_t mont;
+  mont_plan_t plan;                                         // e recoded, for the plan runs
+  bool has_vec;                                             // vec is set up: this CPU has a kernel that pays for n
+  montvec_ctx_t vec;
+  numtheory_ws_t ws;                                        // reused across calls by the *_ws functions
+  rsa_pub_key_t pub;                                        // prepared public key for the batch functions
+  mpz_t bm[BENCH_BATCH], bc[BENCH_BATCH], bs[BENCH_BATCH];  // batch messages, ciphertexts and signatures
+  uint64_t fe[RSA_FAMILY_MAX];                              // a whole key family's exponents
+  rsa_priv_t fpriv[RSA_FAMILY_MAX];                         // each family member's private key
+  mpz_t fm[RSA_FAMILY_MAX], fc[RSA_FAMILY_MAX];             // one message and ciphertext per member
+  rsa_priv_t mpriv[RSA_MAX_PRIMES - 2];                     // keys of the same size with 3, then 4 primes
+  mpz_t mc[RSA_MAX_PRIMES - 2];                             // a ciphertext for each
+  FILE *plain;                                              // BENCH_FILE_BYTES of random plaintext
+  FILE *cipher;                                             // its binary ciphertext
+  FILE *bulk;                                               // BENCH_HYBRID_BYTES of random plaintext
+  FILE *hybrid;                                             // its hybrid ciphertext
+  FILE *scratch;                                            // output of the file runs
+  FILE *key_text;                                           // the private key as a text key file
+  FILE *key_bin;                                            // the private key as a binary key file with precomputed values
+} bench_ctx_t;
+
+typedef struct {                                            // where results go
+  FILE *json;
+  double budget;                                            // seconds spent per function, after the minimum samples
+  int first;                                                // no JSON separator before the first result
+} bench_out_t;
+
+static double now(void) {                                   // monotonic clock, in seconds
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *x, const void *y) {
+  double a = *(const double *)x;
+  double b = *(const double *)y;
+  return (a > b) - (a < b);
+}
+
+static double percentile(double *sorted, uint64_t count, double pct) {    // nearest-rank percentile of sorted samples
+  uint64_t rank = (uint64_t)(pct / 100.0 * count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  if (rank > count) {
+    rank = count;
+  }
+  return sorted[rank - 1];
+}
+
+static void bench_run(bench_out_t *out, const char *name, bench_ctx_t *ctx, double bytes, void (*fn)(bench_ctx_t *)) {   // times fn and reports it
+  uint64_t cap = 1024;
+  uint64_t count = 0;
+  double *samples = (double *)malloc(cap * sizeof(double));
+  double start = now();
+  double total = 0;
+  while (count < BENCH_MIN_SAMPLES || (now() - start < out->budget && count < BENCH_MAX_SAMPLES)) {
+    double t0 = now();
+    fn(ctx);
+    double ns = (now() - t0) * 1e9;
+    if (count == cap) {
+      cap *= 2;
+      samples = (double *)realloc(samples, cap * sizeof(double));
+    }
+    samples[count++] = ns;
+    total += ns;
+  }
+  qsort(samples, count, sizeof(double), cmp_double);
+  double ns_per_op = total / count;
+  double ops_per_sec = 1e9 / ns_per_op;
+  double p50 = percentile(samples, count, 50);
+  double p90 = percentile(samples, count, 90);
+  double p99 = percentile(samples, count, 99);
+
+  fprintf(out->json, "%s\n    {\"name\": \"%s\", \"bits\": %lu, \"ops\": %lu, \"ops_per_sec\": %.3f, \"ns_per_op\": %.0f, ",
+          out->first ? "" : ",", name, ctx->bits, count, ops_per_sec, ns_per_op);
+  if (bytes > 0) {
+    fprintf(out->json, "\"mb_per_sec\": %.3f, ", bytes * ops_per_sec / 1e6);
+  } else {
+    fprintf(out->json, "\"mb_per_sec\": null, ");
+  }
+  fprintf(out->json, "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f}", p50, p90, p99);
+  out->first = 0;
+  fprintf(stderr, "%-20s %6lu %8lu %12.1f %14.0f ", name, ctx->bits, count, ops_per_sec, ns_per_op);
+  if (bytes > 0) {
+    fprintf(stderr, "%10.2f ", bytes * ops_per_sec / 1e6);
+  } else {
+    fprintf(stderr, "%10s ", "-");
+  }
+  fprintf(stderr, "%14.0f %14.0f\n", p90, p99);
+  free(samples);
+}
+
+static void op_pow_mod_ladder(bench_ctx_t *ctx) { pow_mod_ladder(ctx->o, ctx->a, ctx->d, ctx->n); }
+
+static void op_pow_mod(bench_ctx_t *ctx) { pow_mod(ctx->o, ctx->a, ctx->d, ctx->n); }
+
+static void op_mont_pow(bench_ctx_t *ctx) { mont_pow(ctx->o, ctx->a, ctx->d, &ctx->mont); }
+
+static void op_pow_mod_sec(bench_ctx_t *ctx) { pow_mod_sec(ctx->o, ctx->a, ctx->d, ctx->n); }
+
+static void op_mont_pow_sec(bench_ctx_t *ctx) { mont_pow_sec(ctx->o, ctx->a, ctx->d, &ctx->mont); }
+
+static void op_mont_pow_plan8(bench_ctx_t *ctx) {            // eight public exponentiations, one after another
+  for (int i = 0; i < MONTVEC_MAX_LANES; i++) {
+    mont_pow_plan(ctx->bc[i], ctx->bm[i], &ctx->plan, &ctx->mont);
+  }
+}
+
+static void op_montvec_pow_plan8(bench_ctx_t *ctx) {         // the same eight, side by side in vector lanes
+  for (int i = 0; i < MONTVEC_MAX_LANES; i += ctx->vec.lanes) {
+    montvec_pow_plan(ctx->bc + i, ctx->bm + i, ctx->vec.lanes, &ctx->plan, &ctx->vec);
+  }
+}
+
+static void op_pow_mod_ws(bench_ctx_t *ctx) { pow_mod_ws(ctx->o, ctx->a, ctx->d, ctx->n, &ctx->ws); }
+
+static void op_gcd_euclid(bench_ctx_t *ctx) { gcd_euclid(ctx->o, ctx->a, ctx->b); }
+
+static void op_gcd(bench_ctx_t *ctx) { gcd(ctx->o, ctx->a, ctx->b); }
+
+static void op_gcd_ws(bench_ctx_t *ctx) { gcd_ws(ctx->o, ctx->a, ctx->b, &ctx->ws); }
+
+static void op_mod_inverse_euclid(bench_ctx_t *ctx) { mod_inverse_euclid(ctx->o, ctx->e, ctx->b); }
+
+static void op_mod_inverse(bench_ctx_t *ctx) { mod_inverse(ctx->o, ctx->e, ctx->b); }
+
+static void op_mod_inverse_ws(bench_ctx_t *ctx) { mod_inverse_ws(ctx->o, ctx->e, ctx->b, &ctx->ws); }
+
+static void op_qinv_euclid(bench_ctx_t *ctx) { mod_inverse_euclid(ctx->o, ctx->q, ctx->p); }
+
+static void op_qinv_ws(bench_ctx_t *ctx) { mod_inverse_ws(ctx->o, ctx->q, ctx->p, &ctx->ws); }
+
+static void op_is_prime(bench_ctx_t *ctx) { is_prime(ctx->p, 50); }
+
+static void op_is_prime_ws(bench_ctx_t *ctx) { is_prime_ws(ctx->p, 50, state, &ctx->ws); }
+
+static void op_is_prime_auto(bench_ctx_t *ctx) { is_prime_ws(ctx->p, PRIME_ITERS_AUTO, state, &ctx->ws); }
+
+static void op_is_prime_bpsw(bench_ctx_t *ctx) { is_prime_ws(ctx->p, PRIME_ITERS_BPSW, state, &ctx->ws); }
+
+static void op_make_prime(bench_ctx_t *ctx) { make_prime(ctx->o, ctx->bits / 2, 50); }
+
+static void op_make_prime_auto(bench_ctx_t *ctx) { make_prime(ctx->o, ctx->bits / 2, PRIME_ITERS_AUTO); }
+
+static void op_make_prime_bpsw(bench_ctx_t *ctx) { make_prime(ctx->o, ctx->bits / 2, PRIME_ITERS_BPSW); }
+
+static void op_encrypt(bench_ctx_t *ctx) { rsa_encrypt(ctx->o, ctx->m, ctx->e, ctx->n); }
+
+static void op_decrypt(bench_ctx_t *ctx) { rsa_decrypt(ctx->o, ctx->c, &ctx->priv); }
+
+static void op_decrypt_nocrt(bench_ctx_t *ctx) { rsa_decrypt(ctx->o, ctx->c, &ctx->priv_nocrt); }
+
+static void op_sign(bench_ctx_t *ctx) { rsa_sign(ctx->o, ctx->m, &ctx->priv); }
+
+static void op_verify(bench_ctx_t *ctx) { rsa_verify(ctx->m, ctx->s, ctx->e, ctx->n); }
+
+static void op_encrypt_batch(bench_ctx_t *ctx) { rsa_encrypt_batch(ctx->bc, ctx->bm, BENCH_BATCH, &ctx->pub); }
+
+static void op_verify_batch(bench_ctx_t *ctx) { rsa_verify_batch(NULL, ctx->bm, ctx->bs, BENCH_BATCH, &ctx->pub); }
+
+static void op_decrypt_family(bench_ctx_t *ctx) {           // one ciphertext per family member, each on its own
+  for (int i = 0; i < RSA_FAMILY_MAX; i++) {
+    rsa_decrypt(ctx->fm[i], ctx->fc[i], &ctx->fpriv[i]);
+  }
+}
+
+static void op_decrypt_3prime(bench_ctx_t *ctx) { rsa_decrypt(ctx->o, ctx->mc[0], &ctx->mpriv[0]); }
+
+static void op_decrypt_4prime(bench_ctx_t *ctx) { rsa_decrypt(ctx->o, ctx->mc[1], &ctx->mpriv[1]); }
+
+static void op_decrypt_fiat(bench_ctx_t *ctx) { rsa_decrypt_fiat(ctx->fm, ctx->fc, ctx->fe, RSA_FAMILY_MAX, &ctx->fpriv[0]); }
+
+static void op_encrypt_file(bench_ctx_t *ctx) {             // encrypts the plaintext file into the scratch file
+  rewind(ctx->plain);
+  rewind(ctx->scratch);
+  rsa_encrypt_file(ctx->plain, ctx->scratch, ctx->n, ctx->e, 1, RSA_FORMAT_BIN);
+}
+
+static void op_decrypt_file(bench_ctx_t *ctx) {             // decrypts the ciphertext file into the scratch file
+  rewind(ctx->cipher);
+  rewind(ctx->scratch);
+  rsa_decrypt_file(ctx->cipher, ctx->scratch, &ctx->priv, 1, RSA_FORMAT_AUTO);
+}
+
+static void op_hybrid_encrypt_file(bench_ctx_t *ctx) {      // encrypts the bulk file into the scratch file
+  rewind(ctx->bulk);
+  rewind(ctx->scratch);
+  rsa_encrypt_file(ctx->bulk, ctx->scratch, ctx->n, ctx->e, 1, RSA_FORMAT_HYBRID);
+}
+
+static void op_hybrid_decrypt_file(bench_ctx_t *ctx) {      // decrypts the hybrid ciphertext into the scratch file
+  rewind(ctx->hybrid);
+  rewind(ctx->scratch);
+  rsa_decrypt_file(ctx->hybrid, ctx->scratch, &ctx->priv, 1, RSA_FORMAT_AUTO);
+}
+
+static void op_key_load_text(bench_ctx_t *ctx) {            // loads and prepares the text private key, as a service would at startup
+  rsa_priv_t key;
+  rsa_priv_key_t prepared;
+  rsa_priv_init(&key);
+  rewind(ctx->key_text);
+  rsa_read_priv(&key, ctx->key_text);
+  rsa_priv_prepare(&prepared, &key, 1);
+  rsa_priv_key_clear(&prepared);
+  rsa_priv_clear(&key);
+}
+
+static void op_key_load_bin(bench_ctx_t *ctx) {             // the same with the binary key and its stored Montgomery constants
+  keyfile_priv_t kp;
+  rsa_priv_key_t prepared;
+  keyfile_priv_init(&kp);
+  rewind(ctx->key_bin);
+  keyfile_read_priv(&kp, ctx->key_bin);
+  rsa_priv_prepare_ctx(&prepared, &kp.key, 1, kp.has_mp ? &kp.mp : NULL, kp.has_mq ? &kp.mq : NULL);
+  rsa_priv_key_clear(&prepared);
+  keyfile_priv_clear(&kp);
+}
+
+static void ctx_init(bench_ctx_t *ctx, uint64_t bits) {     // makes a key of the given size and every input derived from it
+  ctx->bits = bits;
+  mpz_inits(ctx->p, ctx->q, ctx->n, ctx->e, ctx->m, ctx->c, ctx->s, ctx->o, ctx->a, ctx->b, ctx->d, NULL);
+  rsa_priv_init(&ctx->priv);
+  rsa_priv_init(&ctx->priv_nocrt);
+  rsa_make_pub(ctx->p, ctx->q, ctx->n, ctx->e, bits, 50, 65537, 1);
+  rsa_make_priv(&ctx->priv, ctx->e, ctx->p, ctx->q);
+  mpz_set(ctx->priv_nocrt.n, ctx->priv.n);
+  mpz_set(ctx->priv_nocrt.d, ctx->priv.d);
+  mont_init(&ctx->mont, ctx->n);
+  mont_plan_init(&ctx->plan, ctx->e);
+  ctx->has_vec = montvec_init(&ctx->vec, ctx->n, montvec_best(bits));
+  numtheory_ws_init(&ctx->ws, bits);
+
+  mpz_urandomm(ctx->m, state, ctx->n);
+  rsa_encrypt(ctx->c, ctx->m, ctx->e, ctx->n);
+  rsa_sign(ctx->s, ctx->m, &ctx->priv);
+  mpz_set(ctx->d, ctx->priv.d);                             // a private-size exponent for the raw exponentiation runs
+  rsa_pub_prepare(&ctx->pub, ctx->n, ctx->e, 1);
+  for (int i = 0; i < BENCH_BATCH; i++) {
+    mpz_inits(ctx->bm[i], ctx->bc[i], ctx->bs[i], NULL);
+    mpz_urandomm(ctx->bm[i], state, ctx->n);
+    rsa_sign(ctx->bs[i], ctx->bm[i], &ctx->priv);
+  }
+  rsa_make_family(ctx->a, ctx->b, ctx->o, ctx->fe, RSA_FAMILY_MAX, bits, 50, 1);   // a and b are redrawn just below
+  for (int i = 0; i < RSA_FAMILY_MAX; i++) {
+    rsa_priv_init(&ctx->fpriv[i]);
+    mpz_inits(ctx->fm[i], ctx->fc[i], NULL);
+    mpz_set_ui(ctx->o, ctx->fe[i]);
+    rsa_make_priv(&ctx->fpriv[i], ctx->o, ctx->a, ctx->b);
+    mpz_urandomm(ctx->fm[i], state, ctx->fpriv[i].n);
+    pow_mod(ctx->fc[i], ctx->fm[i], ctx->o, ctx->fpriv[i].n);
+  }
+  for (int i = 0; i < RSA_MAX_PRIMES - 2; i++) {
+    mpz_t primes[RSA_MAX_PRIMES];
+    for (int j = 0; j < i + 3; j++) {
+      mpz_init(primes[j]);
+    }
+    rsa_priv_init(&ctx->mpriv[i]);
+    mpz_init(ctx->mc[i]);
+    rsa_make_pub_multi(primes, i + 3, ctx->o, ctx->e, bits, 50, 65537, 1);
+    rsa_make_priv_multi(&ctx->mpriv[i], ctx->e, primes, i + 3);
+    mpz_urandomm(ctx->mc[i], state, ctx->o);
+    for (int j = 0; j < i + 3; j++) {
+      mpz_clear(primes[j]);
+    }
+  }
+  mpz_urandomm(ctx->a, state, ctx->n);
+  mpz_urandomm(ctx->b, state, ctx->n);
+
+  uint8_t *buf = (uint8_t *)malloc(BENCH_HYBRID_BYTES);
+  for (size_t i = 0; i < BENCH_HYBRID_BYTES; i++) {
+    buf[i] = gmp_urandomb_ui(state, 8);
+  }
+  ctx->plain = tmpfile();
+  ctx->cipher = tmpfile();
+  ctx->bulk = tmpfile();
+  ctx->hybrid = tmpfile();
+  ctx->scratch = tmpfile();
+  fwrite(buf, 1, BENCH_FILE_BYTES, ctx->plain);
+  fflush(ctx->plain);
+  rewind(ctx->plain);
+  rsa_encrypt_file(ctx->plain, ctx->cipher, ctx->n, ctx->e, 1, RSA_FORMAT_BIN);
+  fflush(ctx->cipher);
+  fwrite(buf, 1, BENCH_HYBRID_BYTES, ctx->bulk);
+  fflush(ctx->bulk);
+  rewind(ctx->bulk);
+  rsa_encrypt_file(ctx->bulk, ctx->hybrid, ctx->n, ctx->e, 1, RSA_FORMAT_HYBRID);
+  fflush(ctx->hybrid);
+  free(buf);
+  ctx->key_text = tmpfile();
+  ctx->key_bin = tmpfile();
+  rsa_write_priv(&ctx->priv, ctx->key_text);
+  keyfile_write_priv(ctx->key_bin, &ctx->priv, true);
+  fflush(ctx->key_text);
+  fflush(ctx->key_bin);
+}
+
+static void ctx_clear(bench_ctx_t *ctx) {
+  fclose(ctx->plain);
+  fclose(ctx->cipher);
+  fclose(ctx->bulk);
+  fclose(ctx->hybrid);
+  fclose(ctx->scratch);
+  fclose(ctx->key_text);
+  fclose(ctx->key_bin);
+  mont_clear(&ctx->mont);
+  mont_plan_clear(&ctx->plan);
+  if (ctx->has_vec) {
+    montvec_clear(&ctx->vec);
+  }
+  numtheory_ws_clear(&ctx->ws);
+  rsa_pub_key_clear(&ctx->pub);
+  for (int i = 0; i < BENCH_BATCH; i++) {
+    mpz_clears(ctx->bm[i], ctx->bc[i], ctx->bs[i], NULL);
+  }
+  for (int i = 0; i < RSA_FAMILY_MAX; i++) {
+    rsa_priv_clear(&ctx->fpriv[i]);
+    mpz_clears(ctx->fm[i], ctx->fc[i], NULL);
+  }
+  for (int i = 0; i < RSA_MAX_PRIMES - 2; i++) {
+    rsa_priv_clear(&ctx->mpriv[i]);
+    mpz_clear(ctx->mc[i]);
+  }
+  rsa_priv_clear(&ctx->priv);
+  rsa_priv_clear(&ctx->priv_nocrt);
+  mpz_clears(ctx->p, ctx->q, ctx->n, ctx->e, ctx->m, ctx->c, ctx->s, ctx->o, ctx->a, ctx->b, ctx->d, NULL);
+}
+
+static void bench_size(bench_out_t *out, uint64_t bits) {   // runs every function at one key size
+  bench_ctx_t ctx;
+  ctx_init(&ctx, bits);
+  double block = (bits - 1) / 8 - 1;                        // plaintext bytes carried by one block
+  bench_run(out, "pow_mod_ladder", &ctx, 0, op_pow_mod_ladder);
+  bench_run(out, "pow_mod", &ctx, 0, op_pow_mod);
+  bench_run(out, "pow_mod_ws", &ctx, 0, op_pow_mod_ws);
+  bench_run(out, "mont_pow", &ctx, 0, op_mont_pow);
+  bench_run(out, "pow_mod_sec", &ctx, 0, op_pow_mod_sec);
+  bench_run(out, "mont_pow_sec", &ctx, 0, op_mont_pow_sec);
+  bench_run(out, "mont_pow_plan8", &ctx, 0, op_mont_pow_plan8);
+  if (ctx.has_vec) {                                        // skipped where no vector kernel beats mont.h
+    bench_run(out, "montvec_pow_plan8", &ctx, 0, op_montvec_pow_plan8);
+  }
+  bench_run(out, "gcd_euclid", &ctx, 0, op_gcd_euclid);
+  bench_run(out, "gcd", &ctx, 0, op_gcd);
+  bench_run(out, "gcd_ws", &ctx, 0, op_gcd_ws);
+  bench_run(out, "mod_inverse_euclid", &ctx, 0, op_mod_inverse_euclid);
+  bench_run(out, "mod_inverse", &ctx, 0, op_mod_inverse);
+  bench_run(out, "mod_inverse_ws", &ctx, 0, op_mod_inverse_ws);
+  bench_run(out, "qinv_euclid", &ctx, 0, op_qinv_euclid);         // q^-1 mod p: both operands full length, unlike e
+  bench_run(out, "qinv_ws", &ctx, 0, op_qinv_ws);
+  bench_run(out, "is_prime", &ctx, 0, op_is_prime);
+  bench_run(out, "is_prime_ws", &ctx, 0, op_is_prime_ws);
+  bench_run(out, "is_prime_auto", &ctx, 0, op_is_prime_auto);
+  bench_run(out, "is_prime_bpsw", &ctx, 0, op_is_prime_bpsw);
+  bench_run(out, "make_prime", &ctx, 0, op_make_prime);
+  bench_run(out, "make_prime_auto", &ctx, 0, op_make_prime_auto);
+  bench_run(out, "make_prime_bpsw", &ctx, 0, op_make_prime_bpsw);
+  bench_run(out, "rsa_encrypt", &ctx, block, op_encrypt);
+  bench_run(out, "rsa_decrypt", &ctx, block, op_decrypt);
+  bench_run(out, "rsa_decrypt_nocrt", &ctx, block, op_decrypt_nocrt);
+  bench_run(out, "rsa_decrypt_3prime", &ctx, block, op_decrypt_3prime);
+  bench_run(out, "rsa_decrypt_4prime", &ctx, block, op_decrypt_4prime);
+  bench_run(out, "rsa_sign", &ctx, 0, op_sign);
+  bench_run(out, "rsa_verify", &ctx, 0, op_verify);
+  bench_run(out, "rsa_encrypt_batch64", &ctx, BENCH_BATCH * block, op_encrypt_batch);
+  bench_run(out, "rsa_verify_batch64", &ctx, 0, op_verify_batch);
+  bench_run(out, "rsa_decrypt_family5", &ctx, RSA_FAMILY_MAX * block, op_decrypt_family);
+  bench_run(out, "rsa_decrypt_fiat5", &ctx, RSA_FAMILY_MAX * block, op_decrypt_fiat);
+  bench_run(out, "rsa_encrypt_file", &ctx, BENCH_FILE_BYTES, op_encrypt_file);
+  bench_run(out, "rsa_decrypt_file", &ctx, BENCH_FILE_BYTES, op_decrypt_file);
+  bench_run(out, "hybrid_encrypt_file", &ctx, BENCH_HYBRID_BYTES, op_hybrid_encrypt_file);
+  bench_run(out, "hybrid_decrypt_file", &ctx, BENCH_HYBRID_BYTES, op_hybrid_decrypt_file);
+  bench_run(out, "key_load_text", &ctx, 0, op_key_load_text);
+  bench_run(out, "key_load_bin", &ctx, 0, op_key_load_bin);
+  ctx_clear(&ctx);
+}
+
+int main(int argc, char **argv) {
+  uint64_t only_bits = 0;                                   // 0 runs every key size
+  bench_out_t out = { stdout, 0.5, 1 };
+  int opt = 0;
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'b':                                               // run one key size only
+      only_bits = strtoul(optarg, NULL, 10);
+      break;
+    case 't':                                               // seconds per function
+      out.budget = strtod(optarg, NULL);
+      break;
+    case 'o':                                               // write JSON to a file instead of stdout
+      out.json = fopen(optarg, "w");
+      if (out.json == NULL) {
+        fprintf(stderr, "cannot open %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: ./benchmark [options]\n  ./benchmark times the numtheory and rsa "
+              "primitives and prints JSON results.\n    -b <bits>   : Only run keys "
+              "of <bits> bits. Default: 1024, 2048, 3072, 4096\n    -t <secs>   : "
+              "Time each function for <secs> seconds. Default: 0.5\n    -o <file>   : "
+              "Write JSON to <file>. Default: standard output.\n    -h          : "
+              "Display program synopsis and usage.\n");
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  randstate_init(1);
+  fprintf(stderr, "%-20s %6s %8s %12s %14s %10s %14s %14s\n", "function", "bits", "ops", "ops/sec", "ns/op", "MB/s", "p90 ns", "p99 ns");
+  fprintf(out.json, "{\n  \"benchmark\": \"rsa\",\n  \"version\": 1,\n  \"seed\": 1,\n  \"public_exponent\": 65537,\n  \"results\": [");
+  uint64_t sizes[] = { 1024, 2048, 3072, 4096 };
+  for (int i = 0; i < 4; i++) {
+    if (only_bits == 0 || only_bits == sizes[i]) {
+      bench_size(&out, sizes[i]);
+    }
+  }
+  if (only_bits != 0 && only_bits != 1024 && only_bits != 2048 && only_bits != 3072 && only_bits != 4096) {
+    bench_size(&out, only_bits);
+  }
+  fprintf(out.json, "\n  ]\n}\n");
+  if (out.json != stdout) {
+    fclose(out.json);
+  }
+  randstate_clear();
+  return 0;
+}
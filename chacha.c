@@ -0,0 +1,252 @@
+/*********************************************************************************
+* chacha.c
+* ChaCha20 stream cipher and Poly1305 authenticator (RFC 8439), used by the
+* hybrid file format to encrypt bulk data under an RSA-wrapped session key
+*********************************************************************************/
+
+#include <string.h>
+#include "chacha.h"
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER(a, b, c, d)                                                    \
+  a += b; d ^= a; d = ROTL(d, 16);                                             \
+  c += d; b ^= c; b = ROTL(b, 12);                                             \
+  a += b; d ^= a; d = ROTL(d, 8);                                              \
+  c += d; b ^= c; b = ROTL(b, 7);
+
+static uint32_t load32(const uint8_t *p) {              // little-endian load
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t v) {           // little-endian store
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void store64(uint8_t *p, uint64_t v) {
+  store32(p, v);
+  store32(p + 4, v >> 32);
+}
+
+void chacha_init(chacha_t *c, const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint32_t counter) {
+  c->state[0] = 0x61707865;                             // "expand 32-byte k"
+  c->state[1] = 0x3320646e;
+  c->state[2] = 0x79622d32;
+  c->state[3] = 0x6b206574;
+  for (int i = 0; i < 8; i++) {
+    c->state[4 + i] = load32(key + 4 * i);
+  }
+  c->state[12] = counter;
+  for (int i = 0; i < 3; i++) {
+    c->state[13 + i] = load32(nonce + 4 * i);
+  }
+}
+
+static void chacha_block(chacha_t *c, uint8_t out[CHACHA_BLOCK_SIZE]) {   // one keystream block; steps the counter
+  uint32_t x[16];
+  memcpy(x, c->state, sizeof(x));
+  for (int i = 0; i < 10; i++) {                        // 20 rounds: a column round and a diagonal round per pass
+    QUARTER(x[0], x[4], x[8], x[12]);
+    QUARTER(x[1], x[5], x[9], x[13]);
+    QUARTER(x[2], x[6], x[10], x[14]);
+    QUARTER(x[3], x[7], x[11], x[15]);
+    QUARTER(x[0], x[5], x[10], x[15]);
+    QUARTER(x[1], x[6], x[11], x[12]);
+    QUARTER(x[2], x[7], x[8], x[13]);
+    QUARTER(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i++) {
+    store32(out + 4 * i, x[i] + c->state[i]);
+  }
+  c->state[12] += 1;
+}
+
+void chacha_xor(chacha_t *c, uint8_t *out, const uint8_t *in, size_t len) {   // xors keystream into out, a block at a time
+  uint8_t ks[CHACHA_BLOCK_SIZE];
+  while (len > 0) {
+    chacha_block(c, ks);
+    size_t n = len < CHACHA_BLOCK_SIZE ? len : CHACHA_BLOCK_SIZE;
+    for (size_t i = 0; i < n; i++) {
+      out[i] = in[i] ^ ks[i];
+    }
+    out += n;
+    in += n;
+    len -= n;
+  }
+}
+
+void poly1305_init(poly1305_t *p, const uint8_t key[32]) {   // splits the key into r (clamped) and s
+  p->r[0] = load32(key + 0) & 0x3ffffff;
+  p->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+  p->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+  p->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+  p->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+  for (int i = 0; i < 5; i++) {
+    p->h[i] = 0;
+  }
+  for (int i = 0; i < 4; i++) {
+    p->pad[i] = load32(key + 16 + 4 * i);
+  }
+  p->left = 0;
+}
+
+static void poly1305_blocks(poly1305_t *p, const uint8_t *m, size_t len, uint32_t hibit) {   // h = (h + m) * r mod 2^130 - 5 per 16 bytes
+  uint32_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+  uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+  while (len >= 16) {
+    h0 += load32(m + 0) & 0x3ffffff;
+    h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+    h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+    h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+    h4 += (load32(m + 12) >> 8) | hibit;
+
+    uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    uint32_t carry = d0 >> 26;                          // partial reduction back to 26-bit limbs
+    h0 = d0 & 0x3ffffff;
+    d1 += carry;
+    carry = d1 >> 26;
+    h1 = d1 & 0x3ffffff;
+    d2 += carry;
+    carry = d2 >> 26;
+    h2 = d2 & 0x3ffffff;
+    d3 += carry;
+    carry = d3 >> 26;
+    h3 = d3 & 0x3ffffff;
+    d4 += carry;
+    carry = d4 >> 26;
+    h4 = d4 & 0x3ffffff;
+    h0 += carry * 5;
+    carry = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += carry;
+
+    m += 16;
+    len -= 16;
+  }
+  p->h[0] = h0;
+  p->h[1] = h1;
+  p->h[2] = h2;
+  p->h[3] = h3;
+  p->h[4] = h4;
+}
+
+void poly1305_update(poly1305_t *p, const uint8_t *data, size_t len) {   // buffers partial blocks between calls
+  if (p->left > 0) {
+    size_t n = 16 - p->left < len ? 16 - p->left : len;
+    memcpy(p->buf + p->left, data, n);
+    p->left += n;
+    data += n;
+    len -= n;
+    if (p->left < 16) {
+      return;
+    }
+    poly1305_blocks(p, p->buf, 16, 1 << 24);
+    p->left = 0;
+  }
+  size_t whole = len & ~(size_t)15;
+  poly1305_blocks(p, data, whole, 1 << 24);
+  memcpy(p->buf, data + whole, len - whole);
+  p->left = len - whole;
+}
+
+void poly1305_finish(poly1305_t *p, uint8_t tag[POLY1305_TAG_SIZE]) {   // final block, full reduction, then adds s
+  if (p->left > 0) {
+    p->buf[p->left] = 1;                                // a short block carries its 1 bit just past the data
+    memset(p->buf + p->left + 1, 0, 15 - p->left);
+    poly1305_blocks(p, p->buf, 16, 0);
+  }
+  uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+  uint32_t carry = h1 >> 26;
+  h1 &= 0x3ffffff;
+  h2 += carry;
+  carry = h2 >> 26;
+  h2 &= 0x3ffffff;
+  h3 += carry;
+  carry = h3 >> 26;
+  h3 &= 0x3ffffff;
+  h4 += carry;
+  carry = h4 >> 26;
+  h4 &= 0x3ffffff;
+  h0 += carry * 5;
+  carry = h0 >> 26;
+  h0 &= 0x3ffffff;
+  h1 += carry;
+
+  uint32_t g0 = h0 + 5;                                 // g = h + 5 - 2^130; use it when it does not go negative
+  carry = g0 >> 26;
+  g0 &= 0x3ffffff;
+  uint32_t g1 = h1 + carry;
+  carry = g1 >> 26;
+  g1 &= 0x3ffffff;
+  uint32_t g2 = h2 + carry;
+  carry = g2 >> 26;
+  g2 &= 0x3ffffff;
+  uint32_t g3 = h3 + carry;
+  carry = g3 >> 26;
+  g3 &= 0x3ffffff;
+  uint32_t g4 = h4 + carry - (1 << 26);
+  uint32_t mask = (g4 >> 31) - 1;                       // all ones when g >= 0, selected without a branch
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  uint64_t f;                                           // h as four 32-bit words, plus s, mod 2^128
+  f = (uint64_t)(h0 | h1 << 26) + p->pad[0];
+  store32(tag + 0, f);
+  f = (uint64_t)(h1 >> 6 | h2 << 20) + p->pad[1] + (f >> 32);
+  store32(tag + 4, f);
+  f = (uint64_t)(h2 >> 12 | h3 << 14) + p->pad[2] + (f >> 32);
+  store32(tag + 8, f);
+  f = (uint64_t)(h3 >> 18 | h4 << 8) + p->pad[3] + (f >> 32);
+  store32(tag + 12, f);
+}
+
+static void chacha_poly_mac(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], const uint8_t *ct, size_t len, uint8_t tag[POLY1305_TAG_SIZE]) {   // RFC 8439 tag over the ciphertext
+  chacha_t c;
+  uint8_t block[CHACHA_BLOCK_SIZE];
+  chacha_init(&c, key, nonce, 0);
+  chacha_block(&c, block);                              // the one-time key is the first 32 bytes of block 0
+  poly1305_t p;
+  poly1305_init(&p, block);
+  static const uint8_t zeros[16] = { 0 };
+  poly1305_update(&p, ct, len);
+  poly1305_update(&p, zeros, (16 - len % 16) % 16);
+  uint8_t lengths[16];
+  store64(lengths, 0);                                  // no associated data
+  store64(lengths + 8, len);
+  poly1305_update(&p, lengths, 16);
+  poly1305_finish(&p, tag);
+}
+
+void chacha_poly_seal(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint8_t *out, const uint8_t *in, size_t len, uint8_t tag[POLY1305_TAG_SIZE]) {
+  chacha_t c;
+  chacha_init(&c, key, nonce, 1);                       // data starts at block 1; block 0 keys the MAC
+  chacha_xor(&c, out, in, len);
+  chacha_poly_mac(key, nonce, out, len, tag);
+}
+
+bool chacha_poly_open(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[POLY1305_TAG_SIZE]) {
+  uint8_t expect[POLY1305_TAG_SIZE];
+  chacha_poly_mac(key, nonce, in, len, expect);
+  uint8_t diff = 0;
+  for (int i = 0; i < POLY1305_TAG_SIZE; i++) {         // no early exit, so timing does not reveal the first bad byte
+    diff |= expect[i] ^ tag[i];
+  }
+  if (diff != 0) {
+    return false;
+  }
+  chacha_t c;
+  chacha_init(&c, key, nonce, 1);
+  chacha_xor(&c, out, in, len);
+  return true;
+}
@@ -0,0 +1,49 @@
+/*********************************************************************************
+* chacha.h
+* Interface for chacha.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_NONCE_SIZE 12
+#define CHACHA_BLOCK_SIZE 64
+#define POLY1305_TAG_SIZE 16
+
+//
+// ChaCha20 stream cipher state (RFC 8439): constants, 256-bit key, 32-bit
+// block counter and 96-bit nonce.
+//
+typedef struct {
+  uint32_t state[16];
+} chacha_t;
+
+//
+// Poly1305 one-time authenticator (RFC 8439), with the accumulator in
+// 26-bit limbs so every product fits in 64 bits.
+//
+typedef struct {
+  uint32_t r[5];                           // clamped key half, 26-bit limbs
+  uint32_t h[5];                           // accumulator, 26-bit limbs
+  uint32_t pad[4];                         // s, added at the end
+  uint8_t buf[16];                         // partial block awaiting more input
+  size_t left;                             // bytes held in buf
+} poly1305_t;
+
+void chacha_init(chacha_t *c, const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint32_t counter);   // sets up the cipher at a block counter
+
+void chacha_xor(chacha_t *c, uint8_t *out, const uint8_t *in, size_t len);   // xors len bytes of keystream into out; only the last call may be a partial block
+
+void poly1305_init(poly1305_t *p, const uint8_t key[32]);                    // starts a MAC with a one-time key
+
+void poly1305_update(poly1305_t *p, const uint8_t *data, size_t len);        // absorbs data
+
+void poly1305_finish(poly1305_t *p, uint8_t tag[POLY1305_TAG_SIZE]);          // pads the last block and writes the tag
+
+void chacha_poly_seal(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint8_t *out, const uint8_t *in, size_t len, uint8_t tag[POLY1305_TAG_SIZE]);   // RFC 8439 AEAD encryption with no associated data
+
+bool chacha_poly_open(const uint8_t key[CHACHA_KEY_SIZE], const uint8_t nonce[CHACHA_NONCE_SIZE], uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[POLY1305_TAG_SIZE]);   // checks the tag in constant time, then decrypts; false on a bad tag, leaving out untouched
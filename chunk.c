@@ -0,0 +1,128 @@
+/*********************************************************************************
+* chunk.c
+* Chunked ciphertext stream: fixed-width blocks grouped into checksummed,
+* numbered chunks, so damaged or partial input is found chunk by chunk and
+* any plaintext range can be reached without decrypting what comes before it
+*********************************************************************************/
+
+#include <string.h>
+#include "chunk.h"
+
+static const uint32_t crc_nibble[16] = {                  // CRC-32 (IEEE) of every 4-bit value, reflected
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {   // continues a CRC-32 started at 0
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+    crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+static void put_be(uint8_t *buf, uint64_t v, int len) {  // stores v big-endian in len bytes
+  for (int i = len - 1; i >= 0; i--) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t *buf, int len) {     // loads a big-endian integer of len bytes
+  uint64_t v = 0;
+  for (int i = 0; i < len; i++) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static void info_pack(uint8_t *buf, chunk_info_t *info) { // every field but the checksum; bytes 17-19 are reserved and left 0
+  memset(buf, 0, CHUNK_INFO_SIZE);
+  put_be(buf, info->seq, 8);
+  put_be(buf + 8, info->bytes, 4);
+  put_be(buf + 12, info->blocks, 4);
+  buf[16] = info->flags;
+}
+
+void chunk_write_header(FILE *outfile, chunk_hdr_t *hdr) {             // writes a stream header at the current position
+  uint8_t buf[CHUNK_HEADER_SIZE] = { 0 };
+  memcpy(buf, CHUNK_MAGIC, 4);
+  buf[4] = hdr->version;
+  put_be(buf + 8, hdr->modbytes, 4);
+  put_be(buf + 12, hdr->chunk_blocks, 4);
+  put_be(buf + 16, hdr->block_bytes, 4);
+  fwrite(buf, 1, CHUNK_HEADER_SIZE, outfile);
+}
+
+bool chunk_read_fields(FILE *infile, chunk_hdr_t *hdr) {               // reads and checks the header bytes after the magic
+  uint8_t buf[CHUNK_HEADER_SIZE];
+  if (fread(buf + 4, 1, CHUNK_HEADER_SIZE - 4, infile) != CHUNK_HEADER_SIZE - 4) {
+    return false;
+  }
+  hdr->version = buf[4];
+  hdr->modbytes = get_be(buf + 8, 4);
+  hdr->chunk_blocks = get_be(buf + 12, 4);
+  hdr->block_bytes = get_be(buf + 16, 4);
+  return hdr->version == CHUNK_VERSION && hdr->modbytes > 0 && hdr->chunk_blocks > 0 && hdr->chunk_blocks <= CHUNK_MAX_BLOCKS && hdr->block_bytes > 0 && hdr->block_bytes < hdr->modbytes;
+}
+
+uint64_t chunk_stride(chunk_hdr_t *hdr) {                 // bytes from one full chunk to the next
+  return CHUNK_INFO_SIZE + (uint64_t)hdr->chunk_blocks * hdr->modbytes;
+}
+
+void chunk_write(FILE *outfile, chunk_info_t *info, const uint8_t *blocks, uint32_t modbytes) {   // checksums the record and blocks, then writes both
+  uint8_t buf[CHUNK_INFO_SIZE];
+  size_t len = (size_t)info->blocks * modbytes;
+  info_pack(buf, info);
+  info->crc = crc32_update(crc32_update(0, buf, CHUNK_INFO_SIZE - 4), blocks, len);
+  put_be(buf + 20, info->crc, 4);
+  fwrite(buf, 1, CHUNK_INFO_SIZE, outfile);
+  fwrite(blocks, 1, len, outfile);
+}
+
+chunk_status_t chunk_read_info(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info) {   // reads the record in front of a chunk, or the header of a concatenated stream
+  uint8_t buf[CHUNK_INFO_SIZE];
+  size_t got = fread(buf, 1, 4, infile);
+  if (got == 0) {
+    return CHUNK_END;
+  }
+  if (got < 4) {
+    return CHUNK_TRUNCATED;
+  }
+  if (memcmp(buf, CHUNK_MAGIC, 4) == 0) {                 // a sequence number this large would need exabytes of input
+    return chunk_read_fields(infile, hdr) ? CHUNK_NEXT : CHUNK_CORRUPT;
+  }
+  if (fread(buf + 4, 1, CHUNK_INFO_SIZE - 4, infile) != CHUNK_INFO_SIZE - 4) {
+    return CHUNK_TRUNCATED;
+  }
+  info->seq = get_be(buf, 8);
+  info->bytes = get_be(buf + 8, 4);
+  info->blocks = get_be(buf + 12, 4);
+  info->flags = buf[16];
+  info->crc = get_be(buf + 20, 4);
+  if (buf[17] != 0 || buf[18] != 0 || buf[19] != 0 || info->blocks > hdr->chunk_blocks || info->bytes > (uint64_t)info->blocks * hdr->block_bytes) {
+    return CHUNK_CORRUPT;
+  }
+  return CHUNK_OK;
+}
+
+chunk_status_t chunk_read_blocks(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info, uint8_t *blocks) {   // reads a chunk's blocks and checks them against its record
+  uint8_t buf[CHUNK_INFO_SIZE];
+  size_t len = (size_t)info->blocks * hdr->modbytes;
+  if (fread(blocks, 1, len, infile) != len) {
+    return CHUNK_TRUNCATED;
+  }
+  info_pack(buf, info);                                   // the record as written; its reserved bytes were checked to be 0
+  uint32_t crc = crc32_update(crc32_update(0, buf, CHUNK_INFO_SIZE - 4), blocks, len);
+  return crc == info->crc ? CHUNK_OK : CHUNK_CORRUPT;
+}
+
+chunk_status_t chunk_skip_blocks(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info, uint8_t *blocks) {   // moves past a chunk's blocks without checking them
+  size_t len = (size_t)info->blocks * hdr->modbytes;
+  if (ftell(infile) >= 0 && fseek(infile, len, SEEK_CUR) == 0) {         // fseek on a pipe can claim success, so ftell decides
+    return CHUNK_OK;
+  }
+  return fread(blocks, 1, len, infile) == len ? CHUNK_OK : CHUNK_TRUNCATED;   // pipes are read through instead
+}
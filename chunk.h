@@ -0,0 +1,68 @@
+/*********************************************************************************
+* chunk.h
+* Interface for chunk.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHUNK_MAGIC "RSAC"                 // first four bytes of a chunked ciphertext stream
+#define CHUNK_VERSION 1
+#define CHUNK_HEADER_SIZE 20               // magic, version, 3 reserved bytes, modulus size, blocks per chunk, bytes per block
+#define CHUNK_INFO_SIZE 24                 // sequence, plaintext bytes, block count, flags, 3 reserved bytes, checksum
+#define CHUNK_BLOCKS 256                   // ciphertext blocks per full chunk
+#define CHUNK_MAX_BLOCKS 65536             // largest chunk a reader accepts, bounding its buffer
+#define CHUNK_FINAL 0x01                   // flag of the last chunk of a stream
+
+//
+// Header of a chunked ciphertext stream.
+// The header is followed by chunks, each an info record and then up to
+// chunk_blocks fixed-width big-endian ciphertext blocks. Every chunk but the
+// last of a stream is full, so chunk i sits at a fixed offset and covers a
+// fixed range of plaintext. Streams may be concatenated: a chunk position that
+// holds a new header starts the next stream. All integers are big-endian.
+//
+typedef struct {
+  uint8_t version;                         // stream format version
+  uint32_t modbytes;                       // width of every ciphertext block, in bytes
+  uint32_t chunk_blocks;                   // blocks in every chunk but the last
+  uint32_t block_bytes;                    // plaintext bytes carried by every block but the last
+} chunk_hdr_t;
+
+//
+// Record in front of every chunk. The checksum is a CRC-32 of the record's
+// other fields and the chunk's blocks, so a torn or corrupt chunk is found
+// before any of it is decrypted.
+//
+typedef struct {
+  uint64_t seq;                            // chunk number within its stream, from 0
+  uint32_t bytes;                          // plaintext bytes the chunk decrypts to
+  uint32_t blocks;                         // ciphertext blocks that follow
+  uint8_t flags;                           // CHUNK_FINAL on the last chunk
+  uint32_t crc;                            // checksum over the record and the blocks
+} chunk_info_t;
+
+typedef enum {
+  CHUNK_OK,                                // a whole chunk was read and its checksum matches
+  CHUNK_END,                               // clean end of input
+  CHUNK_NEXT,                              // a concatenated stream starts here; its header has been read
+  CHUNK_TRUNCATED,                         // the input ends inside a chunk
+  CHUNK_CORRUPT,                           // bad record or checksum mismatch
+} chunk_status_t;
+
+void chunk_write_header(FILE *outfile, chunk_hdr_t *hdr);              // writes a stream header at the current position
+
+bool chunk_read_fields(FILE *infile, chunk_hdr_t *hdr);                // reads and checks a header whose magic was already read
+
+uint64_t chunk_stride(chunk_hdr_t *hdr);                               // bytes from one full chunk to the next
+
+void chunk_write(FILE *outfile, chunk_info_t *info, const uint8_t *blocks, uint32_t modbytes);   // fills in the checksum and writes a chunk
+
+chunk_status_t chunk_read_info(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info);   // reads the next chunk record; hdr is replaced on CHUNK_NEXT
+
+chunk_status_t chunk_read_blocks(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info, uint8_t *blocks);   // reads the blocks after a record into blocks, which holds chunk_blocks blocks, and checks the checksum
+
+chunk_status_t chunk_skip_blocks(FILE *infile, chunk_hdr_t *hdr, chunk_info_t *info, uint8_t *blocks);   // moves past the blocks after a record, seeking when the input can; blocks is scratch for pipes
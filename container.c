@@ -0,0 +1,87 @@
+/*********************************************************************************
+* container.c
+* Binary ciphertext container: a short header followed by fixed-width
+* big-endian blocks, replacing one hexstring per line
+*********************************************************************************/
+
+#include <string.h>
+#include "container.h"
+
+static void put_be32(uint8_t *buf, uint32_t v) {          // stores v big-endian
+  for (int i = 3; i >= 0; i--) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static void put_be64(uint8_t *buf, uint64_t v) {
+  for (int i = 7; i >= 0; i--) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t *buf, int len) {     // loads a big-endian integer of len bytes
+  uint64_t v = 0;
+  for (int i = 0; i < len; i++) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+void container_write_header(FILE *outfile, container_hdr_t *hdr) {     // writes a header at the current position
+  uint8_t buf[CONTAINER_HEADER_SIZE] = { 0 };
+  memcpy(buf, CONTAINER_MAGIC, 4);
+  buf[4] = hdr->version;                                  // bytes 5-7 are reserved and left 0
+  put_be32(buf + 8, hdr->modbytes);
+  put_be64(buf + 12, hdr->blocks);
+  fwrite(buf, 1, CONTAINER_HEADER_SIZE, outfile);
+}
+
+bool container_read_header(FILE *infile, container_hdr_t *hdr) {       // reads and checks a header
+  uint8_t magic[4];
+  if (fread(magic, 1, 4, infile) != 4 || memcmp(magic, CONTAINER_MAGIC, 4) != 0) {
+    return false;
+  }
+  return container_read_fields(infile, hdr);
+}
+
+bool container_read_fields(FILE *infile, container_hdr_t *hdr) {       // reads and checks the header bytes after the magic
+  uint8_t buf[CONTAINER_HEADER_SIZE];
+  if (fread(buf + 4, 1, CONTAINER_HEADER_SIZE - 4, infile) != CONTAINER_HEADER_SIZE - 4) {
+    return false;
+  }
+  hdr->version = buf[4];
+  hdr->modbytes = get_be(buf + 8, 4);
+  hdr->blocks = get_be(buf + 12, 8);
+  return hdr->version == CONTAINER_VERSION && hdr->modbytes > 0;
+}
+
+bool container_patch_count(FILE *outfile, long offset, uint64_t blocks) {   // rewrites the block count once it is known
+  long end = ftell(outfile);
+  if (offset < 0 || end < 0 || fseek(outfile, offset + 12, SEEK_SET) != 0) {   // pipes cannot seek; their count stays unknown
+    return false;
+  }
+  uint8_t buf[8];
+  put_be64(buf, blocks);
+  fwrite(buf, 1, 8, outfile);
+  fseek(outfile, end, SEEK_SET);
+  return true;
+}
+
+uint32_t container_modbytes(mpz_t n) {                    // ciphertext block width for modulus n
+  return (mpz_sizeinbase(n, 2) + 7) / 8;
+}
+
+void container_put_block(uint8_t *buf, mpz_t c, uint32_t modbytes) {   // writes c as a zero-padded big-endian block
+  size_t used = (mpz_sizeinbase(c, 2) + 7) / 8;
+  if (mpz_sgn(c) == 0) {
+    used = 0;
+  }
+  memset(buf, 0, modbytes - used);
+  mpz_export(buf + modbytes - used, NULL, 1, sizeof(char), 1, 0, c);
+}
+
+void container_get_block(mpz_t c, const uint8_t *buf, uint32_t modbytes) {   // reads a big-endian block into c
+  mpz_import(c, modbytes, 1, sizeof(char), 1, 0, buf);
+}
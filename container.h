@@ -0,0 +1,41 @@
+/*********************************************************************************
+* container.h
+* Interface for container.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CONTAINER_MAGIC "RSAB"             // first four bytes of a binary ciphertext file
+#define CONTAINER_VERSION 1
+#define CONTAINER_HEADER_SIZE 20           // magic, version, 3 reserved bytes, modulus size, block count
+#define CONTAINER_UNKNOWN_COUNT UINT64_MAX // block count of a container written to a pipe
+
+//
+// Header of a binary ciphertext container.
+// The header is followed by fixed-width big-endian ciphertext blocks, each
+// modbytes long. All integers are stored big-endian.
+//
+typedef struct {
+  uint8_t version;                         // container format version
+  uint32_t modbytes;                       // width of every ciphertext block, in bytes
+  uint64_t blocks;                         // number of blocks, or CONTAINER_UNKNOWN_COUNT
+} container_hdr_t;
+
+void container_write_header(FILE *outfile, container_hdr_t *hdr);      // writes a header at the current position
+
+bool container_read_header(FILE *infile, container_hdr_t *hdr);        // reads and checks a header; false if it is not a container
+
+bool container_read_fields(FILE *infile, container_hdr_t *hdr);        // container_read_header for a stream whose magic was already read
+
+bool container_patch_count(FILE *outfile, long offset, uint64_t blocks);   // rewrites the block count of a header at offset; false if not seekable
+
+uint32_t container_modbytes(mpz_t n);                                  // ciphertext block width for modulus n
+
+void container_put_block(uint8_t *buf, mpz_t c, uint32_t modbytes);    // writes c as a zero-padded big-endian block
+
+void container_get_block(mpz_t c, const uint8_t *buf, uint32_t modbytes);  // reads a big-endian block into c
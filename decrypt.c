@@ -9,16 +9,43 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
+#include "keyfile.h"
+#include "keystore.h"
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "service.h"
+#include "stats.h"
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:k:u:t:f:r:S:j:vh"
+
+static bool read_store_priv(FILE *store_fs, const char *label, rsa_priv_t *key) {   // rsa_read_priv for the key stored under label
+  keystore_t ks;
+  if (!keystore_open(&ks, store_fs)) {
+    return false;
+  }
+  keyfile_priv_t kp;
+  keyfile_priv_init(&kp);
+  bool ok = keystore_read_priv(&ks, label, &kp);
+  rsa_priv_swap(key, &kp.key);
+  keyfile_priv_clear(&kp);
+  keystore_close(&ks);
+  return ok;
+}
 
 int main(int argc, char **argv) {
   FILE *infile = stdin;                         // default input set to stdin
   FILE *outfile = stdout;                       // default output set to stdout
   char priv_file[] = "rsa.priv";                // default private key file
+  char *store_file = NULL;                      // keystore holding the key instead of priv_file
+  char *label = NULL;                           // key's label in the keystore or in rsad's keystore
+  uint64_t threads = 1;                         // default num of worker threads
+  rsa_format_t format = RSA_FORMAT_AUTO;        // default ciphertext format: detected from the input
+  char *socket_path = NULL;                     // daemon to hand the work to; NULL decrypts locally
+  char *stats_file = NULL;                      // where to report counters and timings; NULL counts nothing
+  uint64_t offset = 0;                          // plaintext range to write; the whole input by default
+  uint64_t length = UINT64_MAX;
+  bool ranged = false;
   int verbose = 0;                              // verbose set to false
   int opt = 0;
   while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -31,11 +58,57 @@ int main(int argc, char **argv) {
       }
       break;
     case 'o':                                   // specify output file to write decrypted text to
-      outfile = fopen(optarg, "w");
+      outfile = fopen(optarg, "w+");
       break;
     case 'n':                                   // specify file containing private key
       strcpy(priv_file, optarg);
       break;
+    case 'k':                                   // specify keystore containing the private key
+      store_file = optarg;
+      break;
+    case 'u':                                   // specify label of the key to decrypt with
+      label = optarg;
+      break;
+    case 't':                                   // specify num of worker threads and exit if input is invalid
+      threads = strtoul(optarg, NULL, 10);
+      if (threads < 1 || threads > 1024) {
+        gmp_fprintf(stderr, "number of threads must be within 1-1024, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'f':                                   // specify ciphertext format and exit if input is invalid
+      if (strcmp(optarg, "hex") == 0) {
+        format = RSA_FORMAT_HEX;
+      } else if (strcmp(optarg, "bin") == 0) {
+        format = RSA_FORMAT_BIN;
+      } else if (strcmp(optarg, "hybrid") == 0) {
+        format = RSA_FORMAT_HYBRID;
+      } else if (strcmp(optarg, "chunked") == 0) {
+        format = RSA_FORMAT_CHUNKED;
+      } else {
+        gmp_fprintf(stderr, "format must be hex, bin, hybrid or chunked.\n");
+        return 1;
+      }
+      break;
+    case 'r': {                                 // specify a plaintext byte range and exit if input is invalid
+      char *end = NULL;
+      offset = strtoull(optarg, &end, 10);
+      if (end == optarg || (*end != ':' && *end != '\0')) {
+        gmp_fprintf(stderr, "range must be <offset> or <offset>:<length>.\n");
+        return 1;
+      }
+      if (*end == ':') {
+        length = strtoull(end + 1, NULL, 10);
+      }
+      ranged = true;
+      break;
+    }
+    case 'S':                                   // send the input to a running rsad instead of loading the key
+      socket_path = optarg;
+      break;
+    case 'j':                                   // report counters and timings as JSON
+      stats_file = optarg;
+      break;
     case 'v':                                   // enable verbose output
       verbose = 1;
       break;
@@ -47,7 +120,14 @@ int main(int argc, char **argv) {
           "specified output file.\n    -i <infile> : Read input from <infile>. "
           "Default: standard input.\n    -o <outfile>: Write output to "
           "<outfile>. Default: standard output.\n    -n <keyfile>: Private key "
-          "is in <keyfile>. Default: rsa.priv.\n    -v          : Enable "
+          "is in <keyfile>. Default: rsa.priv.\n    -k <store>  : Private key "
+          "is in keystore <store>, under the -u label.\n    -u <label>  : Decrypt "
+          "as <label> from -k or from the rsad keystore.\n    -t <threads>: Use <threads> "
+          "worker threads. Default: 1.\n    -f <format> : Read ciphertext "
+          "as hex, bin, hybrid or chunked. Default: detected.\n    -r <off:len>: Write only plaintext "
+          "bytes off to off+len of a chunked input.\n    -S <socket> : Decrypt through the "
+          "rsad listening on <socket>.\n    -j <file>   : Write counters and phase "
+          "timings as JSON to <file>, - for stderr.\n    -v          : Enable "
           "verbose output.\n    -h          : Display program synopsis and "
           "usage.\n");
       fclose(infile);
@@ -61,7 +141,14 @@ int main(int argc, char **argv) {
           "specified output file.\n    -i <infile> : Read input from <infile>. "
           "Default: standard input.\n    -o <outfile>: Write output to "
           "<outfile>. Default: standard output.\n    -n <keyfile>: Private key "
-          "is in <keyfile>. Default: rsa.priv.\n    -v          : Enable "
+          "is in <keyfile>. Default: rsa.priv.\n    -k <store>  : Private key "
+          "is in keystore <store>, under the -u label.\n    -u <label>  : Decrypt "
+          "as <label> from -k or from the rsad keystore.\n    -t <threads>: Use <threads> "
+          "worker threads. Default: 1.\n    -f <format> : Read ciphertext "
+          "as hex, bin, hybrid or chunked. Default: detected.\n    -r <off:len>: Write only plaintext "
+          "bytes off to off+len of a chunked input.\n    -S <socket> : Decrypt through the "
+          "rsad listening on <socket>.\n    -j <file>   : Write counters and phase "
+          "timings as JSON to <file>, - for stderr.\n    -v          : Enable "
           "verbose output.\n    -h          : Display program synopsis and "
           "usage.\n");
       fclose(infile);
@@ -69,7 +156,31 @@ int main(int argc, char **argv) {
       return 1;
     }
   }
-  FILE *priv_fs = fopen(priv_file, "r");        // opening file stream for private key file
+  if (socket_path != NULL && ranged) {
+    gmp_fprintf(stderr, "byte ranges cannot be decrypted through rsad.\n");
+    fclose(infile);
+    fclose(outfile);
+    return 1;
+  }
+  if (store_file != NULL && (label == NULL || socket_path != NULL)) {
+    gmp_fprintf(stderr, "a keystore needs a label (-u) and cannot be used with -S.\n");
+    fclose(infile);
+    fclose(outfile);
+    return 1;
+  }
+  if (stats_file != NULL) {
+    stats_enable();
+  }
+  if (socket_path != NULL) {                    // the daemon already holds the prepared key
+    bool ok = service_run_file(socket_path, label != NULL ? SERVICE_DECRYPT_AS : SERVICE_DECRYPT, format, label, infile, outfile);
+    if (stats_file != NULL) {
+      stats_write(stats_file, "decrypt");
+    }
+    fclose(infile);
+    fclose(outfile);
+    return ok ? 0 : 1;
+  }
+  FILE *priv_fs = fopen(store_file != NULL ? store_file : priv_file, "r");   // opening file stream for private key or keystore file
   if (priv_fs == NULL) {                        // exits program if file cannot be opened
     gmp_fprintf(stderr, "cannot open specified private key file");
     fclose(infile);
@@ -77,22 +188,45 @@ int main(int argc, char **argv) {
     fclose(priv_fs);
     return 1;
   }
-  mpz_t n, d;
-  mpz_inits(n, d, NULL);                        // initializing mpz vars
+  rsa_priv_t key;
+  rsa_priv_init(&key);                          // initializing private key
 
-  rsa_read_priv(n, d, priv_fs);                 // reading private key from file
+  uint64_t start = stats_start();
+  bool loaded = store_file != NULL ? read_store_priv(priv_fs, label, &key) : rsa_read_priv(&key, priv_fs);   // reading private key, text or binary; CRT values are optional
+  stats_stop(STATS_KEY_LOAD, start, 1);
+  if (!loaded) {
+    gmp_fprintf(stderr, store_file != NULL ? "no private key for that label in specified keystore\n" : "cannot read specified private key file\n");
+    fclose(infile);
+    fclose(outfile);
+    fclose(priv_fs);
+    rsa_priv_clear(&key);
+    return 1;
+  }
 
   if (verbose == 1) { // verbose output
     gmp_fprintf(
         stderr,
         "n - modulus (%lu bits): %Zd\nd - private exponent (%lu bits): %Zd\n",
-        mpz_sizeinbase(n, 2), n, mpz_sizeinbase(d, 2), d);
+        mpz_sizeinbase(key.n, 2), key.n, mpz_sizeinbase(key.d, 2), key.d);
+    if (rsa_priv_has_crt(&key)) {
+      gmp_fprintf(stderr, "p (%lu bits): %Zd\nq (%lu bits): %Zd\n",
+                  mpz_sizeinbase(key.p, 2), key.p, mpz_sizeinbase(key.q, 2), key.q);
+    }
+  }
+  bool ok = true;
+  if (ranged) {                                 // reads only the chunks that hold the range
+    ok = rsa_decrypt_range(infile, outfile, &key, threads, offset, length);
+  } else {
+    ok = rsa_decrypt_file(infile, outfile, &key, threads, format);   // decrypting input file and writing to output file
+  }
+  if (stats_file != NULL) {
+    fflush(outfile);                            // output still buffered counts as written
+    stats_write(stats_file, "decrypt");
   }
-  rsa_decrypt_file(infile, outfile, n, d);      // decrypting input file and writing to output file
 
   fclose(infile);                               // closing file streams and clearing mpz vars
   fclose(outfile);
   fclose(priv_fs);
-  mpz_clears(n, d, NULL);
-  return 0;
+  rsa_priv_clear(&key);
+  return ok ? 0 : 1;
 }
@@ -9,18 +9,47 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
+#include "keyfile.h"
+#include "keystore.h"
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "service.h"
+#include "stats.h"
 // clang-format on
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:k:u:t:f:S:j:vh"
+
+static bool read_store_pub(FILE *store_fs, const char *label, mpz_t n, mpz_t e, mpz_t s, char **username) {   // rsa_read_pub for the key stored under label
+  keystore_t ks;
+  if (!keystore_open(&ks, store_fs)) {
+    return false;
+  }
+  keyfile_pub_t kp;
+  keyfile_pub_init(&kp);
+  bool ok = keystore_read_pub(&ks, label, &kp) && strcmp(kp.username, label) == 0;   // a key signed for another name is not this recipient's
+  mpz_swap(n, kp.n);
+  mpz_swap(e, kp.e);
+  mpz_swap(s, kp.s);
+  free(*username);
+  *username = kp.username;
+  kp.username = NULL;
+  keyfile_pub_clear(&kp);
+  keystore_close(&ks);
+  return ok;
+}
 
 int main(int argc, char **argv) {
   FILE *infile = stdin;                     // default input set to stdin
   FILE *outfile = stdout;                   // default output set to stdout
   char pub_file[] = "rsa.pub";              // default public key file
-  char input[300];                          // initializing username string array
+  char *input = NULL;                       // username, allocated by rsa_read_pub
+  char *store_file = NULL;                  // keystore holding the key instead of pub_file
+  char *label = NULL;                       // recipient's label in the keystore or in rsad's keystore
+  uint64_t threads = 1;                     // default num of worker threads
+  rsa_format_t format = RSA_FORMAT_HEX;     // default ciphertext format: hexstrings
+  char *socket_path = NULL;                 // daemon to hand the work to; NULL encrypts locally
+  char *stats_file = NULL;                  // where to report counters and timings; NULL counts nothing
   int verbose = 0;                          // verbose set to false
   int opt = 0;
   while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -33,11 +62,44 @@ int main(int argc, char **argv) {
       }
       break;
     case 'o':                               // specify output file to write ciphertext to
-      outfile = fopen(optarg, "w");
+      outfile = fopen(optarg, "w+");
       break;
     case 'n':                               // specify file containing public key
       strcpy(pub_file, optarg);
       break;
+    case 'k':                               // specify keystore containing the public key
+      store_file = optarg;
+      break;
+    case 'u':                               // specify recipient label to look up
+      label = optarg;
+      break;
+    case 't':                               // specify num of worker threads and exit if input is invalid
+      threads = strtoul(optarg, NULL, 10);
+      if (threads < 1 || threads > 1024) {
+        gmp_fprintf(stderr, "number of threads must be within 1-1024, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'f':                               // specify ciphertext format and exit if input is invalid
+      if (strcmp(optarg, "hex") == 0) {
+        format = RSA_FORMAT_HEX;
+      } else if (strcmp(optarg, "bin") == 0) {
+        format = RSA_FORMAT_BIN;
+      } else if (strcmp(optarg, "hybrid") == 0) {
+        format = RSA_FORMAT_HYBRID;
+      } else if (strcmp(optarg, "chunked") == 0) {
+        format = RSA_FORMAT_CHUNKED;
+      } else {
+        gmp_fprintf(stderr, "format must be hex, bin, hybrid or chunked.\n");
+        return 1;
+      }
+      break;
+    case 'S':                               // send the input to a running rsad instead of loading the key
+      socket_path = optarg;
+      break;
+    case 'j':                               // report counters and timings as JSON
+      stats_file = optarg;
+      break;
     case 'v':                               // enable verbose output
       verbose = 1;
       break;
@@ -49,7 +111,13 @@ int main(int argc, char **argv) {
           "specified output file.\n    -i <infile> : Read input from <infile>. "
           "Default: standard input.\n    -o <outfile>: Write output to "
           "<outfile>. Default: standard output.\n    -n <keyfile>: Public key "
-          "is in <keyfile>. Default: rsa.pub.\n    -v          : Enable "
+          "is in <keyfile>. Default: rsa.pub.\n    -k <store>  : Public key is "
+          "in keystore <store>, under the -u label.\n    -u <label>  : Encrypt "
+          "for <label> from -k or from the rsad keystore.\n    -t <threads>: Use <threads> "
+          "worker threads. Default: 1.\n    -f <format> : Write ciphertext "
+          "as hex, bin, hybrid or chunked. Default: hex.\n    -S <socket> : Encrypt through the "
+          "rsad listening on <socket>.\n    -j <file>   : Write counters and phase "
+          "timings as JSON to <file>, - for stderr.\n    -v          : Enable "
           "verbose output.\n    -h          : Display program synopsis and "
           "usage.\n");
       fclose(infile);
@@ -63,7 +131,13 @@ int main(int argc, char **argv) {
           "specified output file.\n    -i <infile> : Read input from <infile>. "
           "Default: standard input.\n    -o <outfile>: Write output to "
           "<outfile>. Default: standard output.\n    -n <keyfile>: Public key "
-          "is in <keyfile>. Default: rsa.pub.\n    -v          : Enable "
+          "is in <keyfile>. Default: rsa.pub.\n    -k <store>  : Public key is "
+          "in keystore <store>, under the -u label.\n    -u <label>  : Encrypt "
+          "for <label> from -k or from the rsad keystore.\n    -t <threads>: Use <threads> "
+          "worker threads. Default: 1.\n    -f <format> : Write ciphertext "
+          "as hex, bin, hybrid or chunked. Default: hex.\n    -S <socket> : Encrypt through the "
+          "rsad listening on <socket>.\n    -j <file>   : Write counters and phase "
+          "timings as JSON to <file>, - for stderr.\n    -v          : Enable "
           "verbose output.\n    -h          : Display program synopsis and "
           "usage.\n");
       fclose(infile);
@@ -71,7 +145,25 @@ int main(int argc, char **argv) {
       return 1;
     }
   }
-  FILE *pub_fs = fopen(pub_file, "r");      // opens specified public file
+  if (store_file != NULL && (label == NULL || socket_path != NULL)) {
+    gmp_fprintf(stderr, "a keystore needs a label (-u) and cannot be used with -S.\n");
+    fclose(infile);
+    fclose(outfile);
+    return 1;
+  }
+  if (stats_file != NULL) {
+    stats_enable();
+  }
+  if (socket_path != NULL) {                // the daemon already holds the verified key
+    bool ok = service_run_file(socket_path, label != NULL ? SERVICE_ENCRYPT_TO : SERVICE_ENCRYPT, format, label, infile, outfile);
+    if (stats_file != NULL) {
+      stats_write(stats_file, "encrypt");
+    }
+    fclose(infile);
+    fclose(outfile);
+    return ok ? 0 : 1;
+  }
+  FILE *pub_fs = fopen(store_file != NULL ? store_file : pub_file, "r");   // opens specified public key or keystore file
   if (pub_fs == NULL) {                     // exits program if file cannot be opened
     gmp_fprintf(stderr, "cannot open specified public key file");
     fclose(infile);
@@ -81,7 +173,18 @@ int main(int argc, char **argv) {
   }
   mpz_t n, e, s, username;
   mpz_inits(n, e, s, username, NULL);       // initializing mpz vars
-  rsa_read_pub(n, e, s, input, pub_fs);     // reading key from public key file
+  uint64_t start = stats_start();
+  bool loaded = store_file != NULL ? read_store_pub(pub_fs, label, n, e, s, &input) : rsa_read_pub(n, e, s, &input, pub_fs);   // reading key, text or binary
+  stats_stop(STATS_KEY_LOAD, start, 1);
+  if (!loaded) {
+    gmp_fprintf(stderr, store_file != NULL ? "no public key for that label in specified keystore\n" : "cannot read specified public key file\n");
+    fclose(infile);
+    fclose(outfile);
+    fclose(pub_fs);
+    mpz_clears(n, e, s, username, NULL);
+    free(input);
+    return 1;
+  }
   if (verbose == 1) {                       // prints verbose output
     gmp_fprintf(stderr,
                 "username: %s\nuser signature(%lu bits): %Zd\nn - modulus (%lu "
@@ -90,19 +193,28 @@ int main(int argc, char **argv) {
                 mpz_sizeinbase(e, 2), e);
   }
   mpz_set_str(username, input, 62);                     // converts username into an mpz_t
-  if (rsa_verify(username, s, e, n) == false) {         // verifies signature; if it cannot verify, exit program
+  start = stats_start();
+  bool verified = rsa_verify(username, s, e, n);
+  stats_stop(STATS_KEY_VERIFY, start, 1);
+  if (verified == false) {                              // verifies signature; if it cannot verify, exit program
     gmp_fprintf(stderr, "could not verify signature\n");
     fclose(infile);
     fclose(outfile);
     fclose(pub_fs);
     mpz_clears(n, e, s, username, NULL);
+    free(input);
     return 1;
   }
-  rsa_encrypt_file(infile, outfile, n, e);              // encrypts input file and writes output to output file
+  bool ok = rsa_encrypt_file(infile, outfile, n, e, threads, format);   // encrypts input file and writes output to output file
+  if (stats_file != NULL) {
+    fflush(outfile);                                    // output still buffered counts as written
+    stats_write(stats_file, "encrypt");
+  }
 
   fclose(infile);                                       // closing file streams and clearing mpz vars
   fclose(outfile);
   fclose(pub_fs);
   mpz_clears(n, e, s, username, NULL);
-  return 0;
+  free(input);
+  return ok ? 0 : 1;
 }
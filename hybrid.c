@@ -0,0 +1,172 @@
+/*********************************************************************************
+* hybrid.c
+* Hybrid file encryption: an RSA-encapsulated session key followed by
+* ChaCha20-Poly1305 chunks, for bulk data at stream cipher speed
+*********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "hybrid.h"
+#include "chacha.h"
+#include "container.h"
+#include "numtheory.h"
+#include "sha256.h"
+#include "stats.h"
+
+static bool random_below(mpz_t r, mpz_t n, uint8_t *buf, uint32_t modbytes) {   // uniform r in [2, n) from the system's random source
+  size_t bits = mpz_sizeinbase(n, 2);
+  do {
+    if (getrandom(buf, modbytes, 0) != (ssize_t)modbytes) {
+      return false;
+    }
+    mpz_import(r, modbytes, 1, 1, 1, 0, buf);
+    mpz_tdiv_r_2exp(r, r, bits);                        // same length as n, so at least half the draws are accepted
+  } while (mpz_cmp(r, n) >= 0 || mpz_cmp_ui(r, 2) < 0);
+  return true;
+}
+
+static void session_key(uint8_t key[CHACHA_KEY_SIZE], mpz_t r, uint8_t *buf, uint32_t modbytes) {   // KDF: SHA-256 of r as a fixed-width block
+  container_put_block(buf, r, modbytes);
+  sha256(key, buf, modbytes);
+  memset(buf, 0, modbytes);
+}
+
+static void chunk_nonce(uint8_t nonce[CHACHA_NONCE_SIZE], uint64_t index, bool final) {
+  memset(nonce, 0, CHACHA_NONCE_SIZE);
+  nonce[0] = final;
+  for (int i = 0; i < 8; i++) {
+    nonce[4 + i] = index >> (56 - 8 * i);
+  }
+}
+
+static bool at_end(FILE *file) {                        // peeks one byte to see whether the stream is exhausted
+  int c = getc(file);
+  if (c == EOF) {
+    return true;
+  }
+  ungetc(c, file);
+  return false;
+}
+
+bool hybrid_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {   // writes the header and wrapped key, then the chunks
+  uint32_t modbytes = container_modbytes(n);
+  uint8_t *block = (uint8_t *)malloc(modbytes);
+  uint8_t key[CHACHA_KEY_SIZE];
+  mpz_t r, c;
+  mpz_inits(r, c, NULL);
+  if (!random_below(r, n, block, modbytes)) {
+    gmp_fprintf(stderr, "cannot draw a random session key\n");
+    mpz_clears(r, c, NULL);
+    free(block);
+    return false;
+  }
+  uint64_t start = stats_start();
+  pow_mod(c, r, e, n);                                  // the only RSA operation for the whole file
+  stats_stop(STATS_POW, start, 1);
+  session_key(key, r, block, modbytes);
+
+  uint8_t header[HYBRID_HEADER_SIZE] = { 0 };
+  memcpy(header, HYBRID_MAGIC, 4);
+  header[4] = HYBRID_VERSION;
+  for (int i = 0; i < 4; i++) {
+    header[8 + i] = modbytes >> (24 - 8 * i);
+  }
+  fwrite(header, 1, HYBRID_HEADER_SIZE, outfile);
+  container_put_block(block, c, modbytes);
+  fwrite(block, 1, modbytes, outfile);
+
+  uint8_t *plain = (uint8_t *)malloc(HYBRID_CHUNK);
+  uint8_t *cipher = (uint8_t *)malloc(HYBRID_CHUNK + POLY1305_TAG_SIZE);
+  uint8_t nonce[CHACHA_NONCE_SIZE];
+  bool final = false;
+  for (uint64_t i = 0; !final; i++) {                   // a short read only happens at the end, which makes that chunk final
+    uint64_t start = stats_start();
+    size_t len = fread(plain, 1, HYBRID_CHUNK, infile);
+    final = len < HYBRID_CHUNK || at_end(infile);
+    stats_stop(STATS_READ, start, 1);
+    start = stats_start();
+    chunk_nonce(nonce, i, final);
+    chacha_poly_seal(key, nonce, cipher, plain, len, cipher + len);
+    stats_stop(STATS_CIPHER, start, 1);
+    start = stats_start();
+    fwrite(cipher, 1, len + POLY1305_TAG_SIZE, outfile);
+    stats_stop(STATS_WRITE, start, 1);
+  }
+  memset(key, 0, sizeof(key));
+  memset(plain, 0, HYBRID_CHUNK);
+  mpz_clears(r, c, NULL);
+  free(plain);
+  free(cipher);
+  free(block);
+  return true;
+}
+
+bool hybrid_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key) {   // unwraps the session key, then checks and decrypts each chunk
+  uint8_t header[HYBRID_HEADER_SIZE];
+  uint32_t modbytes = container_modbytes(key->n);
+  if (fread(header + 4, 1, HYBRID_HEADER_SIZE - 4, infile) != HYBRID_HEADER_SIZE - 4 || header[4] != HYBRID_VERSION) {
+    gmp_fprintf(stderr, "input is not a hybrid ciphertext\n");
+    return false;
+  }
+  uint32_t width = (uint32_t)header[8] << 24 | (uint32_t)header[9] << 16 | (uint32_t)header[10] << 8 | header[11];
+  if (width != modbytes) {
+    gmp_fprintf(stderr, "session key does not match the size of the private key\n");
+    return false;
+  }
+  uint8_t *block = (uint8_t *)malloc(modbytes);
+  mpz_t r, c;
+  mpz_inits(r, c, NULL);
+  bool ok = fread(block, 1, modbytes, infile) == modbytes;
+  if (ok) {
+    container_get_block(c, block, modbytes);
+    ok = mpz_cmp(c, key->n) < 0;
+  }
+  if (!ok) {
+    gmp_fprintf(stderr, "input has no valid session key\n");
+    mpz_clears(r, c, NULL);
+    free(block);
+    return false;
+  }
+  uint8_t skey[CHACHA_KEY_SIZE];
+  uint64_t start = stats_start();
+  rsa_decrypt(r, c, key);
+  stats_stop(STATS_POW, start, 1);
+  session_key(skey, r, block, modbytes);
+
+  uint8_t *cipher = (uint8_t *)malloc(HYBRID_CHUNK + POLY1305_TAG_SIZE);
+  uint8_t *plain = (uint8_t *)malloc(HYBRID_CHUNK);
+  uint8_t nonce[CHACHA_NONCE_SIZE];
+  bool final = false;
+  for (uint64_t i = 0; ok && !final; i++) {
+    start = stats_start();
+    size_t len = fread(cipher, 1, HYBRID_CHUNK + POLY1305_TAG_SIZE, infile);
+    stats_stop(STATS_READ, start, 1);
+    if (len < POLY1305_TAG_SIZE) {
+      gmp_fprintf(stderr, "ciphertext is truncated\n");
+      ok = false;
+      break;
+    }
+    len -= POLY1305_TAG_SIZE;
+    final = len < HYBRID_CHUNK || at_end(infile);
+    chunk_nonce(nonce, i, final);
+    start = stats_start();
+    bool authentic = chacha_poly_open(skey, nonce, plain, cipher, len, cipher + len);
+    stats_stop(STATS_CIPHER, start, 1);
+    if (!authentic) {                                   // wrong key, tampering, or a cut at a chunk boundary
+      gmp_fprintf(stderr, "ciphertext failed authentication at chunk %lu\n", i);
+      ok = false;
+      break;
+    }
+    start = stats_start();
+    fwrite(plain, 1, len, outfile);
+    stats_stop(STATS_WRITE, start, 1);
+  }
+  memset(skey, 0, sizeof(skey));
+  memset(plain, 0, HYBRID_CHUNK);
+  mpz_clears(r, c, NULL);
+  free(cipher);
+  free(plain);
+  free(block);
+  return ok;
+}
@@ -0,0 +1,33 @@
+/*********************************************************************************
+* hybrid.h
+* Interface for hybrid.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "rsa.h"
+
+#define HYBRID_MAGIC "RSAH"                // first four bytes of a hybrid ciphertext file
+#define HYBRID_VERSION 1
+#define HYBRID_HEADER_SIZE 12              // magic, version, 3 reserved bytes, modulus size
+#define HYBRID_CHUNK 65536                 // plaintext bytes per authenticated chunk
+
+//
+// Hybrid ciphertext: RSA only wraps a session key, and the data itself is
+// encrypted with ChaCha20-Poly1305.
+// Layout, all integers big-endian:
+//   header:  magic, u8 version, 3 reserved bytes, u32 modbytes
+//   key:     c = r^e mod n for a random r below n, as a modbytes-wide block;
+//            the session key is SHA-256 of r as a modbytes-wide block (RSA-KEM)
+//   chunks:  HYBRID_CHUNK bytes of ciphertext and a 16-byte tag each; the
+//            last chunk is shorter (possibly empty) and marked final in its
+//            nonce, so truncation and reordering are detected
+// Chunk i uses the nonce: final flag byte, 3 zero bytes, u64 i.
+//
+bool hybrid_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);   // encrypts a whole stream; false if no random session key could be drawn
+
+bool hybrid_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key);   // decrypts a stream positioned just past its magic; false on a bad header or tag, after the chunks before it were written
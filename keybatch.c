@@ -0,0 +1,226 @@
+/*********************************************************************************
+* keybatch.c
+* Batch key generation: many labelled key pairs per invocation
+*********************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "keybatch.h"
+#include "keyfile.h"
+#include "keystore.h"
+#include "randstate.h"
+#include "rsa.h"
+
+typedef struct {                                          // state shared by the batch workers
+  keybatch_opts_t *opts;
+  char **labels;
+  uint64_t count;
+  uint64_t next;                                          // next label to take
+  uint64_t done;                                          // pairs finished
+  bool failed;
+  keystore_writer_t store;
+  double start;                                           // batch start time, in seconds
+  double last_report;
+  pthread_mutex_t lock;
+} keybatch_t;
+
+static double now(void) {                                 // monotonic clock, in seconds
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool write_pair_files(const char *dir, const char *label, mpz_t n, mpz_t e, mpz_t s, rsa_priv_t *priv, bool binary) {   // writes <dir>/<label>.pub and .priv
+  size_t len = strlen(dir) + strlen(label) + 7;
+  char *path = (char *)malloc(len);
+  snprintf(path, len, "%s/%s.pub", dir, label);
+  FILE *pub_fs = fopen(path, "w");
+  snprintf(path, len, "%s/%s.priv", dir, label);
+  FILE *priv_fs = fopen(path, "w");
+  free(path);
+  if (pub_fs == NULL || priv_fs == NULL) {
+    if (pub_fs != NULL) {
+      fclose(pub_fs);
+    }
+    if (priv_fs != NULL) {
+      fclose(priv_fs);
+    }
+    return false;
+  }
+  fchmod(fileno(priv_fs), 0600);                          // private keys are readable by the user only
+  if (binary) {
+    keyfile_write_pub(pub_fs, n, e, s, label, true);
+    keyfile_write_priv(priv_fs, priv, true);
+  } else {
+    rsa_write_pub(n, e, s, (char *)label, pub_fs);
+    rsa_write_priv(priv, priv_fs);
+  }
+  fclose(pub_fs);
+  fclose(priv_fs);
+  return true;
+}
+
+static void *keybatch_worker(void *arg) {                 // takes labels until none are left
+  keybatch_t *batch = (keybatch_t *)arg;
+  keybatch_opts_t *opts = batch->opts;
+  mpz_t p, q, n, e, username, sig;
+  mpz_inits(p, q, n, e, username, sig, NULL);
+  mpz_t primes[RSA_MAX_PRIMES];                           // multi-prime keys only
+  for (int i = 0; i < RSA_MAX_PRIMES; i++) {
+    mpz_init(primes[i]);
+  }
+  rsa_priv_t priv;
+  rsa_priv_init(&priv);
+
+  while (1) {
+    pthread_mutex_lock(&batch->lock);
+    uint64_t i = batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    if (i >= batch->count) {
+      break;
+    }
+    const char *label = batch->labels[i];
+    gmp_randstate_t rs;
+    randstate_derive(rs, i);                              // stream i belongs to key i, whichever thread runs it
+    if (opts->primes > 2) {
+      rsa_make_pub_multi_r(primes, opts->primes, n, e, opts->nbits, opts->iters, opts->fixed_e, rs);
+      rsa_make_priv_multi(&priv, e, primes, opts->primes);
+    } else {
+      rsa_make_pub_r(p, q, n, e, opts->nbits, opts->iters, opts->fixed_e, rs);
+      rsa_make_priv(&priv, e, p, q);
+    }
+    gmp_randclear(rs);
+    mpz_set_str(username, label, 62);                     // signs the label the same way keygen signs $USER
+    rsa_sign(sig, username, &priv);
+
+    bool ok = true;
+    pthread_mutex_lock(&batch->lock);
+    if (opts->keystore != NULL) {                         // records go to one file, so they are appended under the lock
+      keystore_add(&batch->store, label, n, e, sig, &priv, opts->binary);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (opts->keystore == NULL) {
+      ok = write_pair_files(opts->dir, label, n, e, sig, &priv, opts->binary);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    if (!ok) {
+      gmp_fprintf(stderr, "cannot write key files for %s\n", label);
+      batch->failed = true;
+    }
+    batch->done += 1;
+    double t = now();
+    if (t - batch->last_report >= 1.0 || batch->done == batch->count) {   // reports at most once a second, and at the end
+      gmp_fprintf(stderr, "%lu/%lu keys, %.1f keys/sec\n", batch->done, batch->count, batch->done / (t - batch->start));
+      batch->last_report = t;
+    }
+    pthread_mutex_unlock(&batch->lock);
+  }
+  rsa_priv_clear(&priv);
+  mpz_clears(p, q, n, e, username, sig, NULL);
+  for (int i = 0; i < RSA_MAX_PRIMES; i++) {
+    mpz_clear(primes[i]);
+  }
+  return NULL;
+}
+
+static bool valid_label(const char *label) {              // labels become file names and are signed as base-62 numbers
+  if (label[0] == '\0') {
+    return false;
+  }
+  for (const char *c = label; *c != '\0'; c++) {         // the digits mpz_set_str takes in base 62; anything else would sign a stale value
+    if (!((*c >= '0' && *c <= '9') || (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint64_t *label_slot(char **labels, uint64_t *slots, uint64_t mask, const char *label) {   // the slot holding label, or the empty slot it would take
+  uint64_t slot = keystore_hash(label) & mask;            // linear probing, as in the keystore index
+  while (slots[slot] != 0 && strcmp(labels[slots[slot] - 1], label) != 0) {
+    slot = (slot + 1) & mask;
+  }
+  return &slots[slot];
+}
+
+int keybatch_run(FILE *labels, keybatch_opts_t *opts) {   // generates one key pair per label
+  keybatch_t batch;
+  batch.opts = opts;
+  batch.count = 0;
+  batch.next = 0;
+  batch.done = 0;
+  batch.failed = false;
+  uint64_t cap = 64;
+  batch.labels = (char **)malloc(cap * sizeof(char *));
+  uint64_t *slots = (uint64_t *)calloc(2 * cap, sizeof(uint64_t));   // index + 1 of each label read, 0 when empty; at most half full
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, labels)) != -1) {   // one label per line; blank lines are skipped
+    if (len > 0 && line[len - 1] == '\n') {
+      line[len - 1] = '\0';
+    }
+    if (line[0] == '\0') {
+      continue;
+    }
+    if (!valid_label(line)) {
+      gmp_fprintf(stderr, "invalid label: %s\n", line);
+      batch.failed = true;
+      continue;
+    }
+    uint64_t *slot = label_slot(batch.labels, slots, 2 * cap - 1, line);
+    if (*slot != 0) {                                     // a second pair would overwrite or shadow the first
+      gmp_fprintf(stderr, "repeated label: %s\n", line);
+      batch.failed = true;
+      continue;
+    }
+    batch.labels[batch.count++] = strdup(line);
+    *slot = batch.count;
+    if (batch.count == cap) {
+      cap *= 2;
+      batch.labels = (char **)realloc(batch.labels, cap * sizeof(char *));
+      free(slots);
+      slots = (uint64_t *)calloc(2 * cap, sizeof(uint64_t));
+      for (uint64_t i = 0; i < batch.count; i++) {
+        *label_slot(batch.labels, slots, 2 * cap - 1, batch.labels[i]) = i + 1;
+      }
+    }
+  }
+  free(line);
+  free(slots);
+
+  bool store_open = opts->keystore != NULL && keystore_create(&batch.store, opts->keystore);
+  if (opts->keystore != NULL && !store_open) {
+    gmp_fprintf(stderr, "cannot write keystore\n");
+    batch.failed = true;
+    batch.count = 0;
+  }
+  pthread_mutex_init(&batch.lock, NULL);
+  batch.start = now();
+  batch.last_report = batch.start;
+  uint64_t threads = opts->threads < 1 ? 1 : opts->threads;
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_create(&tids[t], NULL, keybatch_worker, &batch);
+  }
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+  }
+  free(tids);
+  pthread_mutex_destroy(&batch.lock);
+  if (store_open && !keystore_finish(&batch.store)) {
+    gmp_fprintf(stderr, "cannot write keystore index\n");
+    batch.failed = true;
+  }
+
+  for (uint64_t i = 0; i < batch.count; i++) {
+    free(batch.labels[i]);
+  }
+  free(batch.labels);
+  return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+/*********************************************************************************
+* keybatch.h
+* Interface for keybatch.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// Settings for a batch of key pairs.
+// Exactly one of dir and keystore is used; keystore takes precedence.
+//
+typedef struct {
+  uint64_t nbits;                          // bits in each public modulus
+  uint64_t iters;                          // Miller-Rabin iterations, or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW
+  uint64_t fixed_e;                        // fixed public exponent, or 0 for random
+  uint64_t threads;                        // keys generated at the same time
+  const char *dir;                         // directory receiving <label>.pub and <label>.priv
+  FILE *keystore;                          // keystore file receiving every pair, or NULL
+  bool binary;                             // binary key files (keyfile.h) with precomputed values instead of text
+  uint64_t primes;                         // primes in each modulus, 2 to RSA_MAX_PRIMES
+} keybatch_opts_t;
+
+//
+// Generates one key pair per label, spreading the labels over a thread pool.
+// Labels are read one per line; each must be non-empty, made only of the
+// letters and digits 0-9, A-Z and a-z, since it is signed as a base-62
+// number, and not repeat an earlier label. Key i draws from random stream i
+// of the seed given to randstate_init, so the keys do not depend on which
+// thread made them.
+// Progress and keys/sec are reported on stderr.
+//
+// labels: the file listing the labels.
+// opts: the batch settings.
+// returns: 0 on success, 1 if any label or output file was rejected.
+//
+int keybatch_run(FILE *labels, keybatch_opts_t *opts);
@@ -0,0 +1,200 @@
+/*********************************************************************************
+* keycache.c
+* LRU cache of prepared keys read from a keystore, so that a service routing
+* to many recipients parses, checks and prepares each key once
+*********************************************************************************/
+
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "keycache.h"
+#include "keyfile.h"
+
+void keycache_init(keycache_t *kc, keystore_t *store, size_t cap, uint64_t lanes) {   // buckets sized for cap entries
+  kc->store = store;
+  kc->lanes = lanes < 1 ? 1 : lanes;
+  kc->cap = cap < 1 ? 1 : cap;
+  kc->count = 0;
+  kc->buckets = 16;
+  while (kc->buckets < kc->cap) {                       // chains stay about one entry long when full
+    kc->buckets *= 2;
+  }
+  kc->table = (keycache_entry_t **)calloc(kc->buckets, sizeof(keycache_entry_t *));
+  kc->head = NULL;
+  kc->tail = NULL;
+  kc->hits = 0;
+  kc->misses = 0;
+  pthread_mutex_init(&kc->lock, NULL);
+}
+
+static void entry_free(keycache_entry_t *e) {
+  if (e->has_pub) {
+    rsa_pub_key_clear(&e->pub);
+  }
+  if (e->has_priv) {
+    rsa_priv_key_clear(&e->priv);
+  }
+  free(e->label);
+  free(e);
+}
+
+void keycache_clear(keycache_t *kc) {
+  keycache_entry_t *e = kc->head;
+  while (e != NULL) {
+    keycache_entry_t *next = e->next;
+    entry_free(e);
+    e = next;
+  }
+  free(kc->table);
+  pthread_mutex_destroy(&kc->lock);
+}
+
+static keycache_entry_t *find(keycache_t *kc, const char *label, uint64_t hash) {   // the entry for label, or NULL
+  for (keycache_entry_t *e = kc->table[hash & (kc->buckets - 1)]; e != NULL; e = e->chain) {
+    if (e->hash == hash && strcmp(e->label, label) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void lru_unlink(keycache_t *kc, keycache_entry_t *e) {   // takes e out of the recency list
+  if (e->prev != NULL) {
+    e->prev->next = e->next;
+  } else {
+    kc->head = e->next;
+  }
+  if (e->next != NULL) {
+    e->next->prev = e->prev;
+  } else {
+    kc->tail = e->prev;
+  }
+}
+
+static void lru_push(keycache_t *kc, keycache_entry_t *e) {    // makes e the most recently used
+  e->prev = NULL;
+  e->next = kc->head;
+  if (kc->head != NULL) {
+    kc->head->prev = e;
+  } else {
+    kc->tail = e;
+  }
+  kc->head = e;
+}
+
+static void evict(keycache_t *kc) {                     // drops unheld entries from the old end until the cache fits
+  keycache_entry_t *e = kc->tail;
+  while (kc->count > kc->cap && e != NULL) {
+    keycache_entry_t *prev = e->prev;
+    if (e->refs == 0) {
+      lru_unlink(kc, e);
+      keycache_entry_t **link = &kc->table[e->hash & (kc->buckets - 1)];
+      while (*link != e) {
+        link = &(*link)->chain;
+      }
+      *link = e->chain;
+      entry_free(e);
+      kc->count -= 1;
+    }
+    e = prev;
+  }
+}
+
+static bool load_pub(keycache_t *kc, const char *label, rsa_pub_key_t *pub) {   // reads, checks and prepares a public key
+  keyfile_pub_t kp;
+  keyfile_pub_init(&kp);
+  bool ok = keystore_read_pub(kc->store, label, &kp) && strcmp(kp.username, label) == 0;   // the key must be signed for this label
+  if (ok) {
+    mpz_t username;
+    mpz_init(username);
+    mpz_set_str(username, kp.username, 62);
+    ok = rsa_verify(username, kp.s, kp.e, kp.n);
+    mpz_clear(username);
+  }
+  if (ok) {
+    rsa_pub_prepare_ctx(pub, kp.n, kp.e, kc->lanes, kp.has_plan ? &kp.plan : NULL, kp.has_mont ? &kp.mont : NULL);
+  }
+  keyfile_pub_clear(&kp);
+  return ok;
+}
+
+static bool load_priv(keycache_t *kc, const char *label, rsa_priv_key_t *priv) {   // reads and prepares a private key
+  keyfile_priv_t kp;
+  keyfile_priv_init(&kp);
+  bool ok = keystore_read_priv(kc->store, label, &kp);
+  if (ok) {
+    rsa_priv_prepare_ctx(priv, &kp.key, kc->lanes, kp.has_mp ? &kp.mp : NULL, kp.has_mq ? &kp.mq : NULL);
+  }
+  keyfile_priv_clear(&kp);
+  return ok;
+}
+
+keycache_entry_t *keycache_get(keycache_t *kc, const char *label, int want) {   // a hit costs one hash and a list move under the lock
+  uint64_t hash = keystore_hash(label);
+  rsa_pub_key_t pub;
+  rsa_priv_key_t priv;
+  int loaded = 0;                                       // parts prepared by this call and not yet handed to an entry
+  bool ok = true;
+  pthread_mutex_lock(&kc->lock);
+  keycache_entry_t *e = find(kc, label, hash);
+  int missing = want & ~(e == NULL ? 0 : (e->has_pub ? KEYCACHE_PUB : 0) | (e->has_priv ? KEYCACHE_PRIV : 0));
+  kc->hits += missing == 0;
+  kc->misses += missing != 0;
+  while (missing != 0 && ok) {
+    if ((missing & ~loaded) == 0) {                     // everything missing is ready: attach it
+      if (e == NULL) {
+        e = (keycache_entry_t *)calloc(1, sizeof(keycache_entry_t));
+        e->label = strdup(label);
+        e->hash = hash;
+        e->chain = kc->table[hash & (kc->buckets - 1)];
+        kc->table[hash & (kc->buckets - 1)] = e;
+        lru_push(kc, e);
+        kc->count += 1;
+      }
+      if (missing & KEYCACHE_PUB) {
+        e->pub = pub;
+        e->has_pub = true;
+        loaded &= ~KEYCACHE_PUB;
+      }
+      if (missing & KEYCACHE_PRIV) {
+        e->priv = priv;
+        e->has_priv = true;
+        loaded &= ~KEYCACHE_PRIV;
+      }
+      break;
+    }
+    int load = missing & ~loaded;
+    pthread_mutex_unlock(&kc->lock);                    // parsing and preparing take far longer than a hit
+    if (load & KEYCACHE_PUB) {
+      ok = load_pub(kc, label, &pub);
+      loaded |= ok ? KEYCACHE_PUB : 0;
+    }
+    if ((load & KEYCACHE_PRIV) && ok) {
+      ok = load_priv(kc, label, &priv);
+      loaded |= ok ? KEYCACHE_PRIV : 0;
+    }
+    pthread_mutex_lock(&kc->lock);
+    e = find(kc, label, hash);                          // another thread may have added or evicted it meanwhile
+    missing = want & ~(e == NULL ? 0 : (e->has_pub ? KEYCACHE_PUB : 0) | (e->has_priv ? KEYCACHE_PRIV : 0));
+  }
+  if (ok) {
+    e->refs += 1;
+    lru_unlink(kc, e);
+    lru_push(kc, e);
+    evict(kc);
+  }
+  pthread_mutex_unlock(&kc->lock);
+  if (loaded & KEYCACHE_PUB) {                          // prepared by this call, but another thread got there first
+    rsa_pub_key_clear(&pub);
+  }
+  if (loaded & KEYCACHE_PRIV) {
+    rsa_priv_key_clear(&priv);
+  }
+  return ok ? e : NULL;
+}
+
+void keycache_release(keycache_t *kc, keycache_entry_t *entry) {   // unpins the entry; eviction is left to the next keycache_get
+  pthread_mutex_lock(&kc->lock);
+  entry->refs -= 1;
+  pthread_mutex_unlock(&kc->lock);
+}
@@ -0,0 +1,62 @@
+/*********************************************************************************
+* keycache.h
+* Interface for keycache.c
+*********************************************************************************/
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystore.h"
+#include "rsa.h"
+
+#define KEYCACHE_PUB 1                     // keycache_get: the entry must hold the prepared public key
+#define KEYCACHE_PRIV 2                    // keycache_get: the entry must hold the prepared private key
+
+//
+// One label's prepared keys. Each part is loaded the first time it is asked
+// for and kept until the entry is evicted. Entries handed out by keycache_get
+// are pinned until keycache_release, so the cache never frees a key in use.
+//
+typedef struct keycache_entry {
+  char *label;
+  uint64_t hash;                           // keystore_hash of the label
+  bool has_pub;                            // pub is prepared and its username signature verified
+  rsa_pub_key_t pub;
+  bool has_priv;
+  rsa_priv_key_t priv;
+  uint64_t refs;                           // callers holding the entry
+  struct keycache_entry *prev;             // towards the most recently used entry
+  struct keycache_entry *next;             // towards the least recently used entry
+  struct keycache_entry *chain;            // next entry in the same hash bucket
+} keycache_entry_t;
+
+//
+// A bounded cache of prepared keys read from one keystore, evicting the
+// least recently used entries that nobody holds. Safe for any number of
+// threads; keys are read and prepared outside the lock, so a miss does not
+// hold up hits on other labels.
+//
+typedef struct {
+  keystore_t *store;
+  uint64_t lanes;                          // per-thread contexts in each prepared key
+  size_t cap;                              // entries kept once none are held
+  size_t count;
+  size_t buckets;                          // a power of two
+  keycache_entry_t **table;
+  keycache_entry_t *head;                  // most recently used
+  keycache_entry_t *tail;                  // least recently used
+  uint64_t hits;
+  uint64_t misses;
+  pthread_mutex_t lock;
+} keycache_t;
+
+void keycache_init(keycache_t *kc, keystore_t *store, size_t cap, uint64_t lanes);   // an empty cache of up to cap entries, each prepared for lanes threads
+
+void keycache_clear(keycache_t *kc);                                   // frees every entry; none may still be held
+
+keycache_entry_t *keycache_get(keycache_t *kc, const char *label, int want);   // the entry for label holding the KEYCACHE_* parts in want, loading them on a miss; NULL if the label is absent, a key is malformed or its signature does not verify
+
+void keycache_release(keycache_t *kc, keycache_entry_t *entry);        // gives back an entry from keycache_get
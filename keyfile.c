@@ -0,0 +1,405 @@
+/*********************************************************************************
+* keyfile.c
+* Binary key files with length-prefixed fields and optional precomputed
+* Montgomery constants, read alongside the hex text format
+*********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "keyfile.h"
+
+#define KEYFILE_TAGS 26                    // one past the largest tag this reader knows
+
+//
+// Every known field of one key file, as read, indexed by tag.
+//
+typedef struct {
+  uint8_t limb_bits;                       // limb size of the writer
+  uint8_t *data[KEYFILE_TAGS];             // field contents, or NULL if absent
+  uint32_t len[KEYFILE_TAGS];
+} keyfile_raw_t;
+
+//
+// Fields of a key file being written, gathered first so that the header can
+// give their count.
+//
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t count;
+} keyfile_buf_t;
+
+static void put_be(uint8_t *buf, uint64_t v, int len) {   // stores the low len bytes of v big-endian
+  for (int i = len - 1; i >= 0; i--) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t *buf, int len) {   // reads len bytes big-endian
+  uint64_t v = 0;
+  for (int i = 0; i < len; i++) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static void put_le64(uint8_t *buf, uint64_t v) {        // stores v as a little-endian word
+  for (int i = 0; i < 8; i++) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_le64(const uint8_t *buf) {          // reads a little-endian word
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+void keyfile_pub_init(keyfile_pub_t *kp) {              // all numbers 0, nothing precomputed
+  mpz_inits(kp->n, kp->e, kp->s, NULL);
+  kp->username = NULL;
+  kp->has_plan = false;
+  kp->has_mont = false;
+}
+
+void keyfile_pub_clear(keyfile_pub_t *kp) {
+  mpz_clears(kp->n, kp->e, kp->s, NULL);
+  free(kp->username);
+  if (kp->has_plan) {
+    mont_plan_clear(&kp->plan);
+  }
+  if (kp->has_mont) {
+    mont_clear(&kp->mont);
+  }
+}
+
+void keyfile_priv_init(keyfile_priv_t *kp) {
+  rsa_priv_init(&kp->key);
+  kp->has_mp = false;
+  kp->has_mq = false;
+}
+
+static void priv_mont_clear(keyfile_priv_t *kp) {
+  if (kp->has_mp) {
+    mont_clear(&kp->mp);
+  }
+  if (kp->has_mq) {
+    mont_clear(&kp->mq);
+  }
+  kp->has_mp = false;
+  kp->has_mq = false;
+}
+
+void keyfile_priv_clear(keyfile_priv_t *kp) {
+  rsa_priv_clear(&kp->key);
+  priv_mont_clear(kp);
+}
+
+bool keyfile_is_binary(FILE *file) {                    // hex text never starts with 'R'
+  int c = fgetc(file);
+  if (c == EOF) {
+    return false;
+  }
+  ungetc(c, file);
+  return c == KEYFILE_PUB_MAGIC[0];
+}
+
+static void raw_clear(keyfile_raw_t *raw) {
+  for (int t = 0; t < KEYFILE_TAGS; t++) {
+    free(raw->data[t]);
+  }
+}
+
+static bool raw_read(keyfile_raw_t *raw, FILE *file, const char *magic) {   // reads the header and every field; unknown tags are skipped
+  memset(raw, 0, sizeof(*raw));
+  uint8_t header[KEYFILE_HEADER_SIZE];
+  if (fread(header, 1, KEYFILE_HEADER_SIZE, file) != KEYFILE_HEADER_SIZE || memcmp(header, magic, 4) != 0) {
+    gmp_fprintf(stderr, "not a %s key file\n", magic[3] == 'P' ? "public" : "private");
+    return false;
+  }
+  if (header[4] != KEYFILE_VERSION) {
+    gmp_fprintf(stderr, "unsupported key file version %u\n", header[4]);
+    return false;
+  }
+  raw->limb_bits = header[5];
+  uint32_t count = get_be(header + 8, 4);
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t field[KEYFILE_FIELD_SIZE];
+    if (fread(field, 1, KEYFILE_FIELD_SIZE, file) != KEYFILE_FIELD_SIZE) {
+      gmp_fprintf(stderr, "key file is truncated\n");
+      return false;
+    }
+    uint16_t tag = get_be(field, 2);
+    uint32_t len = get_be(field + 4, 4);
+    if (len > KEYFILE_MAX_FIELD) {
+      gmp_fprintf(stderr, "key file field %u is too long\n", tag);
+      return false;
+    }
+    uint8_t *data = (uint8_t *)malloc(len > 0 ? len : 1);
+    if (fread(data, 1, len, file) != len) {
+      gmp_fprintf(stderr, "key file is truncated\n");
+      free(data);
+      return false;
+    }
+    if (tag >= KEYFILE_TAGS) {                          // written by a newer version; not needed here
+      free(data);
+      continue;
+    }
+    free(raw->data[tag]);                               // a repeated field replaces the earlier one
+    raw->data[tag] = data;
+    raw->len[tag] = len;
+  }
+  return true;
+}
+
+static bool raw_num(mpz_t z, keyfile_raw_t *raw, keyfile_tag_t tag) {   // imports a number field; false if absent
+  if (raw->data[tag] == NULL) {
+    return false;
+  }
+  mpz_import(z, raw->len[tag], 1, 1, 0, 0, raw->data[tag]);
+  return true;
+}
+
+static bool raw_mont(mont_ctx_t *ctx, keyfile_raw_t *raw, keyfile_tag_t tag, mpz_t m) {   // sets ctx from stored constants; false if absent or unusable here
+  mp_size_t size = mpz_size(m);
+  if (raw->data[tag] == NULL || raw->limb_bits != GMP_NUMB_BITS || GMP_NUMB_BITS != 64 || mpz_even_p(m) || mpz_cmp_ui(m, 1) <= 0 || raw->len[tag] != 8 + 16 * (size_t)size) {
+    return false;
+  }
+  const uint8_t *data = raw->data[tag];
+  mp_limb_t ninv = get_le64(data);
+  if (ninv * mpz_getlimbn(m, 0) != (mp_limb_t)-1) {     // n0 * ninv = -1 mod 2^64 is cheap to check
+    return false;
+  }
+  mp_limb_t *consts = (mp_limb_t *)malloc(2 * size * sizeof(mp_limb_t));
+  for (mp_size_t i = 0; i < 2 * size; i++) {
+    consts[i] = get_le64(data + 8 + 8 * i);
+  }
+  const mp_limb_t *np = mpz_limbs_read(m);
+  bool ok = mpn_cmp(consts, np, size) < 0 && mpn_cmp(consts + size, np, size) < 0;   // both reduced mod m
+  if (ok) {
+    mont_init2(ctx, size);
+    mont_set_consts(ctx, m, ninv, consts, consts + size);
+    mpz_t t, one;
+    mpz_init(t);
+    mont_from(t, consts, ctx);                          // REDC(R mod m) = 1
+    ok = mpz_cmp_ui(t, 1) == 0;
+    mont_from(t, consts + size, ctx);                   // REDC(R^2 mod m) = R mod m
+    ok = ok && mpz_cmp(t, mpz_roinit_n(one, consts, size)) == 0;
+    mpz_clear(t);
+    if (!ok) {                                          // in range but not the constants of m
+      mont_clear(ctx);
+    }
+  }
+  free(consts);
+  return ok;
+}
+
+static bool raw_plan(mont_plan_t *plan, keyfile_raw_t *raw, mpz_t e) {   // loads the stored recoding of e; false if absent or not e's
+  const uint8_t *data = raw->data[KEYFILE_PLAN_E];
+  if (data == NULL || raw->len[KEYFILE_PLAN_E] < 12) {
+    return false;
+  }
+  uint64_t count = get_be(data + 8, 4);
+  if (raw->len[KEYFILE_PLAN_E] != 12 + 8 * count) {
+    return false;
+  }
+  uint64_t entries = get_be(data, 4);
+  plan->entries = entries > INT32_MAX ? 0 : (int)entries;   // mont_plan_check bounds it properly
+  plan->tail = get_be(data + 4, 4);
+  plan->count = count;
+  plan->shift = (uint32_t *)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+  plan->index = (uint32_t *)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+  for (uint64_t i = 0; i < count; i++) {
+    plan->shift[i] = get_be(data + 12 + 8 * i, 4);
+    plan->index[i] = get_be(data + 16 + 8 * i, 4);
+  }
+  if (!mont_plan_check(plan, e)) {
+    mont_plan_clear(plan);
+    return false;
+  }
+  return true;
+}
+
+bool keyfile_read_pub(keyfile_pub_t *kp, FILE *file) {  // binary files by tag, text files through rsa_read_pub
+  if (kp->has_plan) {                                   // a key read into a used struct
+    mont_plan_clear(&kp->plan);
+    kp->has_plan = false;
+  }
+  if (kp->has_mont) {
+    mont_clear(&kp->mont);
+    kp->has_mont = false;
+  }
+  if (!keyfile_is_binary(file)) {
+    return rsa_read_pub(kp->n, kp->e, kp->s, &kp->username, file);
+  }
+  keyfile_raw_t raw;
+  bool ok = raw_read(&raw, file, KEYFILE_PUB_MAGIC);
+  if (ok && !(raw_num(kp->n, &raw, KEYFILE_N) && raw_num(kp->e, &raw, KEYFILE_E))) {
+    gmp_fprintf(stderr, "public key file has no modulus or exponent\n");
+    ok = false;
+  }
+  if (ok) {
+    if (!raw_num(kp->s, &raw, KEYFILE_SIG)) {
+      mpz_set_ui(kp->s, 0);
+    }
+    uint32_t len = raw.data[KEYFILE_USER] != NULL ? raw.len[KEYFILE_USER] : 0;
+    free(kp->username);
+    kp->username = (char *)malloc(len + 1);
+    memcpy(kp->username, raw.data[KEYFILE_USER] != NULL ? raw.data[KEYFILE_USER] : (uint8_t *)"", len);
+    kp->username[len] = '\0';
+    kp->has_plan = raw_plan(&kp->plan, &raw, kp->e);
+    kp->has_mont = raw_mont(&kp->mont, &raw, KEYFILE_MONT_N, kp->n);
+  }
+  raw_clear(&raw);
+  return ok;
+}
+
+bool keyfile_read_priv(keyfile_priv_t *kp, FILE *file) {   // binary files by tag, text files through rsa_read_priv
+  priv_mont_clear(kp);
+  if (!keyfile_is_binary(file)) {
+    return rsa_read_priv(&kp->key, file);
+  }
+  keyfile_raw_t raw;
+  rsa_priv_t *key = &kp->key;
+  bool ok = raw_read(&raw, file, KEYFILE_PRIV_MAGIC);
+  if (ok && !(raw_num(key->n, &raw, KEYFILE_N) && raw_num(key->d, &raw, KEYFILE_D))) {
+    gmp_fprintf(stderr, "private key file has no modulus or exponent\n");
+    ok = false;
+  }
+  if (ok) {
+    bool crt = raw_num(key->p, &raw, KEYFILE_P) && raw_num(key->q, &raw, KEYFILE_Q) && raw_num(key->dp, &raw, KEYFILE_DP) && raw_num(key->dq, &raw, KEYFILE_DQ) && raw_num(key->qinv, &raw, KEYFILE_QINV);
+    if (crt) {
+      mpz_t pq;
+      mpz_init(pq);
+      mpz_mul(pq, key->p, key->q);
+      key->extra = 0;
+      while (key->extra < RSA_MAX_PRIMES - 2) {         // a multi-prime key's further primes
+        keyfile_tag_t tag = KEYFILE_R + 3 * key->extra;
+        if (!(raw_num(key->r[key->extra], &raw, tag) && raw_num(key->dr[key->extra], &raw, tag + 1) && raw_num(key->tr[key->extra], &raw, tag + 2))) {
+          break;
+        }
+        mpz_mul(pq, pq, key->r[key->extra]);
+        key->extra += 1;
+      }
+      crt = mpz_cmp(pq, key->n) == 0;                   // ignore CRT values that do not match n
+      mpz_clear(pq);
+    }
+    if (!crt) {
+      mpz_set_ui(key->p, 0);
+      key->extra = 0;
+    }
+    if (crt) {
+      kp->has_mp = raw_mont(&kp->mp, &raw, KEYFILE_MONT_P, key->p);
+      kp->has_mq = raw_mont(&kp->mq, &raw, KEYFILE_MONT_Q, key->q);
+    } else {
+      kp->has_mp = raw_mont(&kp->mp, &raw, KEYFILE_MONT_N, key->n);
+    }
+  }
+  raw_clear(&raw);
+  return ok;
+}
+
+static uint8_t *buf_field(keyfile_buf_t *fb, keyfile_tag_t tag, size_t len) {   // appends a field header; returns where its len bytes go
+  while (fb->len + KEYFILE_FIELD_SIZE + len > fb->cap) {
+    fb->cap = fb->cap > 0 ? 2 * fb->cap : 1024;
+    fb->buf = (uint8_t *)realloc(fb->buf, fb->cap);
+  }
+  uint8_t *field = fb->buf + fb->len;
+  put_be(field, tag, 2);
+  put_be(field + 2, 0, 2);
+  put_be(field + 4, len, 4);
+  fb->len += KEYFILE_FIELD_SIZE + len;
+  fb->count += 1;
+  return field + KEYFILE_FIELD_SIZE;
+}
+
+static void buf_num(keyfile_buf_t *fb, keyfile_tag_t tag, mpz_t z) {   // a number as a big-endian magnitude; 0 is empty
+  size_t len = mpz_sgn(z) == 0 ? 0 : (mpz_sizeinbase(z, 2) + 7) / 8;
+  uint8_t *data = buf_field(fb, tag, len);
+  if (len > 0) {
+    mpz_export(data, NULL, 1, 1, 0, 0, z);
+  }
+}
+
+static void buf_mont(keyfile_buf_t *fb, keyfile_tag_t tag, mpz_t m) {   // the Montgomery constants for m, if this build can store them
+  if (GMP_NUMB_BITS != 64 || mpz_even_p(m) || mpz_cmp_ui(m, 1) <= 0) {
+    return;
+  }
+  mont_ctx_t ctx;
+  mont_init(&ctx, m);
+  uint8_t *data = buf_field(fb, tag, 8 + 16 * ctx.size);
+  put_le64(data, ctx.ninv);
+  for (mp_size_t i = 0; i < ctx.size; i++) {
+    put_le64(data + 8 + 8 * i, ctx.one[i]);
+    put_le64(data + 8 + 8 * (ctx.size + i), ctx.r2[i]);
+  }
+  mont_clear(&ctx);
+}
+
+static void buf_plan(keyfile_buf_t *fb, mpz_t e) {      // the window recoding of e
+  mont_plan_t plan;
+  mont_plan_init(&plan, e);
+  uint8_t *data = buf_field(fb, KEYFILE_PLAN_E, 12 + 8 * plan.count);
+  put_be(data, plan.entries, 4);
+  put_be(data + 4, plan.tail, 4);
+  put_be(data + 8, plan.count, 4);
+  for (size_t i = 0; i < plan.count; i++) {
+    put_be(data + 12 + 8 * i, plan.shift[i], 4);
+    put_be(data + 16 + 8 * i, plan.index[i], 4);
+  }
+  mont_plan_clear(&plan);
+}
+
+static void buf_write(keyfile_buf_t *fb, FILE *file, const char *magic) {   // the header, then the gathered fields
+  uint8_t header[KEYFILE_HEADER_SIZE] = { 0 };
+  memcpy(header, magic, 4);
+  header[4] = KEYFILE_VERSION;
+  header[5] = GMP_NUMB_BITS;
+  put_be(header + 8, fb->count, 4);
+  fwrite(header, 1, KEYFILE_HEADER_SIZE, file);
+  fwrite(fb->buf, 1, fb->len, file);
+  free(fb->buf);
+}
+
+void keyfile_write_pub(FILE *file, mpz_t n, mpz_t e, mpz_t s, const char *username, bool precompute) {
+  keyfile_buf_t fb = { NULL, 0, 0, 0 };
+  buf_num(&fb, KEYFILE_N, n);
+  buf_num(&fb, KEYFILE_E, e);
+  buf_num(&fb, KEYFILE_SIG, s);
+  memcpy(buf_field(&fb, KEYFILE_USER, strlen(username)), username, strlen(username));
+  if (precompute) {
+    buf_mont(&fb, KEYFILE_MONT_N, n);
+    buf_plan(&fb, e);
+  }
+  buf_write(&fb, file, KEYFILE_PUB_MAGIC);
+}
+
+void keyfile_write_priv(FILE *file, rsa_priv_t *key, bool precompute) {
+  keyfile_buf_t fb = { NULL, 0, 0, 0 };
+  buf_num(&fb, KEYFILE_N, key->n);
+  buf_num(&fb, KEYFILE_D, key->d);
+  if (rsa_priv_has_crt(key)) {
+    buf_num(&fb, KEYFILE_P, key->p);
+    buf_num(&fb, KEYFILE_Q, key->q);
+    buf_num(&fb, KEYFILE_DP, key->dp);
+    buf_num(&fb, KEYFILE_DQ, key->dq);
+    buf_num(&fb, KEYFILE_QINV, key->qinv);
+    for (uint64_t i = 0; i < key->extra; i++) {
+      buf_num(&fb, KEYFILE_R + 3 * i, key->r[i]);
+      buf_num(&fb, KEYFILE_DR + 3 * i, key->dr[i]);
+      buf_num(&fb, KEYFILE_TR + 3 * i, key->tr[i]);
+    }
+  }
+  if (precompute && rsa_priv_has_crt(key)) {            // the constants the exponentiations will use
+    buf_mont(&fb, KEYFILE_MONT_P, key->p);
+    buf_mont(&fb, KEYFILE_MONT_Q, key->q);
+  } else if (precompute) {
+    buf_mont(&fb, KEYFILE_MONT_N, key->n);
+  }
+  buf_write(&fb, file, KEYFILE_PRIV_MAGIC);
+}
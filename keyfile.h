@@ -0,0 +1,98 @@
+/*********************************************************************************
+* keyfile.h
+* Interface for keyfile.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "mont.h"
+#include "rsa.h"
+
+#define KEYFILE_PUB_MAGIC "RSAP"           // first four bytes of a binary public key file
+#define KEYFILE_PRIV_MAGIC "RSAV"          // first four bytes of a binary private key file
+#define KEYFILE_VERSION 1
+#define KEYFILE_HEADER_SIZE 12             // magic, version, limb bits, 2 reserved bytes, field count
+#define KEYFILE_FIELD_SIZE 8               // tag, 2 reserved bytes, length
+#define KEYFILE_MAX_FIELD (1u << 20)       // longest field a reader accepts
+
+//
+// Binary key files. Text key files are hex digits, so the leading 'R' of
+// either magic tells the two formats apart. Layout, all integers big-endian:
+//   header: magic, u8 version, u8 limb bits of the writer, u16 reserved,
+//           u32 field count
+//   fields: u16 tag, u16 reserved, u32 length, then length bytes
+// Numbers are big-endian magnitudes. Readers skip tags they do not know, so
+// fields can be added without a new version.
+//
+// The precomputed fields are optional and only used by a reader with the
+// same limb size as the writer:
+//   KEYFILE_MONT_*  u64 -m^-1 mod 2^64, then R mod m and R^2 mod m as little-endian
+//                   u64 words, as many as m has limbs
+//   KEYFILE_PLAN_E  u32 table entries, u32 tail squarings, u32 window count,
+//                   then a u32 shift and a u32 table index for every window
+//
+typedef enum {
+  KEYFILE_N = 1,                           // public modulus
+  KEYFILE_E = 2,                           // public exponent
+  KEYFILE_SIG = 3,                         // signature of the username
+  KEYFILE_USER = 4,                        // username, without a terminator
+  KEYFILE_D = 5,                           // private exponent
+  KEYFILE_P = 6,                           // CRT values, all or none
+  KEYFILE_Q = 7,
+  KEYFILE_DP = 8,
+  KEYFILE_DQ = 9,
+  KEYFILE_QINV = 10,
+  KEYFILE_MONT_N = 16,                     // Montgomery constants for n
+  KEYFILE_MONT_P = 17,                     // Montgomery constants for p
+  KEYFILE_MONT_Q = 18,                     // Montgomery constants for q
+  KEYFILE_PLAN_E = 19,                     // sliding-window recoding of e
+  KEYFILE_R = 20,                          // further primes of a multi-prime key, three tags each
+  KEYFILE_DR = 21,                         // from KEYFILE_R + 3 * i: r, d mod (r - 1), then the
+  KEYFILE_TR = 22,                         // inverse of the primes before r, mod r
+} keyfile_tag_t;
+
+//
+// A public key as loaded from a key file, with whatever precomputed values
+// the file carried.
+//
+typedef struct {
+  mpz_t n, e, s;
+  char *username;                          // allocated; NULL until a key is read
+  bool has_plan;                           // plan holds e recoded for mont_pow_plan
+  mont_plan_t plan;
+  bool has_mont;                           // mont is set for n
+  mont_ctx_t mont;
+} keyfile_pub_t;
+
+//
+// A private key as loaded from a key file. With CRT values mp and mq are for
+// p and q; without them mp is for n.
+//
+typedef struct {
+  rsa_priv_t key;
+  bool has_mp;                             // mp is set
+  bool has_mq;                             // mq is set
+  mont_ctx_t mp, mq;
+} keyfile_priv_t;
+
+void keyfile_pub_init(keyfile_pub_t *kp);                              // an empty public key
+
+void keyfile_pub_clear(keyfile_pub_t *kp);                             // frees any memory used by the key
+
+void keyfile_priv_init(keyfile_priv_t *kp);                            // an empty private key
+
+void keyfile_priv_clear(keyfile_priv_t *kp);                           // frees any memory used by the key
+
+bool keyfile_is_binary(FILE *file);                                    // peeks at the next byte without consuming it; true if a binary key follows
+
+bool keyfile_read_pub(keyfile_pub_t *kp, FILE *file);                  // reads a public key in either format; false on a malformed file, reported on stderr
+
+bool keyfile_read_priv(keyfile_priv_t *kp, FILE *file);                // reads a private key in either format; false on a malformed file, reported on stderr
+
+void keyfile_write_pub(FILE *file, mpz_t n, mpz_t e, mpz_t s, const char *username, bool precompute);   // writes a binary public key, with the Montgomery constants and plan if precompute
+
+void keyfile_write_priv(FILE *file, rsa_priv_t *key, bool precompute);   // writes a binary private key, with the Montgomery constants if precompute
@@ -13,15 +13,85 @@
 #include "rsa.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "keybatch.h"
+#include "keyfile.h"
+#include "stats.h"
 
-#define OPTIONS "b:i:n:d:s:vh"
+#define OPTIONS "b:i:n:d:s:e:t:P:F:B:D:k:f:j:vh"
+
+static int make_family(char *pub_file, char *priv_file, uint64_t nbits, uint64_t iters, uint64_t count, uint64_t threads, bool binary, int verbose) {   // writes <pbfile>.<e> and <pvfile>.<e> for every member of a key family
+  mpz_t p, q, n, e, username, sig;
+  mpz_inits(p, q, n, e, username, sig, NULL);
+  rsa_priv_t priv;
+  rsa_priv_init(&priv);
+  uint64_t exps[RSA_FAMILY_MAX];
+  rsa_make_family(p, q, n, exps, count, nbits, iters, threads);
+  char *input = getenv("USER");                     // every member signs the same username
+  mpz_set_str(username, input, 62);
+
+  int status = 0;
+  size_t len = strlen(pub_file) + strlen(priv_file) + 24;
+  char *pub_path = (char *)malloc(len);
+  char *priv_path = (char *)malloc(len);
+  for (uint64_t i = 0; i < count; i++) {
+    mpz_set_ui(e, exps[i]);
+    rsa_make_priv(&priv, e, p, q);
+    rsa_sign(sig, username, &priv);
+    snprintf(pub_path, len, "%s.%lu", pub_file, exps[i]);
+    snprintf(priv_path, len, "%s.%lu", priv_file, exps[i]);
+    FILE *pub_fs = fopen(pub_path, "w");
+    FILE *priv_fs = fopen(priv_path, "w");
+    if (pub_fs == NULL || priv_fs == NULL) {
+      gmp_fprintf(stderr, "cannot open key files for e = %lu\n", exps[i]);
+      if (pub_fs != NULL) {
+        fclose(pub_fs);
+      }
+      if (priv_fs != NULL) {
+        fclose(priv_fs);
+      }
+      status = 1;
+      break;
+    }
+    fchmod(fileno(priv_fs), 0600);                  // setting file permissions for private key to user only
+    if (binary) {
+      keyfile_write_pub(pub_fs, n, e, sig, input, true);
+      keyfile_write_priv(priv_fs, &priv, true);
+    } else {
+      rsa_write_pub(n, e, sig, input, pub_fs);
+      rsa_write_priv(&priv, priv_fs);
+    }
+    fclose(pub_fs);
+    fclose(priv_fs);
+    if (verbose == 1) {
+      gmp_fprintf(stderr, "e = %lu: %s, %s\n", exps[i], pub_path, priv_path);
+    }
+  }
+  if (verbose == 1) {
+    gmp_fprintf(stderr, "p (%lu bits): %Zd\nq (%lu bits): %Zd\nn - modulus (%lu bits): %Zd\n",
+                mpz_sizeinbase(p, 2), p, mpz_sizeinbase(q, 2), q, mpz_sizeinbase(n, 2), n);
+  }
+  free(pub_path);
+  free(priv_path);
+  rsa_priv_clear(&priv);
+  mpz_clears(p, q, n, e, username, sig, NULL);
+  return status;
+}
 
 int main(int argc, char **argv) {
   uint64_t nbits = 1024;              // default num of bits: 1024
-  uint64_t mr_iters = 50;             // default num of iterations for Miller-Rabin
+  uint64_t mr_iters = PRIME_ITERS_AUTO;   // default Miller-Rabin rounds: as many as the prime size needs
   char pub_file[] = "rsa.pub";        // default public key file
   char priv_file[] = "rsa.priv";      // default private key file
   uint64_t seed = time(NULL);         // default seed set to num of seconds since Unix epoch
+  uint64_t fixed_e = 0;               // default public exponent: random, about as long as n
+  uint64_t threads = 1;               // default num of prime search threads
+  uint64_t nprimes = 2;               // default num of primes in n
+  uint64_t family = 0;                // key family size; 0 makes a single pair
+  char *batch_file = NULL;            // batch mode: file listing one label per key pair
+  char *batch_dir = ".";              // batch mode: directory for <label>.pub and <label>.priv
+  char *keystore_file = NULL;         // batch mode: single keystore file instead of a directory
+  char *stats_file = NULL;            // where to report counters and timings; NULL counts nothing
+  bool binary = false;                // default key file format: hex text
   int verbose = 0;                    // verbose set to false
   int opt = 0;
   while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -34,9 +104,17 @@ int main(int argc, char **argv) {
       }
       break;
     case 'i':                         // specify num of iters for Miller-Rabin and exit if input is invalid
+      if (strcmp(optarg, "auto") == 0) {
+        mr_iters = PRIME_ITERS_AUTO;
+        break;
+      }
+      if (strcmp(optarg, "bpsw") == 0) {
+        mr_iters = PRIME_ITERS_BPSW;
+        break;
+      }
       mr_iters = strtoul(optarg, NULL, 10);
-      if (mr_iters < 1 || nbits > 500) {
-        gmp_fprintf(stderr, "number of iterations must be within 1-500, inclusive.\n");
+      if (mr_iters < 1 || mr_iters > 500) {
+        gmp_fprintf(stderr, "number of iterations must be within 1-500, inclusive, auto or bpsw.\n");
         return 1;
       }
       break;
@@ -49,6 +127,56 @@ int main(int argc, char **argv) {
     case 's':                         // specify seed to initialize random state to
       seed = strtoul(optarg, NULL, 10);
       break;
+    case 'e':                         // specify a small fixed public exponent and exit if input is invalid
+      fixed_e = strtoul(optarg, NULL, 10);
+      if (fixed_e != 0 && !rsa_is_fermat_prime(fixed_e)) {
+        gmp_fprintf(stderr, "public exponent must be 3, 5, 17, 257, 65537, or 0 for random.\n");
+        return 1;
+      }
+      break;
+    case 't':                         // specify num of prime search threads and exit if input is invalid
+      threads = strtoul(optarg, NULL, 10);
+      if (threads < 1 || threads > 1024) {
+        gmp_fprintf(stderr, "number of threads must be within 1-1024, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'P':                         // specify num of primes in n and exit if input is invalid
+      nprimes = strtoul(optarg, NULL, 10);
+      if (nprimes < 2 || nprimes > RSA_MAX_PRIMES) {
+        gmp_fprintf(stderr, "number of primes must be within 2-%d, inclusive.\n", RSA_MAX_PRIMES);
+        return 1;
+      }
+      break;
+    case 'F':                         // specify key family size and exit if input is invalid
+      family = strtoul(optarg, NULL, 10);
+      if (family < 2 || family > RSA_FAMILY_MAX) {
+        gmp_fprintf(stderr, "family size must be within 2-%d, inclusive.\n", RSA_FAMILY_MAX);
+        return 1;
+      }
+      break;
+    case 'B':                         // specify label file for batch mode
+      batch_file = optarg;
+      break;
+    case 'D':                         // specify output directory for batch mode
+      batch_dir = optarg;
+      break;
+    case 'k':                         // specify keystore file for batch mode
+      keystore_file = optarg;
+      break;
+    case 'f':                         // specify key file format and exit if input is invalid
+      if (strcmp(optarg, "text") == 0) {
+        binary = false;
+      } else if (strcmp(optarg, "bin") == 0) {
+        binary = true;
+      } else {
+        gmp_fprintf(stderr, "format must be text or bin.\n");
+        return 1;
+      }
+      break;
+    case 'j':                         // report counters and timings as JSON
+      stats_file = optarg;
+      break;
     case 'v':                         // enable verbose output
       verbose = 1;
       break;
@@ -62,9 +190,24 @@ int main(int argc, char **argv) {
           "as the random number seed. Default: time()\n    -b <bits>   : "
           "Public modulus n must have at least <bits> bits. Default: 1024\n    "
           "-i <iters>  : Run <iters> Miller-Rabin iterations for primality "
-          "testing. Default: 50\n    -n <pbfile> : Public key file is "
+          "testing, auto for\n                  as many as the prime size "
+          "needs, or bpsw for Baillie-PSW. Default: auto\n    -n <pbfile> : Public key file is "
           "<pbfile>. Default: rsa.pub\n    -d <pvfile> : Private key file is "
-          "<pvfile>. Default: rsa.priv\n    -v          : Enable verbose "
+          "<pvfile>. Default: rsa.priv\n    -e <exp>    : Use the Fermat prime "
+          "<exp> (e.g. 65537) as the public\n                  exponent, or 0 "
+          "for a random one. Default: 0\n    -t <threads>: Search for primes "
+          "on <threads> threads. With more than 1,\n                  thread timing as well as the seed picks the\n                  primes, except in batch mode. Default: 1\n    -P <primes> : Build n from "
+          "<primes> balanced primes, 2-4; more primes\n                  "
+          "make decryption faster. Default: 2\n    -F <count>  : Make <count> pairs "
+          "sharing one n, with e = 3, 5, 17, ...,\n                  as <pbfile>.<e> and "
+          "<pvfile>.<e>, for batch decryption.\n    -B <labels> : Batch mode: make "
+          "one pair per line of <labels>,\n                  using the "
+          "threads for separate keys.\n    -D <dir>    : Batch mode: write "
+          "<label>.pub and <label>.priv to <dir>. Default: .\n    -k <store>  "
+          ": Batch mode: write every pair to keystore <store> instead.\n    -f <format> : Write "
+          "keys as text, or bin for binary keys with precomputed\n                  values that "
+          "load faster. Default: text\n    -j <file>   : Write "
+          "counters and phase timings as JSON to <file>, - for stderr.\n    -v          : Enable verbose "
           "output.\n    -h          : Display program synopsis and usage.\n");
       return 0;
     default:                          // print -h output and exit the program on bad option
@@ -77,15 +220,75 @@ int main(int argc, char **argv) {
           "as the random number seed. Default: time()\n    -b <bits>   : "
           "Public modulus n must have at least <bits> bits. Default: 1024\n    "
           "-i <iters>  : Run <iters> Miller-Rabin iterations for primality "
-          "testing. Default: 50\n    -n <pbfile> : Public key file is "
+          "testing, auto for\n                  as many as the prime size "
+          "needs, or bpsw for Baillie-PSW. Default: auto\n    -n <pbfile> : Public key file is "
           "<pbfile>. Default: rsa.pub\n    -d <pvfile> : Private key file is "
-          "<pvfile>. Default: rsa.priv\n    -v          : Enable verbose "
+          "<pvfile>. Default: rsa.priv\n    -e <exp>    : Use the Fermat prime "
+          "<exp> (e.g. 65537) as the public\n                  exponent, or 0 "
+          "for a random one. Default: 0\n    -t <threads>: Search for primes "
+          "on <threads> threads. With more than 1,\n                  thread timing as well as the seed picks the\n                  primes, except in batch mode. Default: 1\n    -P <primes> : Build n from "
+          "<primes> balanced primes, 2-4; more primes\n                  "
+          "make decryption faster. Default: 2\n    -F <count>  : Make <count> pairs "
+          "sharing one n, with e = 3, 5, 17, ...,\n                  as <pbfile>.<e> and "
+          "<pvfile>.<e>, for batch decryption.\n    -B <labels> : Batch mode: make "
+          "one pair per line of <labels>,\n                  using the "
+          "threads for separate keys.\n    -D <dir>    : Batch mode: write "
+          "<label>.pub and <label>.priv to <dir>. Default: .\n    -k <store>  "
+          ": Batch mode: write every pair to keystore <store> instead.\n    -f <format> : Write "
+          "keys as text, or bin for binary keys with precomputed\n                  values that "
+          "load faster. Default: text\n    -j <file>   : Write "
+          "counters and phase timings as JSON to <file>, - for stderr.\n    -v          : Enable verbose "
           "output.\n    -h          : Display program synopsis and usage.\n");
       return 1;
     }
   }
-  FILE *pub_fs = open(pub_file, "w");               // open file stream for specified public key file
-  FILE *priv_fs = open(priv_file, "w"); // open file stream for specified private key file
+  if (stats_file != NULL) {
+    stats_enable();
+  }
+  if (family > 0 && (batch_file != NULL || fixed_e != 0 || nprimes != 2)) {
+    gmp_fprintf(stderr, "-F cannot be combined with -B, -e or -P\n");
+    return 1;
+  }
+  if (family > 0) {                                 // family mode also replaces the single-pair flow
+    randstate_init(seed);
+    int status = make_family(pub_file, priv_file, nbits, mr_iters, family, threads, binary, verbose);
+    randstate_clear();
+    if (stats_file != NULL) {
+      stats_write(stats_file, "keygen");
+    }
+    return status;
+  }
+  if (batch_file != NULL) {                         // batch mode replaces the single-pair flow below
+    FILE *labels = strcmp(batch_file, "-") == 0 ? stdin : fopen(batch_file, "r");
+    if (labels == NULL) {
+      gmp_fprintf(stderr, "cannot open specified label file\n");
+      return 1;
+    }
+    FILE *store = NULL;
+    if (keystore_file != NULL) {
+      store = fopen(keystore_file, "w+");
+      if (store == NULL) {
+        gmp_fprintf(stderr, "cannot open specified keystore file\n");
+        fclose(labels);
+        return 1;
+      }
+      fchmod(fileno(store), 0600);                  // the keystore holds private keys
+    }
+    randstate_init(seed);
+    keybatch_opts_t opts = { nbits, mr_iters, fixed_e, threads, batch_dir, store, binary, nprimes };
+    int status = keybatch_run(labels, &opts);
+    if (store != NULL) {
+      fclose(store);
+    }
+    fclose(labels);
+    randstate_clear();
+    if (stats_file != NULL) {
+      stats_write(stats_file, "keygen");
+    }
+    return status;
+  }
+  FILE *pub_fs = fopen(pub_file, "w");              // open file stream for specified public key file
+  FILE *priv_fs = fopen(priv_file, "w");            // open file stream for specified private key file
   if (pub_fs == NULL) {      // exit program if file cannot be opened
     gmp_fprintf(stderr, "cannot open specified public key file\n");
     if (priv_fs != NULL) {
@@ -102,18 +305,39 @@ int main(int argc, char **argv) {
   }
   fchmod(fileno(priv_fs), 0600);                    // setting file permissions for private key to user only
   randstate_init(seed);                             // initializing state with specified seed
-  mpz_t d, p, q, n, e, username, sig;
-  mpz_inits(d, p, q, n, e, username, sig, NULL);    // initializing mpz vars
+  mpz_t p, q, n, e, username, sig;
+  mpz_inits(p, q, n, e, username, sig, NULL);       // initializing mpz vars
+  rsa_priv_t priv;
+  rsa_priv_init(&priv);
 
-  rsa_make_pub(p, q, n, e, nbits, r_iters);         // makes public key and sets to mpz vars
-  rsa_make_priv(d, e, p, q); // makes private key and sets to mpz vars
+  if (nprimes > 2) {                                // n from nprimes balanced primes; p and q are the first two
+    mpz_t primes[RSA_MAX_PRIMES];
+    for (uint64_t i = 0; i < nprimes; i++) {
+      mpz_init(primes[i]);
+    }
+    rsa_make_pub_multi(primes, nprimes, n, e, nbits, mr_iters, fixed_e, threads);
+    rsa_make_priv_multi(&priv, e, primes, nprimes);
+    mpz_set(p, primes[0]);
+    mpz_set(q, primes[1]);
+    for (uint64_t i = 0; i < nprimes; i++) {
+      mpz_clear(primes[i]);
+    }
+  } else {
+    rsa_make_pub(p, q, n, e, nbits, mr_iters, fixed_e, threads);   // makes public key and sets to mpz vars
+    rsa_make_priv(&priv, e, p, q);                  // makes private key, including its CRT values
+  }
 
   char *input = getenv("USER");                     // gets user's name from environment variable
   mpz_set_str(username, input, 62);                 // sets the name to the mpz var 'username'
-  rsa_sign(sig, username, d, n);                    // RSA signs the mpz var 'username'
+  rsa_sign(sig, username, &priv);                   // RSA signs the mpz var 'username'
 
-  rsa_write_pub(n, e, sig, input, pub_fs);          // writes public key to specified file
-  rsa_write_priv(n, d, priv_fs);                    // writes private key to specified file
+  if (binary) {                                     // binary keys carry their Montgomery constants and the recoded e
+    keyfile_write_pub(pub_fs, n, e, sig, input, true);
+    keyfile_write_priv(priv_fs, &priv, true);
+  } else {
+    rsa_write_pub(n, e, sig, input, pub_fs);        // writes public key to specified file
+    rsa_write_priv(&priv, priv_fs);                 // writes private key to specified file
+  }
 
   if (verbose == 1) {                               // verbose output
     gmp_fprintf(
@@ -123,10 +347,17 @@ int main(int argc, char **argv) {
         "(%lu bits): %Zd\nd - private exponent (%lu bits): %Zd\n",
         input, mpz_sizeinbase(sig, 2), sig, mpz_sizeinbase(p, 2), p,
         mpz_sizeinbase(q, 2), q, mpz_sizeinbase(n, 2), n, mpz_sizeinbase(e, 2),
-        e, mpz_sizeinbase(d, 2), d);
+        e, mpz_sizeinbase(priv.d, 2), priv.d);
+    for (uint64_t i = 0; i < priv.extra; i++) {     // further primes of a multi-prime key
+      gmp_fprintf(stderr, "r%lu (%lu bits): %Zd\n", i + 1, mpz_sizeinbase(priv.r[i], 2), priv.r[i]);
+    }
   }
   fclose(pub_fs);                                   // closing file streams and clearing mpz vars
   fclose(priv_fs);
-  mpz_clears(d, p, q, n, e, username, sig, NULL);
+  mpz_clears(p, q, n, e, username, sig, NULL);
+  rsa_priv_clear(&priv);
+  if (stats_file != NULL) {
+    stats_write(stats_file, "keygen");
+  }
   return 0;
 }
@@ -0,0 +1,215 @@
+/*********************************************************************************
+* keystore.c
+* Single-file store of many labelled key pairs with an on-disk hash index
+*********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "keyfile.h"
+#include "keystore.h"
+
+static void put_be(uint8_t *buf, uint64_t v, int len) {   // stores the low len bytes of v big-endian
+  for (int i = len - 1; i >= 0; i--) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t *buf, int len) {   // reads len bytes big-endian
+  uint64_t v = 0;
+  for (int i = 0; i < len; i++) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static void write_field(FILE *file, const void *data, uint32_t len) {   // writes a u32 length followed by the bytes
+  uint8_t buf[4];
+  put_be(buf, len, 4);
+  fwrite(buf, 1, 4, file);
+  fwrite(data, 1, len, file);
+}
+
+uint64_t keystore_hash(const char *label) {             // 64-bit FNV-1a; 0 is reserved for empty index slots
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char *c = label; *c != '\0'; c++) {
+    h ^= (uint8_t)*c;
+    h *= 0x100000001b3ULL;
+  }
+  return h == 0 ? 1 : h;
+}
+
+bool keystore_create(keystore_writer_t *ks, FILE *file) {   // reserves the header; records follow it
+  uint8_t header[KEYSTORE_HEADER_SIZE] = { 0 };
+  if (fwrite(header, 1, KEYSTORE_HEADER_SIZE, file) != KEYSTORE_HEADER_SIZE) {
+    return false;
+  }
+  ks->file = file;
+  ks->count = 0;
+  ks->cap = 64;
+  ks->hashes = (uint64_t *)malloc(ks->cap * sizeof(uint64_t));
+  ks->offsets = (uint64_t *)malloc(ks->cap * sizeof(uint64_t));
+  return true;
+}
+
+void keystore_add(keystore_writer_t *ks, const char *label, mpz_t n, mpz_t e, mpz_t s, rsa_priv_t *priv, bool binary) {   // appends one key pair
+  char *pub_text = NULL;
+  char *priv_text = NULL;
+  size_t pub_len = 0;
+  size_t priv_len = 0;
+  FILE *pub_fs = open_memstream(&pub_text, &pub_len);     // the records hold exactly what a key file would
+  FILE *priv_fs = open_memstream(&priv_text, &priv_len);
+  if (binary) {
+    keyfile_write_pub(pub_fs, n, e, s, label, true);
+    keyfile_write_priv(priv_fs, priv, true);
+  } else {
+    rsa_write_pub(n, e, s, (char *)label, pub_fs);
+    rsa_write_priv(priv, priv_fs);
+  }
+  fclose(pub_fs);
+  fclose(priv_fs);
+
+  if (ks->count == ks->cap) {
+    ks->cap *= 2;
+    ks->hashes = (uint64_t *)realloc(ks->hashes, ks->cap * sizeof(uint64_t));
+    ks->offsets = (uint64_t *)realloc(ks->offsets, ks->cap * sizeof(uint64_t));
+  }
+  ks->hashes[ks->count] = keystore_hash(label);
+  ks->offsets[ks->count] = ftell(ks->file);
+  ks->count += 1;
+  write_field(ks->file, label, strlen(label));
+  write_field(ks->file, pub_text, pub_len);
+  write_field(ks->file, priv_text, priv_len);
+  free(pub_text);
+  free(priv_text);
+}
+
+bool keystore_finish(keystore_writer_t *ks) {           // writes the hash index after the records, then the header
+  uint64_t slots = 16;
+  while (slots < 2 * ks->count) {                       // at most half full, so probe runs stay short
+    slots *= 2;
+  }
+  uint64_t *taken = (uint64_t *)calloc(slots, sizeof(uint64_t));   // hash held by each slot; 0 when empty
+  uint8_t *index = (uint8_t *)calloc(slots, 16);
+  for (uint64_t i = 0; i < ks->count; i++) {            // linear probing from hash mod slots
+    uint64_t slot = ks->hashes[i] & (slots - 1);
+    while (taken[slot] != 0) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    taken[slot] = ks->hashes[i];
+    put_be(index + slot * 16, ks->hashes[i], 8);
+    put_be(index + slot * 16 + 8, ks->offsets[i], 8);
+  }
+  free(taken);
+  uint64_t index_offset = ftell(ks->file);
+  fwrite(index, 16, slots, ks->file);
+  free(index);
+
+  uint8_t header[KEYSTORE_HEADER_SIZE];
+  memcpy(header, KEYSTORE_MAGIC, 4);
+  put_be(header + 4, KEYSTORE_VERSION, 4);
+  put_be(header + 8, ks->count, 8);
+  put_be(header + 16, index_offset, 8);
+  put_be(header + 24, slots, 8);
+  bool ok = fseek(ks->file, 0, SEEK_SET) == 0 && fwrite(header, 1, KEYSTORE_HEADER_SIZE, ks->file) == KEYSTORE_HEADER_SIZE;
+  fseek(ks->file, 0, SEEK_END);
+  free(ks->hashes);
+  free(ks->offsets);
+  return ok;
+}
+
+bool keystore_open(keystore_t *ks, FILE *file) {        // maps the file and checks that the index fits inside it
+  rewind(file);
+  if (!mapfile_open_read(&ks->map, file)) {
+    gmp_fprintf(stderr, "keystore is not a readable regular file\n");
+    return false;
+  }
+  madvise(ks->map.base, ks->map.length, MADV_RANDOM);   // lookups touch one slot run and one record each
+  const uint8_t *header = ks->map.data;
+  uint64_t index_offset = 0;
+  bool ok = ks->map.size >= KEYSTORE_HEADER_SIZE && memcmp(header, KEYSTORE_MAGIC, 4) == 0;
+  if (ok) {
+    ks->count = get_be(header + 8, 8);
+    index_offset = get_be(header + 16, 8);
+    ks->slots = get_be(header + 24, 8);
+    ok = get_be(header + 4, 4) == KEYSTORE_VERSION && ks->slots > 0 && (ks->slots & (ks->slots - 1)) == 0 && ks->count < ks->slots
+         && index_offset >= KEYSTORE_HEADER_SIZE && index_offset <= ks->map.size && ks->slots <= (ks->map.size - index_offset) / 16;
+  }
+  if (!ok) {
+    gmp_fprintf(stderr, "not a keystore, or an unfinished one\n");
+    mapfile_close(&ks->map, 0);
+    return false;
+  }
+  ks->index = ks->map.data + index_offset;
+  return true;
+}
+
+void keystore_close(keystore_t *ks) {
+  mapfile_close(&ks->map, 0);
+}
+
+static bool record_field(keystore_t *ks, uint64_t *pos, const uint8_t **data, uint32_t *len) {   // reads one length-prefixed field of a record; false if it runs past the map
+  if (*pos > ks->map.size || ks->map.size - *pos < 4) {
+    return false;
+  }
+  *len = get_be(ks->map.data + *pos, 4);
+  *pos += 4;
+  if (ks->map.size - *pos < *len) {
+    return false;
+  }
+  *data = ks->map.data + *pos;
+  *pos += *len;
+  return true;
+}
+
+bool keystore_lookup(keystore_t *ks, const char *label, const uint8_t **pub, uint32_t *pub_len, const uint8_t **priv, uint32_t *priv_len) {   // linear probing, as keystore_finish placed the records
+  uint64_t hash = keystore_hash(label);
+  size_t label_len = strlen(label);
+  uint64_t slot = hash & (ks->slots - 1);
+  for (uint64_t probes = 0; probes < ks->slots; probes++) {
+    const uint8_t *entry = ks->index + slot * 16;
+    uint64_t h = get_be(entry, 8);
+    if (h == 0) {                                       // an empty slot ends the run: the label is not stored
+      return false;
+    }
+    if (h == hash) {                                    // the hash matches; the record's label decides
+      uint64_t pos = get_be(entry + 8, 8);
+      const uint8_t *name = NULL;
+      uint32_t name_len = 0;
+      if (record_field(ks, &pos, &name, &name_len) && name_len == label_len && memcmp(name, label, label_len) == 0) {
+        return record_field(ks, &pos, pub, pub_len) && record_field(ks, &pos, priv, priv_len);
+      }
+    }
+    slot = (slot + 1) & (ks->slots - 1);
+  }
+  return false;
+}
+
+bool keystore_read_pub(keystore_t *ks, const char *label, keyfile_pub_t *kp) {   // the stored key file, read as keyfile_read_pub reads any other
+  const uint8_t *pub = NULL;
+  const uint8_t *priv = NULL;
+  uint32_t pub_len = 0;
+  uint32_t priv_len = 0;
+  if (!keystore_lookup(ks, label, &pub, &pub_len, &priv, &priv_len) || pub_len == 0) {
+    return false;
+  }
+  FILE *in = fmemopen((void *)pub, pub_len, "r");
+  bool ok = keyfile_read_pub(kp, in);
+  fclose(in);
+  return ok;
+}
+
+bool keystore_read_priv(keystore_t *ks, const char *label, keyfile_priv_t *kp) {
+  const uint8_t *pub = NULL;
+  const uint8_t *priv = NULL;
+  uint32_t pub_len = 0;
+  uint32_t priv_len = 0;
+  if (!keystore_lookup(ks, label, &pub, &pub_len, &priv, &priv_len) || priv_len == 0) {
+    return false;
+  }
+  FILE *in = fmemopen((void *)priv, priv_len, "r");
+  bool ok = keyfile_read_priv(kp, in);
+  fclose(in);
+  return ok;
+}
@@ -0,0 +1,66 @@
+/*********************************************************************************
+* keystore.h
+* Interface for keystore.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "keyfile.h"
+#include "mapfile.h"
+#include "rsa.h"
+
+#define KEYSTORE_MAGIC "RSAK"              // first four bytes of a keystore file
+#define KEYSTORE_VERSION 1
+#define KEYSTORE_HEADER_SIZE 32            // magic, version, key count, index offset, index slots
+
+//
+// A keystore holds many key pairs in one file, each under a label.
+// Layout, all integers big-endian:
+//   header:  magic, u32 version, u64 count, u64 index offset, u64 index slots
+//   records: u32 label length, label, u32 length + public key file,
+//            u32 length + private key file, each as rsa_write_pub /
+//            rsa_write_priv text or as a binary key file (keyfile.h)
+//   index:   an open-addressing hash table of (u64 label hash, u64 record
+//            offset) slots; a hash of 0 marks an empty slot
+//
+typedef struct {
+  FILE *file;
+  uint64_t count;                          // records written so far
+  uint64_t cap;                            // capacity of hashes and offsets
+  uint64_t *hashes;                        // label hash of every record
+  uint64_t *offsets;                       // file offset of every record
+} keystore_writer_t;
+
+uint64_t keystore_hash(const char *label);                             // 64-bit FNV-1a hash of a label; never 0
+
+bool keystore_create(keystore_writer_t *ks, FILE *file);               // starts a keystore at the start of an empty, seekable file
+
+void keystore_add(keystore_writer_t *ks, const char *label, mpz_t n, mpz_t e, mpz_t s, rsa_priv_t *priv, bool binary);   // appends one key pair under a label, as text or binary key files
+
+bool keystore_finish(keystore_writer_t *ks);                           // writes the index and header, and frees the writer
+
+//
+// A keystore opened for lookups. The file is memory-mapped, so a lookup reads
+// the index slots and one record straight from the page cache, and any
+// number of threads can look up at once.
+//
+typedef struct {
+  mapfile_t map;                           // the whole file
+  uint64_t count;                          // records in the store
+  uint64_t slots;                          // index slots, a power of two
+  const uint8_t *index;                    // slots * 16 bytes of (hash, offset)
+} keystore_t;
+
+bool keystore_open(keystore_t *ks, FILE *file);                        // maps a keystore and checks its header and index; false if it is not one, reported on stderr
+
+void keystore_close(keystore_t *ks);                                   // unmaps the store; the file stays open
+
+bool keystore_lookup(keystore_t *ks, const char *label, const uint8_t **pub, uint32_t *pub_len, const uint8_t **priv, uint32_t *priv_len);   // finds the key files stored under a label, pointing into the map; false if absent
+
+bool keystore_read_pub(keystore_t *ks, const char *label, keyfile_pub_t *kp);    // loads the public key stored under a label; false if absent or malformed
+
+bool keystore_read_priv(keystore_t *ks, const char *label, keyfile_priv_t *kp);  // loads the private key stored under a label; false if absent or malformed
@@ -0,0 +1,69 @@
+/*********************************************************************************
+* mapfile.c
+* Memory-mapped file access for the file encryption and decryption paths.
+* Regular files are read and written through their mapped pages; pipes and
+* other streams are left to stdio.
+*********************************************************************************/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapfile.h"
+
+bool mapfile_open_read(mapfile_t *map, FILE *file) {            // maps the rest of a regular file read-only
+  struct stat st;
+  long offset = ftell(file);                                    // accounts for anything stdio has already buffered
+  if (offset < 0 || fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= offset) {
+    return false;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  madvise(base, st.st_size, MADV_SEQUENTIAL);                   // blocks are consumed front to back
+  map->file = file;
+  map->base = (uint8_t *)base;
+  map->length = st.st_size;
+  map->offset = offset;
+  map->data = map->base + offset;
+  map->size = st.st_size - offset;
+  map->writable = false;
+  return true;
+}
+
+bool mapfile_open_write(mapfile_t *map, FILE *file, size_t size) {   // grows a regular file past its position and maps it writable
+  struct stat st;
+  int fd = fileno(file);
+  if (size == 0 || fflush(file) != 0) {
+    return false;
+  }
+  long offset = ftell(file);
+  if (offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDWR) {
+    return false;                                               // shared writable maps need a descriptor opened for reading too
+  }
+  if (ftruncate(fd, offset + size) != 0) {
+    return false;
+  }
+  void *base = mmap(NULL, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    ftruncate(fd, offset);
+    return false;
+  }
+  map->file = file;
+  map->base = (uint8_t *)base;
+  map->length = offset + size;
+  map->offset = offset;
+  map->data = map->base + offset;
+  map->size = size;
+  map->writable = true;
+  return true;
+}
+
+void mapfile_close(mapfile_t *map, size_t used) {               // unmaps and moves the stream past the used bytes
+  munmap(map->base, map->length);
+  if (map->writable) {
+    ftruncate(fileno(map->file), map->offset + used);           // drops the unused tail of a preallocated output
+  }
+  fseek(map->file, map->offset + used, SEEK_SET);
+}
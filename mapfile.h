@@ -0,0 +1,31 @@
+/*********************************************************************************
+* mapfile.h
+* Interface for mapfile.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// A memory mapping of a regular file, starting at the stream position the
+// file had when it was mapped.
+//
+typedef struct {
+  FILE *file;                              // the mapped stream
+  uint8_t *base;                           // start of the mapping (file offset 0)
+  size_t length;                           // length of the mapping
+  long offset;                             // file offset that data points at
+  uint8_t *data;                           // the bytes from offset onwards
+  size_t size;                             // number of bytes at data
+  bool writable;                           // set for output maps, which are truncated on close
+} mapfile_t;
+
+bool mapfile_open_read(mapfile_t *map, FILE *file);                   // maps the rest of a regular file read-only; false for pipes and empty files
+
+bool mapfile_open_write(mapfile_t *map, FILE *file, size_t size);     // grows a regular file by size bytes past its position and maps them writable; false if not possible
+
+void mapfile_close(mapfile_t *map, size_t used);                      // unmaps; a writable map is truncated to used bytes and the stream moved past them
@@ -0,0 +1,428 @@
+/*********************************************************************************
+* mont.c
+* Montgomery-form modular arithmetic on GMP limbs.
+* Replaces the multiply-then-divide steps of modular exponentiation with
+* multiplications and word-by-word reductions against a precomputed modulus.
+*********************************************************************************/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "mont.h"
+
+#define MONT_MAX_WINDOW 6                               // largest sliding window, in bits
+#define MONT_SEC_WINDOW (MONT_MAX_WINDOW - 1)            // largest fixed window; its 2^w entries fill the table
+
+static void mont_limbs(mp_limb_t *r, mpz_t a, mp_size_t size) {   // copies the limbs of a into r, zero-padded to size limbs
+  mp_size_t used = mpz_size(a);
+  mpn_copyi(r, mpz_limbs_read(a), used);
+  mpn_zero(r + used, size - used);
+}
+
+static void mont_redc(mp_limb_t *r, mp_limb_t *t, mont_ctx_t *ctx) {   // r = t / R mod n for a 2 * size limb t < n * R
+  mp_size_t s = ctx->size;
+  for (mp_size_t i = 0; i < s; i++) {                   // clears one low limb per step by adding a multiple of n
+    mp_limb_t u = t[i] * ctx->ninv;
+    t[i] = mpn_addmul_1(t + i, ctx->np, s, u);          // the cleared limb holds the carry out of this row
+  }
+  mp_limb_t cy = mpn_add_n(r, t + s, t, s);             // high half plus the saved row carries
+  if (cy != 0 || mpn_cmp(r, ctx->np, s) >= 0) {         // result is below 2n; one subtraction brings it below n
+    mpn_sub_n(r, r, ctx->np, s);
+  }
+}
+
+static void mont_redc_sec(mp_limb_t *r, mp_limb_t *t, mont_ctx_t *ctx) {   // mont_redc with the final subtraction masked instead of branched on
+  mp_size_t s = ctx->size;
+  for (mp_size_t i = 0; i < s; i++) {
+    mp_limb_t u = t[i] * ctx->ninv;
+    t[i] = mpn_addmul_1(t + i, ctx->np, s, u);
+  }
+  mp_limb_t cy = mpn_add_n(r, t + s, t, s);
+  mp_limb_t borrow = mpn_sub_n(t, r, ctx->np, s);       // only its borrow is wanted; t is spent
+  mpn_cnd_sub_n(cy | (borrow ^ 1), r, r, ctx->np, s);
+}
+
+static mp_size_t mont_sec_itch(mp_size_t cap) {         // limbs of scratch mpn_sec_mul and mpn_sec_sqr need at cap limbs
+  mp_size_t mul = mpn_sec_mul_itch(cap, cap);
+  mp_size_t sqr = mpn_sec_sqr_itch(cap);
+  return mul > sqr ? mul : sqr;
+}
+
+static void mont_alloc(mont_ctx_t *ctx, mp_size_t cap) {   // allocates room for moduli of up to cap limbs
+  ctx->cap = cap;
+  ctx->np = (mp_limb_t *)malloc(cap * sizeof(mp_limb_t));
+  ctx->r2 = (mp_limb_t *)malloc(cap * sizeof(mp_limb_t));
+  ctx->one = (mp_limb_t *)malloc(cap * sizeof(mp_limb_t));
+  ctx->prod = (mp_limb_t *)malloc(2 * cap * sizeof(mp_limb_t));
+  ctx->acc = (mp_limb_t *)malloc(cap * sizeof(mp_limb_t));
+  ctx->table = (mp_limb_t *)malloc((1 << (MONT_MAX_WINDOW - 1)) * cap * sizeof(mp_limb_t));
+  ctx->sec = (mp_limb_t *)malloc((cap + mont_sec_itch(cap)) * sizeof(mp_limb_t));
+}
+
+static void mont_free(mont_ctx_t *ctx) {
+  free(ctx->np);
+  free(ctx->r2);
+  free(ctx->one);
+  free(ctx->prod);
+  free(ctx->acc);
+  free(ctx->table);
+  free(ctx->sec);
+}
+
+void mont_init(mont_ctx_t *ctx, mpz_t n) {              // precomputes the context for an odd modulus n > 1
+  mont_init2(ctx, mpz_size(n));
+  mont_set(ctx, n);
+}
+
+void mont_init2(mont_ctx_t *ctx, mp_size_t cap) {       // an empty context with room for moduli of up to cap limbs
+  ctx->size = 0;
+  mpz_init2(ctx->n, cap * GMP_NUMB_BITS);
+  mpz_init2(ctx->tmp, (2 * cap + 1) * GMP_NUMB_BITS);    // also holds R^2 while the context is set up
+  mont_alloc(ctx, cap);
+}
+
+void mont_set(mont_ctx_t *ctx, mpz_t n) {               // retargets the context at an odd modulus n > 1
+  mp_size_t s = mpz_size(n);
+  if (s > ctx->cap) {                                   // only a larger modulus than any before allocates
+    mont_free(ctx);
+    mont_alloc(ctx, s);
+  }
+  ctx->size = s;
+  mpz_set(ctx->n, n);
+  mont_limbs(ctx->np, n, s);
+
+  mp_limb_t n0 = ctx->np[0];
+  mp_limb_t inv = n0;                                   // n0 * n0 = 1 mod 8, so n0 is its own inverse to 3 bits
+  for (int i = 0; i < 5; i++) {                         // each Newton step doubles the correct bits: 3, 6, 12, 24, 48, 96
+    inv *= 2 - n0 * inv;
+  }
+  ctx->ninv = -inv;
+
+  mpz_set_ui(ctx->tmp, 0);
+  mpz_setbit(ctx->tmp, s * GMP_NUMB_BITS);
+  mpz_mod(ctx->tmp, ctx->tmp, n);                       // R mod n
+  mont_limbs(ctx->one, ctx->tmp, s);
+  mpz_set_ui(ctx->tmp, 0);
+  mpz_setbit(ctx->tmp, 2 * s * GMP_NUMB_BITS);
+  mpz_mod(ctx->tmp, ctx->tmp, n);                       // R^2 mod n
+  mont_limbs(ctx->r2, ctx->tmp, s);
+}
+
+void mont_set_consts(mont_ctx_t *ctx, mpz_t n, mp_limb_t ninv, const mp_limb_t *one, const mp_limb_t *r2) {   // retargets the context without any division
+  mp_size_t s = mpz_size(n);
+  if (s > ctx->cap) {
+    mont_free(ctx);
+    mont_alloc(ctx, s);
+  }
+  ctx->size = s;
+  mpz_set(ctx->n, n);
+  mont_limbs(ctx->np, n, s);
+  ctx->ninv = ninv;
+  mpn_copyi(ctx->one, one, s);
+  mpn_copyi(ctx->r2, r2, s);
+}
+
+void mont_clear(mont_ctx_t *ctx) {                      // frees any memory used by the context
+  mpz_clears(ctx->n, ctx->tmp, NULL);
+  mont_free(ctx);
+}
+
+void mont_mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mont_ctx_t *ctx) {   // Montgomery product a * b / R mod n
+  mpn_mul_n(ctx->prod, a, b, ctx->size);
+  mont_redc(r, ctx->prod, ctx);
+}
+
+void mont_sqr(mp_limb_t *r, const mp_limb_t *a, mont_ctx_t *ctx) {     // Montgomery square a * a / R mod n
+  mpn_sqr(ctx->prod, a, ctx->size);
+  mont_redc(r, ctx->prod, ctx);
+}
+
+void mont_to(mp_limb_t *r, mpz_t a, mont_ctx_t *ctx) {  // converts a into Montgomery form: a * R mod n
+  if (mpz_sgn(a) < 0 || mpz_cmp(a, ctx->n) >= 0) {      // reduce the input first if it is not already below n
+    mpz_mod(ctx->tmp, a, ctx->n);
+    mont_limbs(r, ctx->tmp, ctx->size);
+  } else {
+    mont_limbs(r, a, ctx->size);
+  }
+  mont_mul(r, r, ctx->r2, ctx);                         // a * R^2 / R = a * R
+}
+
+void mont_from(mpz_t o, const mp_limb_t *a, mont_ctx_t *ctx) {         // converts a out of Montgomery form: a / R mod n
+  mp_size_t s = ctx->size;
+  mpn_copyi(ctx->prod, a, s);
+  mpn_zero(ctx->prod + s, s);
+  mp_limb_t *op = mpz_limbs_write(o, s);
+  mont_redc(op, ctx->prod, ctx);
+  mpz_limbs_finish(o, s);
+}
+
+static int mont_window(size_t bits) {                   // sliding window size for an exponent of the given length
+  if (bits > 768) {
+    return 6;
+  }
+  if (bits > 256) {
+    return 5;
+  }
+  if (bits > 80) {
+    return 4;
+  }
+  if (bits > 24) {
+    return 3;
+  }
+  if (bits > 6) {
+    return 2;
+  }
+  return 1;
+}
+
+void mont_pow(mpz_t o, mpz_t a, mpz_t d, mont_ctx_t *ctx) {             // computes a^d % n with a sliding window over the bits of d
+  mp_size_t s = ctx->size;
+  if (mpz_sgn(d) == 0) {                                // a^0 = 1
+    mont_from(o, ctx->one, ctx);
+    return;
+  }
+  long bits = mpz_sizeinbase(d, 2);
+  int w = mont_window(bits);
+  mp_limb_t *acc = ctx->acc;
+  mp_limb_t *table = ctx->table;                        // table[i] = a^(2i + 1) in Montgomery form
+  mont_to(table, a, ctx);
+  if (w > 1) {
+    mont_sqr(acc, table, ctx);                          // a^2, used only to step between odd powers
+    for (long i = 1; i < (1L << (w - 1)); i++) {
+      mont_mul(table + i * s, table + (i - 1) * s, acc, ctx);
+    }
+  }
+
+  bool started = false;
+  long i = bits - 1;
+  while (i >= 0) {                                      // scans d from the top bit down
+    if (mpz_tstbit(d, i) == 0) {                        // zero bits only square; the top bit is 1 so acc is already set
+      mont_sqr(acc, acc, ctx);
+      i -= 1;
+      continue;
+    }
+    long j = i - w + 1;                                 // longest window starting at bit i that ends on a 1 bit
+    if (j < 0) {
+      j = 0;
+    }
+    while (mpz_tstbit(d, j) == 0) {
+      j += 1;
+    }
+    unsigned long value = 0;
+    for (long k = i; k >= j; k--) {
+      value = (value << 1) | mpz_tstbit(d, k);
+    }
+    if (started) {
+      for (long k = j; k <= i; k++) {
+        mont_sqr(acc, acc, ctx);
+      }
+      mont_mul(acc, acc, table + (value >> 1) * s, ctx);
+    } else {
+      mpn_copyi(acc, table + (value >> 1) * s, s);
+      started = true;
+    }
+    i = j - 1;
+  }
+  mont_from(o, acc, ctx);
+}
+
+static void mont_mul_sec(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mont_ctx_t *ctx) {   // mont_mul for values below n, in time independent of them
+  mpn_sec_mul(ctx->prod, a, ctx->size, b, ctx->size, ctx->sec + ctx->cap);
+  mont_redc_sec(r, ctx->prod, ctx);
+}
+
+static void mont_sqr_sec(mp_limb_t *r, const mp_limb_t *a, mont_ctx_t *ctx) {   // mont_sqr for a value below n, in time independent of it
+  mpn_sec_sqr(ctx->prod, a, ctx->size, ctx->sec + ctx->cap);
+  mont_redc_sec(r, ctx->prod, ctx);
+}
+
+static int mont_sec_window(size_t bits) {               // fixed window for bits exponent bits: the fewest of bits / w multiplications plus 2^w table entries
+  if (bits > 320) {
+    return MONT_SEC_WINDOW;
+  }
+  if (bits > 96) {
+    return 4;
+  }
+  return 3;
+}
+
+void mont_pow_sec(mpz_t o, mpz_t a, mpz_t d, mont_ctx_t *ctx) {         // computes a^d % n with fixed windows and full-table lookups
+  mp_size_t s = ctx->size;
+  mp_size_t dsize = mpz_size(d) > (size_t)s ? (mp_size_t)mpz_size(d) : s;   // R bounds RSA exponents; only a longer d costs more
+  size_t bits = dsize * GMP_NUMB_BITS;
+  int w = mont_sec_window(bits);
+  mp_size_t entries = (mp_size_t)1 << w;
+  mp_limb_t *acc = ctx->acc;
+  mp_limb_t *table = ctx->table;                        // table[i] = a^i in Montgomery form
+  mp_limb_t *entry = ctx->sec;
+  if (mpz_sgn(a) < 0 || mpz_cmp(a, ctx->n) >= 0) {      // the base is public, e.g. a ciphertext
+    mpz_mod(ctx->tmp, a, ctx->n);
+    mont_limbs(acc, ctx->tmp, s);
+  } else {
+    mont_limbs(acc, a, s);
+  }
+  mpn_copyi(table, ctx->one, s);
+  mont_mul_sec(table + s, acc, ctx->r2, ctx);
+  for (mp_size_t i = 2; i < entries; i++) {
+    mont_mul_sec(table + i * s, table + (i - 1) * s, table + s, ctx);
+  }
+
+  size_t windows = (bits + w - 1) / w;
+  mpn_copyi(acc, ctx->one, s);
+  for (size_t k = windows; k-- > 0;) {                  // every window, top down, zero or not
+    if (k + 1 < windows) {                              // the first window starts from 1; squaring it would be wasted
+      for (int j = 0; j < w; j++) {
+        mont_sqr_sec(acc, acc, ctx);
+      }
+    }
+    size_t pos = k * w;
+    size_t limb = pos / GMP_NUMB_BITS;
+    unsigned off = pos % GMP_NUMB_BITS;
+    mp_limb_t value = mpz_getlimbn(d, limb) >> off;
+    if (off + w > GMP_NUMB_BITS) {                      // depends on the window position only
+      value |= mpz_getlimbn(d, limb + 1) << (GMP_NUMB_BITS - off);
+    }
+    mpn_sec_tabselect(entry, table, s, entries, value & (entries - 1));
+    mont_mul_sec(acc, acc, entry, ctx);
+  }
+
+  mpn_copyi(ctx->prod, acc, s);                         // out of Montgomery form
+  mpn_zero(ctx->prod + s, s);
+  mp_limb_t *op = mpz_limbs_write(o, s);
+  mont_redc_sec(op, ctx->prod, ctx);
+  mpz_limbs_finish(o, s);
+}
+
+static size_t mont_plan_scan(mpz_t d, int w, mont_plan_t *plan) {      // splits d into windows of at most w bits; fills plan when given
+  size_t count = 0;
+  uint32_t pending = 0;                                 // squarings owed before the next window
+  uint32_t top = 0;                                     // largest table entry used
+  long i = mpz_sizeinbase(d, 2) - 1;
+  while (i >= 0) {
+    if (mpz_tstbit(d, i) == 0) {
+      pending += 1;
+      i -= 1;
+      continue;
+    }
+    long j = i - w + 1;                                 // same windows as mont_pow
+    if (j < 0) {
+      j = 0;
+    }
+    while (mpz_tstbit(d, j) == 0) {
+      j += 1;
+    }
+    uint32_t value = 0;
+    for (long k = i; k >= j; k--) {
+      value = (value << 1) | mpz_tstbit(d, k);
+    }
+    if (count > 0) {
+      pending += i - j + 1;
+    }
+    if (plan != NULL) {
+      plan->shift[count] = pending;
+      plan->index[count] = value >> 1;
+    }
+    if (value >> 1 > top) {
+      top = value >> 1;
+    }
+    pending = 0;
+    count += 1;
+    i = j - 1;
+  }
+  if (plan != NULL) {
+    plan->tail = pending;
+    plan->entries = top + 1;
+  }
+  return count;
+}
+
+void mont_plan_init(mont_plan_t *plan, mpz_t d) {       // picks the window width with the fewest multiplications, table included
+  plan->entries = 0;
+  plan->count = 0;
+  plan->tail = 0;
+  plan->shift = NULL;
+  plan->index = NULL;
+  if (mpz_sgn(d) <= 0) {
+    return;
+  }
+  int best = 1;
+  size_t best_cost = mont_plan_scan(d, 1, NULL);        // width 1 needs no table beyond a itself
+  for (int w = 2; w <= MONT_MAX_WINDOW; w++) {
+    size_t cost = mont_plan_scan(d, w, NULL) + ((size_t)1 << (w - 1));   // windows plus a squaring and the odd powers
+    if (cost < best_cost) {
+      best = w;
+      best_cost = cost;
+    }
+  }
+  plan->count = mont_plan_scan(d, best, NULL);
+  plan->shift = (uint32_t *)malloc(plan->count * sizeof(uint32_t));
+  plan->index = (uint32_t *)malloc(plan->count * sizeof(uint32_t));
+  mont_plan_scan(d, best, plan);
+}
+
+void mont_plan_copy(mont_plan_t *dst, mont_plan_t *src) {   // deep copy, so dst outlives src
+  *dst = *src;
+  dst->shift = (uint32_t *)malloc(src->count * sizeof(uint32_t));
+  dst->index = (uint32_t *)malloc(src->count * sizeof(uint32_t));
+  for (size_t i = 0; i < src->count; i++) {
+    dst->shift[i] = src->shift[i];
+    dst->index[i] = src->index[i];
+  }
+}
+
+bool mont_plan_check(mont_plan_t *plan, mpz_t d) {     // replays the windows as bits and compares with d
+  if (plan->count == 0) {
+    return mpz_sgn(d) == 0 && plan->entries == 0;
+  }
+  if (plan->entries < 1 || plan->entries > (1 << (MONT_MAX_WINDOW - 1)) || plan->shift[0] != 0) {   // the table holds at most this many powers
+    return false;
+  }
+  mpz_t v;
+  mpz_init(v);
+  bool ok = true;
+  for (size_t i = 0; i < plan->count && ok; i++) {
+    ok = plan->index[i] < (uint32_t)plan->entries && plan->shift[i] <= mpz_sizeinbase(d, 2);
+    mpz_mul_2exp(v, v, plan->shift[i]);
+    mpz_add_ui(v, v, 2 * plan->index[i] + 1);
+  }
+  if (ok && plan->tail <= mpz_sizeinbase(d, 2)) {
+    mpz_mul_2exp(v, v, plan->tail);
+    ok = mpz_cmp(v, d) == 0;
+  } else {
+    ok = false;
+  }
+  mpz_clear(v);
+  return ok;
+}
+
+void mont_plan_clear(mont_plan_t *plan) {               // frees any memory used by the plan
+  free(plan->shift);
+  free(plan->index);
+}
+
+void mont_pow_plan(mpz_t o, mpz_t a, mont_plan_t *plan, mont_ctx_t *ctx) {   // replays the plan's windows; no bit scanning
+  mp_size_t s = ctx->size;
+  if (plan->count == 0) {                               // a^0 = 1
+    mont_from(o, ctx->one, ctx);
+    return;
+  }
+  mp_limb_t *acc = ctx->acc;
+  mp_limb_t *table = ctx->table;                        // table[i] = a^(2i + 1) in Montgomery form
+  mont_to(table, a, ctx);
+  if (plan->entries > 1) {
+    mont_sqr(acc, table, ctx);
+    for (long i = 1; i < plan->entries; i++) {
+      mont_mul(table + i * s, table + (i - 1) * s, acc, ctx);
+    }
+  }
+  mpn_copyi(acc, table + plan->index[0] * s, s);
+  for (size_t i = 1; i < plan->count; i++) {
+    for (uint32_t k = 0; k < plan->shift[i]; k++) {
+      mont_sqr(acc, acc, ctx);
+    }
+    mont_mul(acc, acc, table + plan->index[i] * s, ctx);
+  }
+  for (uint32_t k = 0; k < plan->tail; k++) {
+    mont_sqr(acc, acc, ctx);
+  }
+  mont_from(o, acc, ctx);
+}
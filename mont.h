@@ -0,0 +1,84 @@
+/*********************************************************************************
+* mont.h
+* Interface for mont.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Precomputed state for Montgomery arithmetic modulo one odd modulus n.
+// With R = 2^(GMP_NUMB_BITS * size), values are kept in Montgomery form a * R mod n so
+// that a product only needs a multiply and a word-by-word reduction, never a
+// full division by n.
+//
+typedef struct {
+  mp_size_t size;          // number of limbs in n; 0 until a modulus is set
+  mp_size_t cap;           // largest size the buffers below can hold
+  mpz_t n;                 // the modulus
+  mp_limb_t ninv;          // -n^-1 mod 2^GMP_NUMB_BITS
+  mp_limb_t *np;           // limbs of n
+  mp_limb_t *r2;           // R^2 mod n, used to convert into Montgomery form
+  mp_limb_t *one;          // R mod n, the Montgomery form of 1
+  mp_limb_t *prod;         // 2 * size limbs of product space
+  mp_limb_t *acc;          // exponentiation accumulator
+  mp_limb_t *table;        // odd powers of the base for window exponentiation
+  mp_limb_t *sec;          // mont_pow_sec: a selected table entry, then mpn_sec_mul / mpn_sec_sqr scratch
+  mpz_t tmp;               // reduced base when the input is not below n
+} mont_ctx_t;
+
+void mont_init(mont_ctx_t *ctx, mpz_t n);                                       // precomputes the context for an odd modulus n > 1
+
+void mont_init2(mont_ctx_t *ctx, mp_size_t cap);                                // allocates a context with no modulus yet, for moduli of up to cap limbs
+
+void mont_set(mont_ctx_t *ctx, mpz_t n);                                        // retargets the context at an odd modulus n > 1; allocates only if n is larger than before
+
+void mont_set_consts(mont_ctx_t *ctx, mpz_t n, mp_limb_t ninv, const mp_limb_t *one, const mp_limb_t *r2);   // mont_set with ninv, R mod n and R^2 mod n supplied instead of derived, e.g. loaded from a key file
+
+void mont_clear(mont_ctx_t *ctx);                                               // frees any memory used by the context
+
+void mont_to(mp_limb_t *r, mpz_t a, mont_ctx_t *ctx);                           // converts a into Montgomery form
+
+void mont_from(mpz_t o, const mp_limb_t *a, mont_ctx_t *ctx);                   // converts a out of Montgomery form
+
+void mont_mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mont_ctx_t *ctx);   // Montgomery product a * b / R mod n
+
+void mont_sqr(mp_limb_t *r, const mp_limb_t *a, mont_ctx_t *ctx);               // Montgomery square a * a / R mod n
+
+void mont_pow(mpz_t o, mpz_t a, mpz_t d, mont_ctx_t *ctx);                      // sliding-window modular exponentiation a^d mod n
+
+//
+// a^d mod n for a secret exponent 0 <= d < R. Fixed windows span every bit
+// position below R, so each window costs the same squarings and one
+// multiplication whatever its bits, and the table entry is picked by reading
+// the whole table. Products, reductions and lookups use GMP's side-channel
+// silent mpn_sec_* and mpn_cnd_* functions; timing and memory access depend
+// only on the size of n.
+//
+void mont_pow_sec(mpz_t o, mpz_t a, mpz_t d, mont_ctx_t *ctx);
+
+//
+// A sliding-window recoding of one exponent, worked out once so that many
+// exponentiations by the same exponent skip the bit scan and use the window
+// width (and table size) that costs the fewest multiplications for it.
+//
+typedef struct {
+  int entries;             // odd powers of the base needed: a, a^3, ..., a^(2 * entries - 1); 0 for a zero exponent
+  size_t count;            // number of windows
+  uint32_t *shift;         // squarings before each window; the first is always 0
+  uint32_t *index;         // table entry multiplied in at each window
+  uint32_t tail;           // squarings after the last window
+} mont_plan_t;
+
+void mont_plan_init(mont_plan_t *plan, mpz_t d);                                 // recodes a non-negative exponent d
+
+void mont_plan_copy(mont_plan_t *dst, mont_plan_t *src);                         // makes dst an independent copy of src
+
+bool mont_plan_check(mont_plan_t *plan, mpz_t d);                                // true if a plan from outside, e.g. a key file, is usable and recodes exactly d
+
+void mont_plan_clear(mont_plan_t *plan);                                        // frees any memory used by the plan
+
+void mont_pow_plan(mpz_t o, mpz_t a, mont_plan_t *plan, mont_ctx_t *ctx);        // a^d mod n for the exponent d the plan was made from
@@ -0,0 +1,273 @@
+/*********************************************************************************
+* montvec.c
+* Montgomery exponentiation of several bases at once, one per SIMD lane, with
+* AVX-512 IFMA or AVX2 kernels picked at runtime
+*********************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "montvec.h"
+
+#define MONTVEC_AVX2_BITS 768              // 26-bit digits lose to GMP's 64-bit limbs beyond about this
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MONTVEC_X86 1
+#include <immintrin.h>
+#endif
+
+static bool supported(montvec_kind_t kind) {                               // kind runs on this CPU and was compiled in
+#ifdef MONTVEC_X86
+  __builtin_cpu_init();
+  if (kind == MONTVEC_IFMA) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+  }
+  if (kind == MONTVEC_AVX2) {
+    return __builtin_cpu_supports("avx2");
+  }
+#endif
+  (void)kind;
+  return false;
+}
+
+montvec_kind_t montvec_best(size_t bits) {                                  // IFMA beats GMP at every size; AVX2 only on small moduli
+  if (supported(MONTVEC_IFMA) && bits + 2 <= MONTVEC_MAX_DIGITS * 52) {
+    return MONTVEC_IFMA;
+  }
+  if (supported(MONTVEC_AVX2) && bits <= MONTVEC_AVX2_BITS) {
+    return MONTVEC_AVX2;
+  }
+  return MONTVEC_NONE;
+}
+
+static uint64_t *vec_alloc(size_t words) {                                 // 64-byte aligned, as the kernels load whole vectors
+  size_t bytes = (words * sizeof(uint64_t) + 63) / 64 * 64;
+  uint64_t *p = (uint64_t *)aligned_alloc(64, bytes);
+  memset(p, 0, bytes);
+  return p;
+}
+
+static void put_digits(uint64_t *x, mpz_t a, int lane, montvec_ctx_t *ctx) {   // spreads 0 <= a < R over lane's digits
+  uint64_t mask = ((uint64_t)1 << ctx->bits) - 1;
+  for (size_t j = 0; j < ctx->k; j++) {
+    size_t pos = j * ctx->bits;
+    mp_size_t w = pos / 64;
+    unsigned off = pos % 64;
+    uint64_t v = mpz_getlimbn(a, w) >> off;
+    if (off + ctx->bits > 64) {                                            // the digit straddles two limbs
+      v |= (uint64_t)mpz_getlimbn(a, w + 1) << (64 - off);
+    }
+    x[j * ctx->lanes + lane] = v & mask;
+  }
+}
+
+static void get_digits(mpz_t o, const uint64_t *x, int lane, montvec_ctx_t *ctx) {   // gathers lane's normalized digits back into o
+  mp_size_t words = (ctx->k * ctx->bits + 63) / 64;
+  mp_limb_t *w = mpz_limbs_write(o, words);
+  memset(w, 0, words * sizeof(mp_limb_t));
+  for (size_t j = 0; j < ctx->k; j++) {
+    size_t pos = j * ctx->bits;
+    unsigned off = pos % 64;
+    uint64_t d = x[j * ctx->lanes + lane];
+    w[pos / 64] |= d << off;
+    if (off + ctx->bits > 64) {
+      w[pos / 64 + 1] |= d >> (64 - off);
+    }
+  }
+  mpz_limbs_finish(o, words);
+}
+
+#ifdef MONTVEC_X86
+//
+// Almost-Montgomery product r = a * b / R mod n, below 2n for a, b below 2n,
+// by operand scanning. Row i adds a * b[i] and m * n, with m chosen so that
+// digit i becomes zero, then carries digit i into digit i + 1 instead of
+// shifting the whole accumulator. IFMA gives the low and high 52 bits of each
+// product separately; they collect in lo and hi so that consecutive digits
+// do not wait on each other. Digits stay far below 2^64 for up to
+// MONTVEC_MAX_DIGITS digits, so carries only propagate once, at the end.
+//
+__attribute__((target("avx512f,avx512ifma")))
+static void amm_ifma(uint64_t *r, const uint64_t *a, const uint64_t *b, montvec_ctx_t *ctx) {
+  size_t k = ctx->k;
+  const __m512i *av = (const __m512i *)a;
+  const __m512i *bv = (const __m512i *)b;
+  const __m512i *nv = (const __m512i *)ctx->np;
+  __m512i *lo = (__m512i *)ctx->t;
+  __m512i *hi = lo + 2 * k;
+  __m512i zero = _mm512_setzero_si512();
+  __m512i ninv = _mm512_set1_epi64(ctx->ninv);
+  for (size_t j = 0; j < 2 * k; j++) {
+    lo[j] = zero;
+    hi[j] = zero;
+  }
+  for (size_t i = 0; i < k; i++) {
+    __m512i bi = bv[i];
+    __m512i x = _mm512_madd52lo_epu64(_mm512_add_epi64(lo[i], hi[i]), av[0], bi);
+    __m512i m = _mm512_madd52lo_epu64(zero, x, ninv);
+    x = _mm512_madd52lo_epu64(x, nv[0], m);                               // low 52 bits are now zero
+    hi[i + 1] = _mm512_madd52hi_epu64(_mm512_madd52hi_epu64(hi[i + 1], av[0], bi), nv[0], m);
+    lo[i + 1] = _mm512_add_epi64(lo[i + 1], _mm512_srli_epi64(x, 52));
+    for (size_t j = 1; j < k; j++) {
+      lo[i + j] = _mm512_madd52lo_epu64(_mm512_madd52lo_epu64(lo[i + j], av[j], bi), nv[j], m);
+      hi[i + j + 1] = _mm512_madd52hi_epu64(_mm512_madd52hi_epu64(hi[i + j + 1], av[j], bi), nv[j], m);
+    }
+  }
+  __m512i mask = _mm512_set1_epi64(((uint64_t)1 << 52) - 1);
+  __m512i carry = zero;
+  __m512i *rv = (__m512i *)r;
+  for (size_t j = 0; j < k; j++) {                                         // the result is digits k..2k-1
+    __m512i v = _mm512_add_epi64(_mm512_add_epi64(lo[k + j], hi[k + j]), carry);
+    rv[j] = _mm512_and_si512(v, mask);
+    carry = _mm512_srli_epi64(v, 52);
+  }
+}
+
+//
+// amm_ifma with 26-bit digits, for AVX2: _mm256_mul_epu32 multiplies the low
+// 32 bits of each lane into a full 64-bit product, so no high half is needed.
+//
+__attribute__((target("avx2")))
+static void amm_avx2(uint64_t *r, const uint64_t *a, const uint64_t *b, montvec_ctx_t *ctx) {
+  size_t k = ctx->k;
+  const __m256i *av = (const __m256i *)a;
+  const __m256i *bv = (const __m256i *)b;
+  const __m256i *nv = (const __m256i *)ctx->np;
+  __m256i *t = (__m256i *)ctx->t;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i mask = _mm256_set1_epi64x(((uint64_t)1 << 26) - 1);
+  __m256i ninv = _mm256_set1_epi64x(ctx->ninv);
+  for (size_t j = 0; j < 2 * k; j++) {
+    t[j] = zero;
+  }
+  for (size_t i = 0; i < k; i++) {
+    __m256i bi = bv[i];
+    __m256i x = _mm256_add_epi64(t[i], _mm256_mul_epu32(av[0], bi));
+    __m256i m = _mm256_and_si256(_mm256_mul_epu32(_mm256_and_si256(x, mask), ninv), mask);
+    x = _mm256_add_epi64(x, _mm256_mul_epu32(nv[0], m));                   // low 26 bits are now zero
+    t[i + 1] = _mm256_add_epi64(t[i + 1], _mm256_srli_epi64(x, 26));
+    for (size_t j = 1; j < k; j++) {
+      t[i + j] = _mm256_add_epi64(t[i + j], _mm256_add_epi64(_mm256_mul_epu32(av[j], bi), _mm256_mul_epu32(nv[j], m)));
+    }
+  }
+  __m256i carry = zero;
+  __m256i *rv = (__m256i *)r;
+  for (size_t j = 0; j < k; j++) {
+    __m256i v = _mm256_add_epi64(t[k + j], carry);
+    rv[j] = _mm256_and_si256(v, mask);
+    carry = _mm256_srli_epi64(v, 26);
+  }
+}
+#endif
+
+static void amm(uint64_t *r, const uint64_t *a, const uint64_t *b, montvec_ctx_t *ctx) {   // r may alias a or b
+#ifdef MONTVEC_X86
+  if (ctx->kind == MONTVEC_IFMA) {
+    amm_ifma(r, a, b, ctx);
+  } else {
+    amm_avx2(r, a, b, ctx);
+  }
+#else
+  (void)r, (void)a, (void)b, (void)ctx;
+#endif
+}
+
+bool montvec_init(montvec_ctx_t *ctx, mpz_t n, montvec_kind_t kind) {     // digits, -n^-1 and R^2 mod n for the chosen kernel
+  if (kind == MONTVEC_NONE || !supported(kind) || GMP_NUMB_BITS != 64) {
+    return false;
+  }
+  int bits = kind == MONTVEC_IFMA ? 52 : 26;
+  size_t k = (mpz_sizeinbase(n, 2) + 2 + bits - 1) / bits;                // R = 2^(bits * k) > 4n
+  if (k > MONTVEC_MAX_DIGITS) {
+    return false;
+  }
+  ctx->kind = kind;
+  ctx->lanes = kind == MONTVEC_IFMA ? 8 : 4;
+  ctx->fill = kind == MONTVEC_IFMA ? 2 : 4;                               // an IFMA lane costs about a quarter of a GMP exponentiation
+  ctx->bits = bits;
+  ctx->k = k;
+  uint64_t n0 = mpz_getlimbn(n, 0);
+  uint64_t inv = n0;                                                       // n0 * n0 = 1 mod 8; each step doubles the correct bits
+  for (int i = 0; i < 5; i++) {
+    inv *= 2 - n0 * inv;
+  }
+  ctx->ninv = (0 - inv) & (((uint64_t)1 << bits) - 1);
+  mpz_init_set(ctx->n, n);
+  mpz_init(ctx->tmp);
+  size_t v = k * ctx->lanes;
+  ctx->np = vec_alloc(v);
+  ctx->r2 = vec_alloc(v);
+  ctx->one = vec_alloc(v);
+  ctx->acc = vec_alloc(v);
+  ctx->t = vec_alloc(4 * v);                                               // IFMA keeps 2k low and 2k high digits
+  ctx->table = NULL;
+  ctx->entries = 0;
+  mpz_set_ui(ctx->tmp, 0);
+  mpz_setbit(ctx->tmp, 2 * bits * k);
+  mpz_mod(ctx->tmp, ctx->tmp, n);
+  for (int lane = 0; lane < ctx->lanes; lane++) {
+    put_digits(ctx->np, n, lane, ctx);
+    put_digits(ctx->r2, ctx->tmp, lane, ctx);
+    ctx->one[lane] = 1;
+  }
+  return true;
+}
+
+void montvec_clear(montvec_ctx_t *ctx) {
+  free(ctx->np);
+  free(ctx->r2);
+  free(ctx->one);
+  free(ctx->acc);
+  free(ctx->t);
+  free(ctx->table);
+  mpz_clears(ctx->n, ctx->tmp, NULL);
+}
+
+void montvec_pow_plan(mpz_t o[], mpz_t a[], size_t count, mont_plan_t *plan, montvec_ctx_t *ctx) {   // mont_pow_plan's window replay, every lane in step
+  if (plan->count == 0) {                                                  // a^0 = 1, and n > 1
+    for (size_t i = 0; i < count; i++) {
+      mpz_set_ui(o[i], 1);
+    }
+    return;
+  }
+  size_t v = ctx->k * ctx->lanes;
+  if (plan->entries > ctx->entries) {
+    free(ctx->table);
+    ctx->table = vec_alloc(plan->entries * v);
+    ctx->entries = plan->entries;
+  }
+  uint64_t *acc = ctx->acc;
+  uint64_t *table = ctx->table;                                            // table[i] = a^(2i + 1) in Montgomery form, for every lane
+  memset(acc, 0, v * sizeof(uint64_t));                                    // lanes past count stay 0 throughout
+  for (size_t i = 0; i < count; i++) {
+    mpz_ptr x = a[i];
+    if (mpz_sgn(x) < 0 || mpz_cmp(x, ctx->n) >= 0) {
+      mpz_mod(ctx->tmp, x, ctx->n);
+      x = ctx->tmp;
+    }
+    put_digits(acc, x, i, ctx);
+  }
+  amm(table, acc, ctx->r2, ctx);
+  if (plan->entries > 1) {
+    amm(acc, table, table, ctx);
+    for (long i = 1; i < plan->entries; i++) {
+      amm(table + i * v, table + (i - 1) * v, acc, ctx);
+    }
+  }
+  memcpy(acc, table + plan->index[0] * v, v * sizeof(uint64_t));
+  for (size_t i = 1; i < plan->count; i++) {
+    for (uint32_t s = 0; s < plan->shift[i]; s++) {
+      amm(acc, acc, acc, ctx);
+    }
+    amm(acc, acc, table + plan->index[i] * v, ctx);
+  }
+  for (uint32_t s = 0; s < plan->tail; s++) {
+    amm(acc, acc, acc, ctx);
+  }
+  amm(acc, acc, ctx->one, ctx);                                            // out of Montgomery form; at most n
+  for (size_t i = 0; i < count; i++) {
+    get_digits(o[i], acc, i, ctx);
+    if (mpz_cmp(o[i], ctx->n) >= 0) {
+      mpz_sub(o[i], o[i], ctx->n);
+    }
+  }
+}
@@ -0,0 +1,55 @@
+/*********************************************************************************
+* montvec.h
+* Interface for montvec.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mont.h"
+
+#define MONTVEC_MAX_LANES 8                // most exponentiations one call runs side by side
+#define MONTVEC_MAX_DIGITS 256             // longest modulus, in digits, the kernels take
+
+typedef enum {
+  MONTVEC_NONE = 0,                        // no vector kernel; use mont.h
+  MONTVEC_AVX2 = 1,                        // 4 lanes of 26-bit digits
+  MONTVEC_IFMA = 2,                        // 8 lanes of 52-bit digits, AVX-512 IFMA
+} montvec_kind_t;
+
+//
+// State for running up to MONTVEC_MAX_LANES exponentiations modulo one odd n
+// at once, one per SIMD lane. Numbers are held as k digits of a few bits
+// each, digit j of every lane side by side, so one vector instruction works
+// on the same digit of all lanes. Products are almost-Montgomery: with
+// R = 2^(bits * k) > 4n they stay below 2n and are only fully reduced on the
+// way out. A context belongs to one thread at a time.
+//
+typedef struct {
+  montvec_kind_t kind;
+  int lanes;                               // exponentiations per call
+  int fill;                                // fewest bases a call needs to beat mont_pow_plan on each of them
+  int bits;                                // bits per digit
+  size_t k;                                // digits per number
+  uint64_t ninv;                           // -n^-1 mod 2^bits
+  mpz_t n;
+  mpz_t tmp;                               // a base reduced mod n
+  uint64_t *np;                            // n in every lane; each vector below is k * lanes words
+  uint64_t *r2;                            // R^2 mod n in every lane, to convert into Montgomery form
+  uint64_t *one;                           // 1 in every lane, to convert out
+  uint64_t *acc;                           // exponentiation accumulator
+  uint64_t *t;                             // 2k + 1 words per lane of product accumulator
+  uint64_t *table;                         // odd powers of the bases for the window
+  int entries;                             // powers table has room for
+} montvec_ctx_t;
+
+montvec_kind_t montvec_best(size_t bits);                              // the kernel this CPU runs fastest for bits-bit moduli, by CPUID; MONTVEC_NONE when mont.h is faster or n is too long
+
+bool montvec_init(montvec_ctx_t *ctx, mpz_t n, montvec_kind_t kind);  // sets up kind for an odd modulus n > 1; false if kind is not available or n is too long
+
+void montvec_clear(montvec_ctx_t *ctx);                                // frees any memory used by the context
+
+void montvec_pow_plan(mpz_t o[], mpz_t a[], size_t count, mont_plan_t *plan, montvec_ctx_t *ctx);   // o[i] = a[i]^d mod n for up to ctx->lanes bases at once, d as recoded in plan; o may alias a
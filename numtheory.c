@@ -4,163 +4,536 @@
 * Includes large number operations and large prime number generation
 *********************************************************************************/
 
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include "numtheory.h"
 #include "randstate.h"
+#include "stats.h"
+
+#define SIEVE_LIMIT 65536                               // small primes used by the candidate sieve lie below this
+#define SIEVE_PRIMES 6542                               // number of odd primes below SIEVE_LIMIT
+#define SIEVE_SPAN 4096                                 // odd candidates sieved per window
+
+void numtheory_ws_init(numtheory_ws_t *ws, uint64_t bits) {   // preallocates every temporary for operands of up to bits bits
+  for (int i = 0; i < NUMTHEORY_WS_TEMPS; i++) {        // products of two operands must fit without growing
+    mpz_init2(ws->t[i], 2 * bits + GMP_NUMB_BITS);
+  }
+  ws->cap = bits / GMP_NUMB_BITS + 1;
+  mont_init2(&ws->mont, ws->cap);
+  ws->limbs = (mp_limb_t *)malloc(NUMTHEORY_WS_VECS * ws->cap * sizeof(mp_limb_t));
+}
+
+void numtheory_ws_clear(numtheory_ws_t *ws) {           // frees any memory used by the workspace
+  for (int i = 0; i < NUMTHEORY_WS_TEMPS; i++) {
+    mpz_clear(ws->t[i]);
+  }
+  mont_clear(&ws->mont);
+  free(ws->limbs);
+}
+
+static uint64_t ws_bits(mpz_t a, mpz_t b) {             // workspace size for a one-shot call on a and b
+  size_t x = mpz_sizeinbase(a, 2);
+  size_t y = mpz_sizeinbase(b, 2);
+  return x > y ? x : y;
+}
+
+static void ws_mont(numtheory_ws_t *ws, mpz_t n) {      // points the workspace's Montgomery context at n unless it already is
+  if (ws->mont.size == 0 || mpz_cmp(ws->mont.n, n) != 0) {
+    mont_set(&ws->mont, n);
+  }
+}
 
 void gcd(mpz_t d, mpz_t a, mpz_t b) {                   // computes greatest common divisor
-  mpz_t copy_b, copy_a, temp, mod;
-  mpz_inits(copy_b, copy_a, temp, mod, NULL);           // initializing mpz vars
-  mpz_set(copy_b, b);                                   // copying b so original remains unmodified
-  mpz_set(copy_a, a);                                   // copying a so original remains unmodified
-  while (mpz_cmp_ui(copy_b, 0) != 0) {                  // while b is not 0, loop and find factors
-    mpz_set(temp, copy_b);
-    mpz_mod(mod, copy_a, copy_b);
-    mpz_set(copy_b, mod);
-    mpz_set(copy_a, temp);
+  numtheory_ws_t ws;
+  numtheory_ws_init(&ws, ws_bits(a, b));
+  gcd_ws(d, a, b, &ws);
+  numtheory_ws_clear(&ws);
+}
+
+#define LEHMER_BITS 62                                  // leading bits per Lehmer step; cofactor sums stay inside int64_t
+
+static int64_t lehmer_top(mpz_t x, size_t shift) {      // bits shift and up of x, for an x below 2^(shift + LEHMER_BITS)
+  size_t limb = shift / GMP_NUMB_BITS;
+  unsigned off = shift % GMP_NUMB_BITS;
+  uint64_t v = mpz_getlimbn(x, limb) >> off;
+  if (off != 0) {
+    v |= (uint64_t)mpz_getlimbn(x, limb + 1) << (GMP_NUMB_BITS - off);
   }
-  mpz_set(d, copy_a);                                   // set output var to a
-  mpz_clears(copy_b, copy_a, temp, mod, NULL);          // clear mpz vars initialized inside function
+  return (int64_t)(v & (((uint64_t)1 << LEHMER_BITS) - 1));
+}
+
+//
+// Runs Euclid on the leading LEHMER_BITS of x and the same bits of y, for as
+// long as the single-word quotients provably match the full ones (Knuth's
+// Algorithm L), and collects the steps as the matrix (A B; C D). Returns false
+// if not even one step was certain, and a full division step is needed.
+//
+static bool lehmer_step(mpz_t x, mpz_t y, int64_t m[4]) {
+  size_t shift = mpz_sizeinbase(x, 2) - LEHMER_BITS;
+  int64_t xh = lehmer_top(x, shift);
+  int64_t yh = lehmer_top(y, shift);
+  int64_t a = 1, b = 0, c = 0, d = 1;
+  while (yh + c != 0 && yh + d != 0) {
+    int64_t q = (xh + a) / (yh + c);
+    if (q != (xh + b) / (yh + d)) {                     // the true quotient is not pinned down
+      break;
+    }
+    int64_t t = a - q * c;
+    a = c;
+    c = t;
+    t = b - q * d;
+    b = d;
+    d = t;
+    t = xh - q * yh;
+    xh = yh;
+    yh = t;
+  }
+  m[0] = a;
+  m[1] = b;
+  m[2] = c;
+  m[3] = d;
+  return b != 0;
+}
+
+static void lehmer_apply(mpz_t x, mpz_t y, const int64_t m[4], mpz_t t1, mpz_t t2) {   // (x, y) = (A x + B y, C x + D y), through t1 and t2
+  mpz_mul_si(t1, x, m[0]);
+  if (m[1] >= 0) {
+    mpz_addmul_ui(t1, y, m[1]);
+  } else {
+    mpz_submul_ui(t1, y, -m[1]);
+  }
+  mpz_mul_si(t2, x, m[2]);
+  if (m[3] >= 0) {
+    mpz_addmul_ui(t2, y, m[3]);
+  } else {
+    mpz_submul_ui(t2, y, -m[3]);
+  }
+  mpz_swap(x, t1);
+  mpz_swap(y, t2);
+}
+
+void gcd_ws(mpz_t d, mpz_t a, mpz_t b, numtheory_ws_t *ws) {   // Lehmer's algorithm: most steps on one word, applied to the full values in bulk
+  mpz_ptr x = ws->t[0];
+  mpz_ptr y = ws->t[1];
+  mpz_ptr t1 = ws->t[2];
+  mpz_ptr t2 = ws->t[3];
+  mpz_abs(x, a);                                        // copies so the inputs remain unmodified
+  mpz_abs(y, b);
+  if (mpz_cmp(x, y) < 0) {
+    mpz_swap(x, y);
+  }
+  int64_t m[4];
+  while (mpz_sgn(y) != 0) {
+    if (mpz_size(x) > 1 && lehmer_step(x, y, m)) {
+      lehmer_apply(x, y, m, t1, t2);
+    } else {                                            // one word left, or a large quotient: an ordinary step
+      mpz_tdiv_r(t1, x, y);
+      mpz_swap(x, y);
+      mpz_swap(y, t1);
+    }
+  }
+  mpz_set(d, x);
 }
 
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n) {           // computes modulo inverse
-  mpz_t r1, r2, t1, t2, q, p, m, temp, add;             // initializing mpz vars
-  mpz_inits(r1, r2, t1, t2, q, p, m, temp, add, NULL);
+  numtheory_ws_t ws;
+  numtheory_ws_init(&ws, ws_bits(a, n));
+  mod_inverse_ws(o, a, n, &ws);
+  numtheory_ws_clear(&ws);
+}
+
+void mod_inverse_ws(mpz_t o, mpz_t a, mpz_t n, numtheory_ws_t *ws) {   // extended Lehmer, tracking only the cofactors of a
+  mpz_ptr x = ws->t[0];
+  mpz_ptr y = ws->t[1];
+  mpz_ptr u0 = ws->t[2];                                // x = u0 * a mod n
+  mpz_ptr u1 = ws->t[3];                                // y = u1 * a mod n
+  mpz_ptr t1 = ws->t[4];
+  mpz_ptr t2 = ws->t[5];
+  mpz_set(x, n);
+  mpz_mod(y, a, n);
+  mpz_set_ui(u0, 0);
+  mpz_set_ui(u1, 1);
+  int64_t m[4];
+  while (mpz_sgn(y) != 0) {
+    if (mpz_size(x) > 1 && lehmer_step(x, y, m)) {
+      lehmer_apply(x, y, m, t1, t2);
+      lehmer_apply(u0, u1, m, t1, t2);
+    } else {
+      mpz_tdiv_qr(t1, t2, x, y);
+      mpz_swap(x, y);
+      mpz_swap(y, t2);
+      mpz_submul(u0, t1, u1);                           // (u0, u1) = (u1, u0 - q * u1)
+      mpz_swap(u0, u1);
+    }
+  }
+  if (mpz_cmp_ui(x, 1) != 0) {                          // no inverse unless the gcd is 1
+    mpz_set_ui(o, 0);
+    return;
+  }
+  mpz_mod(o, u0, n);
+}
+
+void gcd_euclid(mpz_t d, mpz_t a, mpz_t b) {            // Euclid's algorithm, one division per step
+  mpz_t x, y, r;
+  mpz_inits(x, y, r, NULL);
+  mpz_set(x, a);
+  mpz_set(y, b);
+  while (mpz_sgn(y) != 0) {                             // (x, y) = (y, x mod y) until y is 0
+    mpz_mod(r, x, y);
+    mpz_swap(x, y);
+    mpz_swap(y, r);
+  }
+  mpz_set(d, x);
+  mpz_clears(x, y, r, NULL);
+}
+
+void mod_inverse_euclid(mpz_t o, mpz_t a, mpz_t n) {    // extended Euclid, one division per step
+  mpz_t r1, r2, t1, t2, q, tmp;
+  mpz_inits(r1, r2, t1, t2, q, tmp, NULL);
   mpz_set(r1, n);
   mpz_set(r2, a);
   mpz_set_ui(t1, 0);
   mpz_set_ui(t2, 1);
-  while (mpz_cmp_ui(r2, 0) != 0) {                      // while r' is not equal to 0, loop
-    mpz_fdiv_q(q, r1, r2);                              // quotient of r and r'
+  while (mpz_sgn(r2) != 0) {                            // while r' is not equal to 0, loop
+    mpz_fdiv_qr(q, tmp, r1, r2);                        // quotient of r and r', and r - q * r'
+    mpz_swap(r1, r2);
+    mpz_swap(r2, tmp);                                  // (r, r') = (r', r - q * r')
 
-    mpz_set(temp, r1);                                  // auxiliary variable for r
-    mpz_set(r1, r2);
-    mpz_mul(p, q, r2);
-    mpz_sub(m, temp, p);                                // q * r'
-    mpz_set(r2, m);                                     // r - q * r'
-
-    mpz_set(temp, t1);                                  // auxiliary variable for t
-    mpz_set(t1, t2);
-    mpz_mul(p, q, t2);                                  // q * t'
-    mpz_sub(m, temp, p);                                // t - q * t'
-    mpz_set(t2, m);
+    mpz_set(tmp, t1);
+    mpz_submul(tmp, q, t2);                             // t - q * t'
+    mpz_swap(t1, t2);
+    mpz_swap(t2, tmp);                                  // (t, t') = (t', t - q * t')
   }
   if (mpz_cmp_ui(r1, 1) > 0) {                          // if r > 1, no inverse
     mpz_set_ui(o, 0);
-    mpz_clears(r1, r2, t1, t2, q, p, m, temp, add, NULL);
-    return;
-  }
-  if (mpz_cmp_ui(t1, 0) < 0) {                          // if t < 0, t = t + n
-    mpz_add(add, t1, n);
-    mpz_set(t1, add);
+  } else {
+    if (mpz_sgn(t1) < 0) {                              // if t < 0, t = t + n
+      mpz_add(t1, t1, n);
+    }
+    mpz_set(o, t1);
   }
-  mpz_set(o, t1);                                       // set output to t
-  mpz_clears(r1, r2, t1, t2, q, p, m, temp, add, NULL);
+  mpz_clears(r1, r2, t1, t2, q, tmp, NULL);
 }
 
-void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {      // computes base**exponent % modulus
-  mpz_t p, copy_d, rem, prod, mod, p_prod, p_mod, q, two;
-  mpz_inits(p, copy_d, rem, prod, mod, p_prod, p_mod, q, two, NULL);
-  mpz_set(copy_d, d);
-  mpz_set_ui(o, 1);
+void pow_mod_ladder(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {   // computes base**exponent % modulus one bit at a time with divisions
+  mpz_t p, prod;
+  mpz_inits(p, prod, NULL);
   mpz_set(p, a);
-  while (mpz_cmp_ui(copy_d, 0) > 0) {                   // while d > 0, loop
-    mpz_mod_ui(rem, copy_d, 2);
-    if (mpz_cmp_ui(rem, 1) == 0) {                      // if d is odd, o = (o * p) % n
+  mpz_set_ui(o, 1);
+  size_t bits = mpz_sgn(d) > 0 ? mpz_sizeinbase(d, 2) : 0;
+  for (size_t i = 0; i < bits; i++) {                   // walks d from its low bit up
+    if (mpz_tstbit(d, i) != 0) {                        // if the bit is set, o = (o * p) % n
       mpz_mul(prod, o, p);
-      mpz_mod(mod, prod, n);
-      mpz_set(o, mod);
+      mpz_mod(o, prod, n);
     }
-    mpz_mul(p_prod, p, p);                              // p^2
-    mpz_mod(p_mod, p_prod, n);                          // p^2 % n
-    mpz_set(p, p_mod);                                  // p = p^2 % n
+    mpz_mul(prod, p, p);                                // p = p^2 % n
+    mpz_mod(p, prod, n);
+  }
+  mpz_clears(p, prod, NULL);
+}
 
-    mpz_set_ui(two, 2);
-    mpz_fdiv_q(q, copy_d, two);                         // floor of d / 2
-    mpz_set(copy_d, q);                                 // d = floor of d / 2
+void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {      // computes base**exponent % modulus
+  if (mpz_odd_p(n) == 0 || mpz_cmp_ui(n, 1) == 0) {     // Montgomery form needs an odd modulus above 1
+    pow_mod_ladder(o, a, d, n);
+    return;
   }
-  mpz_clears(p, copy_d, rem, prod, mod, p_prod, p_mod, q, two, NULL);
+  mont_ctx_t ctx;
+  mont_init(&ctx, n);
+  mont_pow(o, a, d, &ctx);
+  mont_clear(&ctx);
 }
 
-bool is_prime(mpz_t n, uint64_t iters) {                // Miller-Rabin primality test
-  mpz_t copy_n, start, one, right, floor, ceil, r, rand, y, y2, two;
-  mpz_inits(copy_n, start, one, right, floor, ceil, r, rand, y, y2, two, NULL);
+void pow_mod_ws(mpz_t o, mpz_t a, mpz_t d, mpz_t n, numtheory_ws_t *ws) {   // pow_mod reusing the workspace's Montgomery context
+  if (mpz_odd_p(n) == 0 || mpz_cmp_ui(n, 1) == 0) {
+    pow_mod_ladder(o, a, d, n);
+    return;
+  }
+  ws_mont(ws, n);
+  mont_pow(o, a, d, &ws->mont);
+}
 
-  if (mpz_cmp_ui(n, 0) == 0 || mpz_cmp_ui(n, 1) == 0) {          // since program cannot tell if 0-3 are prime or not, this is provided
-    return false;
+void pow_mod_sec(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {  // computes base**exponent % modulus without leaking the exponent
+  if (mpz_odd_p(n) == 0 || mpz_cmp_ui(n, 1) == 0) {     // no RSA modulus gets here
+    pow_mod_ladder(o, a, d, n);
+    return;
+  }
+  mont_ctx_t ctx;
+  mont_init(&ctx, n);
+  mont_pow_sec(o, a, d, &ctx);
+  mont_clear(&ctx);
+}
+
+void pow_mod_sec_ws(mpz_t o, mpz_t a, mpz_t d, mpz_t n, numtheory_ws_t *ws) {   // pow_mod_sec reusing the workspace's Montgomery context
+  if (mpz_odd_p(n) == 0 || mpz_cmp_ui(n, 1) == 0) {
+    pow_mod_ladder(o, a, d, n);
+    return;
   }
-  if (mpz_cmp_ui(n, 3) == 0) {
+  ws_mont(ws, n);
+  mont_pow_sec(o, a, d, &ws->mont);
+}
+
+bool is_prime(mpz_t n, uint64_t iters) {                // Miller-Rabin primality test
+  return is_prime_r(n, iters, state);
+}
+
+bool is_prime_r(mpz_t n, uint64_t iters, gmp_randstate_t rs) {   // Miller-Rabin primality test with bases drawn from rs
+  numtheory_ws_t ws;
+  numtheory_ws_init(&ws, mpz_sizeinbase(n, 2));
+  bool prime = is_prime_ws(n, iters, rs, &ws);
+  numtheory_ws_clear(&ws);
+  return prime;
+}
+
+uint64_t prime_rounds(uint64_t bits) {                  // error below 2^-80 on a random bits-bit candidate (Damgard-Landrock-Pomerance bounds, as in OpenSSL)
+  return bits >= 3747 ? 3 : bits >= 1345 ? 4 : bits >= 476 ? 5 : bits >= 400 ? 6 : bits >= 347 ? 7 : bits >= 308 ? 8 : bits >= 55 ? 27 : 34;
+}
+
+static bool mr_round(mpz_t base, mpz_t r, mp_bitcnt_t s, mpz_t y, mpz_t minus1, mp_limb_t *ym, mp_limb_t *minus1m, mont_ctx_t *ctx) {   // one strong probable-prime round; n - 1 = 2^s * r
+  mont_pow(y, base, r, ctx);                            // y = base^r % n
+  if (mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, minus1) == 0) {
     return true;
   }
+  mont_to(ym, y, ctx);                                  // square in Montgomery form without leaving it
+  for (mp_bitcnt_t j = 1; j < s; j++) {
+    mont_sqr(ym, ym, ctx);
+    if (mpn_cmp(ym, ctx->one, ctx->size) == 0) {        // y == 1 before reaching n - 1: composite
+      return false;
+    }
+    if (mpn_cmp(ym, minus1m, ctx->size) == 0) {         // y == n - 1: this round passes
+      return true;
+    }
+  }
+  return false;
+}
 
-  int s = 0;                                            // exponent s begins at 0
-  mpz_set(copy_n, n);
-  mpz_set_ui(one, 1);
-  mpz_set_ui(two, 2);
-  mpz_sub_ui(start, copy_n, 1);
-  while (1) {                                           // finds exponent s and odd number r such that n - 1 = 2^s * r
-    mpz_mul_2exp(right, one, s);
-    mpz_fdiv_q(floor, start, right);
-    mpz_cdiv_q(ceil, start, right);
-    if (mpz_cmp(floor, ceil) != 0) {                    // break loop if n - 1 / 2^s is no longer an integer
-      break;
+static void mod_add(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mont_ctx_t *ctx) {   // r = a + b mod n, for a and b below n
+  mp_limb_t cy = mpn_add_n(r, a, b, ctx->size);
+  if (cy != 0 || mpn_cmp(r, ctx->np, ctx->size) >= 0) {
+    mpn_sub_n(r, r, ctx->np, ctx->size);
+  }
+}
+
+static void mod_sub(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mont_ctx_t *ctx) {   // r = a - b mod n, for a and b below n
+  if (mpn_sub_n(r, a, b, ctx->size) != 0) {
+    mpn_add_n(r, r, ctx->np, ctx->size);
+  }
+}
+
+//
+// Strong Lucas probable-prime test with Selfridge's parameters: D is the first
+// of 5, -7, 9, -11, ... with Jacobi symbol (D/n) = -1, P = 1 and Q = (1 - D) / 4.
+// Only V is carried through the ladder, in Montgomery form; U_d is zero
+// exactly when D * U_d = 2 * V_(d+1) - P * V_d is. Takes an odd n > 3 whose
+// Montgomery context is already set, and uses ws->t[0..1] and five vectors of
+// ws->limbs.
+//
+static bool lucas_prp_ws(mpz_t n, numtheory_ws_t *ws) {
+  mont_ctx_t *ctx = &ws->mont;
+  mp_size_t size = ctx->size;
+  mpz_ptr d = ws->t[0];
+  mpz_ptr q = ws->t[1];
+  long sd = 5;
+  int jacobi;
+  for (int tries = 0; (jacobi = mpz_si_kronecker(sd, n)) != -1; tries++) {
+    if (jacobi == 0 && mpz_cmp_ui(n, labs(sd)) != 0) {  // |D| divides n
+      return false;
+    }
+    if (jacobi == 0) {                                  // n = |D| is one of the small primes passed over
+      return true;
+    }
+    if (tries == 8 && mpz_perfect_square_p(n)) {        // no D exists for a square; rare, so only checked once the search runs long
+      return false;
+    }
+    sd = sd > 0 ? -(sd + 2) : -sd + 2;
+  }
+  mpz_set_si(q, (1 - sd) / 4);
+
+  mp_limb_t *v = ws->limbs;                             // V_k
+  mp_limb_t *v1 = v + size;                             // V_(k+1)
+  mp_limb_t *qk = v1 + size;                            // Q^k
+  mp_limb_t *qm = qk + size;                            // Q
+  mp_limb_t *t = qm + size;
+  mont_to(qm, q, ctx);
+  mpn_copyi(qk, ctx->one, size);
+  mod_add(v, ctx->one, ctx->one, ctx);                  // V_0 = 2
+  mpn_copyi(v1, ctx->one, size);                        // V_1 = P = 1
+
+  mpz_add_ui(d, n, 1);                                  // n + 1 = 2^s * d with d odd
+  mp_bitcnt_t s = mpz_scan1(d, 0);
+  mpz_fdiv_q_2exp(d, d, s);
+  for (long i = (long)mpz_sizeinbase(d, 2) - 1; i >= 0; i--) {   // k -> 2k or 2k + 1, from the top bit of d down
+    if (mpz_tstbit(d, i) == 0) {
+      mont_mul(v1, v, v1, ctx);                         // V_(2k+1) = V_k * V_(k+1) - P * Q^k
+      mod_sub(v1, v1, qk, ctx);
+      mont_sqr(v, v, ctx);                              // V_2k = V_k^2 - 2 * Q^k
+      mod_sub(v, v, qk, ctx);
+      mod_sub(v, v, qk, ctx);
+      mont_sqr(qk, qk, ctx);
+    } else {
+      mont_mul(v, v, v1, ctx);                          // V_(2k+1) = V_k * V_(k+1) - P * Q^k
+      mod_sub(v, v, qk, ctx);
+      mont_mul(t, qk, qm, ctx);                         // Q^(k+1)
+      mont_sqr(v1, v1, ctx);                            // V_(2k+2) = V_(k+1)^2 - 2 * Q^(k+1)
+      mod_sub(v1, v1, t, ctx);
+      mod_sub(v1, v1, t, ctx);
+      mont_mul(qk, qk, t, ctx);                         // Q^(2k+1)
+    }
+  }
+
+  mod_add(t, v1, v1, ctx);                              // U_d = 0 or V_d = 0: probable prime
+  if (mpn_cmp(t, v, size) == 0 || mpn_zero_p(v, size)) {
+    return true;
+  }
+  for (mp_bitcnt_t r = 1; r < s; r++) {                 // V_(d * 2^r) = 0 for some 0 < r < s: probable prime
+    mont_sqr(v, v, ctx);
+    mod_sub(v, v, qk, ctx);
+    mod_sub(v, v, qk, ctx);
+    if (mpn_zero_p(v, size)) {
+      return true;
     }
-    s += 1;                      // increment exponent by 1
+    mont_sqr(qk, qk, ctx);
   }
-  s -= 1;                        // find previous s, since current s is the non-integer exponent for n
-  
-  mpz_mul_2exp(right, one, s);                          // 2^s
-  mpz_fdiv_q(r, start, right);                          // r = n - 1 / 2^s
+  return false;
+}
+
+bool is_prime_ws(mpz_t n, uint64_t iters, gmp_randstate_t rs, numtheory_ws_t *ws) {   // Miller-Rabin or Baillie-PSW with every temporary taken from ws
+  if (mpz_cmp_ui(n, 3) <= 0) {                          // since program cannot tell if 0-3 are prime or not, this is provided
+    return mpz_cmp_ui(n, 2) >= 0;
+  }
+  if (mpz_even_p(n) != 0) {
+    return false;
+  }
+
+  mpz_ptr start = ws->t[0];
+  mpz_ptr r = ws->t[1];
+  mpz_ptr rand = ws->t[2];
+  mpz_ptr y = ws->t[3];
+  mpz_sub_ui(start, n, 1);
+  mp_bitcnt_t s = mpz_scan1(start, 0);                  // finds exponent s and odd number r such that n - 1 = 2^s * r
+  mpz_fdiv_q_2exp(r, start, s);
+
+  ws_mont(ws, n);                                       // one Montgomery context serves every round for this n
+  mont_ctx_t *ctx = &ws->mont;
+  if (ctx->size > ws->cap) {                            // n is wider than the workspace was sized for
+    free(ws->limbs);
+    ws->cap = ctx->size;
+    ws->limbs = (mp_limb_t *)malloc(NUMTHEORY_WS_VECS * ws->cap * sizeof(mp_limb_t));
+  }
+  mp_limb_t *ym = ws->limbs;
+  mp_limb_t *minus1 = ym + ctx->size;                   // n - 1 in Montgomery form
+  mont_to(minus1, start, ctx);
 
-  for (uint64_t i = 1; i < iters; i++) {                // iterates through specified num of iters
+  mpz_set_ui(rand, 2);                                  // base 2 first: no draw, and nearly every composite stops here
+  bool prime = mr_round(rand, r, s, y, start, ym, minus1, ctx);
+  uint64_t rounds = 1;
+  if (iters == PRIME_ITERS_BPSW) {
+    stats_add(STATS_MR_ROUNDS, rounds);
+    if (!prime) {
+      return false;
+    }
+    stats_add(STATS_LUCAS, 1);
+    return lucas_prp_ws(n, ws);
+  }
+  if (iters == PRIME_ITERS_AUTO) {
+    iters = prime_rounds(mpz_sizeinbase(n, 2));
+  }
+  for (; rounds < iters && prime; rounds++) {           // the remaining rounds use random bases
     while (1) {
-      mpz_urandomm(rand, state, start);                 // find random number 2 to n - 2, inclusive
+      mpz_urandomm(rand, rs, start);                    // find random number 2 to n - 2, inclusive
       if (mpz_cmp_ui(rand, 1) > 0) {
         break;
       }
     }
-    pow_mod(y, rand, r, copy_n);                        // Miller-Rabin primality test
-    if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, start) != 0) {
-      int j = 1;
-      while (j <= s - 1 && mpz_cmp(y, start) != 0) {
-        pow_mod(y2, y, two, copy_n);
-        mpz_set(y, y2);                                 // auxiliary temp variable for y
-        if (mpz_cmp_ui(y, 1) == 0) {
-          mpz_clears(copy_n, start, one, right, floor, ceil, r, rand, y, y2, two, NULL);
-          return false;                                 // return false if y == 1
-        }
-        j += 1;
-      }
-      if (mpz_cmp(y, start) != 0) {                     // return false if y != n - 1
-        mpz_clears(copy_n, start, one, right, floor, ceil, r, rand, y, y2, two, NULL);
-        return false;
-      }
-    }
+    prime = mr_round(rand, r, s, y, start, ym, minus1, ctx);
   }
-  mpz_clears(copy_n, start, one, right, floor, ceil, r, rand, y, y2, two, NULL);
-  return true;                                          // clear mpz vars initialized inside function and return true
+  stats_add(STATS_MR_ROUNDS, rounds);
+  return prime;
 }
 
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {           // generates random numbers until a prime is found
-  while (1) {
-    mpz_urandomb(p, state, bits);
-    if (mpz_sizeinbase(p, 2) == bits) {                 // get a rand num exactly 'bits' long
-      if (mpz_even_p(p) != 0) {                         // if it is even, make it odd
-        mpz_add_ui(p, p, 1);
-      }
-      int cont = 0;                                     // if this is 1, it will go to the next iter of the while loop
-      for (int i = 3; i < 542; i += 2) {                // checks if the random num is divisible by a bunch of odd nums to filter out nums that cannot be prime
-        if (mpz_divisible_ui_p(p, i) == 1 && mpz_cmp_ui(p, i) != 0) {
-          cont = 1;
-          break;                                        // sets cont = 1, so remainder of while loop is skipped; is_prime is skipped for this number
+  make_prime_r(p, bits, iters, state, NULL);
+}
+
+static uint32_t small_primes[SIEVE_PRIMES];              // odd primes below SIEVE_LIMIT
+static uint64_t num_small_primes = 0;
+static pthread_once_t small_primes_once = PTHREAD_ONCE_INIT;
+
+static void small_primes_init(void) {                   // sieve of Eratosthenes over the odd numbers below SIEVE_LIMIT
+  uint8_t *composite = (uint8_t *)calloc(SIEVE_LIMIT, 1);
+  for (uint32_t i = 3; i < SIEVE_LIMIT; i += 2) {
+    if (composite[i] != 0) {
+      continue;
+    }
+    small_primes[num_small_primes++] = i;
+    for (uint64_t j = (uint64_t)i * i; j < SIEVE_LIMIT; j += 2 * i) {
+      composite[j] = 1;
+    }
+  }
+  free(composite);
+}
+
+bool make_prime_r(mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rs, atomic_bool *cancel) {   // make_prime from rs; stops early once *cancel is set
+  pthread_once(&small_primes_once, small_primes_init);
+  uint64_t nprimes = 0;                                 // only sieve with primes below 2^(bits - 1), which no candidate can equal
+  while (nprimes < num_small_primes && (bits > 32 || small_primes[nprimes] < (1ULL << (bits - 1)))) {
+    nprimes += 1;
+  }
+  uint32_t *residues = (uint32_t *)malloc((nprimes + 1) * sizeof(uint32_t));
+  uint8_t *sieve = (uint8_t *)malloc(SIEVE_SPAN);
+  mpz_t start;
+  mpz_init2(start, bits + GMP_NUMB_BITS);
+  numtheory_ws_t ws;                                    // shared by every candidate, so testing them does not allocate
+  numtheory_ws_init(&ws, bits);
+  bool found = false;
+  uint64_t candidates = 0;                              // counted here and added once, keeping the loops free of atomics
+  uint64_t sieved = 0;
+
+  while (!found && (cancel == NULL || !atomic_load_explicit(cancel, memory_order_relaxed))) {
+    mpz_urandomb(start, rs, bits);                      // random odd start point exactly 'bits' long
+    mpz_setbit(start, bits - 1);
+    mpz_setbit(start, 0);
+    for (uint64_t i = 0; i < nprimes; i++) {            // the only divisions by small primes for this start point
+      residues[i] = mpz_fdiv_ui(start, small_primes[i]);
+    }
+    while (!found && mpz_sizeinbase(start, 2) == bits && (cancel == NULL || !atomic_load_explicit(cancel, memory_order_relaxed))) {
+      memset(sieve, 0, SIEVE_SPAN);                     // sieve[j] != 0 marks start + 2j as divisible by a small prime
+      for (uint64_t i = 0; i < nprimes; i++) {
+        uint32_t q = small_primes[i];
+        uint64_t j = residues[i] == 0 ? 0 : q - residues[i];   // first j with start + j = 0 mod q ...
+        if (j % 2 == 1) {                               // ... that is an even offset, since start is odd
+          j += q;
+        }
+        for (j /= 2; j < SIEVE_SPAN; j += q) {
+          sieve[j] = 1;
         }
       }
-      if (cont == 1) {
-        continue;
+      for (uint64_t j = 0; j < SIEVE_SPAN && !found; j++) {   // full Miller-Rabin only on survivors
+        candidates += 1;
+        if (sieve[j] != 0) {
+          sieved += 1;
+          continue;
+        }
+        mpz_add_ui(p, start, 2 * j);
+        if (mpz_sizeinbase(p, 2) != bits) {             // stepped past the top of the range; draw a new start point
+          break;
+        }
+        uint64_t t = stats_start();
+        found = is_prime_ws(p, iters, rs, &ws);
+        stats_stop(STATS_PRIME_TEST, t, 1);
       }
-      if (is_prime(p, iters) == 1) {                    // this will only run if the number passes the filter
-        break;
+      mpz_add_ui(start, start, 2 * SIEVE_SPAN);          // steps the window; residues follow without any mpz division
+      for (uint64_t i = 0; i < nprimes; i++) {
+        residues[i] = (residues[i] + 2 * SIEVE_SPAN) % small_primes[i];
       }
     }
   }
+  stats_add(STATS_CANDIDATES, candidates);
+  stats_add(STATS_SIEVED, sieved);
+  stats_add(STATS_PRIMES, found);
+  mpz_clear(start);
+  numtheory_ws_clear(&ws);
+  free(residues);
+  free(sieve);
+  return found;
 }
@@ -6,16 +6,66 @@
 #pragma once
 
 #include <gmp.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "mont.h"
+
+#define NUMTHEORY_WS_TEMPS 6                 // scratch integers held by a workspace
+#define NUMTHEORY_WS_VECS 5                  // cap-limb vectors of Montgomery scratch held by a workspace
+
+#define PRIME_ITERS_AUTO 0                   // is_prime iters: as many Miller-Rabin rounds as prime_rounds gives for n
+#define PRIME_ITERS_BPSW UINT64_MAX          // is_prime iters: Baillie-PSW, a strong base-2 round then a strong Lucas test
+
+//
+// Scratch space for the number theory kernels, sized for one operand width
+// up front. The *_ws functions only use memory from the workspace, so calls
+// that reuse one (and keep to its size) do not touch the heap. Every other
+// kernel is a one-shot wrapper that builds and frees a workspace per call.
+// A workspace belongs to one thread at a time.
+//
+typedef struct {
+  mpz_t t[NUMTHEORY_WS_TEMPS];               // scratch integers with room for 2 * bits
+  mont_ctx_t mont;                           // Montgomery context for the last odd modulus used
+  mp_limb_t *limbs;                          // NUMTHEORY_WS_VECS * cap limbs of Montgomery scratch for is_prime_ws
+  mp_size_t cap;                             // limbs available in limbs
+} numtheory_ws_t;
+
+void numtheory_ws_init(numtheory_ws_t *ws, uint64_t bits);   // allocates a workspace for operands of up to bits bits
+
+void numtheory_ws_clear(numtheory_ws_t *ws);                 // frees any memory used by the workspace
 
 void gcd(mpz_t d, mpz_t a, mpz_t b);                          // greatest common divisor of large numbers
 
+void gcd_ws(mpz_t d, mpz_t a, mpz_t b, numtheory_ws_t *ws);   // gcd using the workspace for its temporaries; Lehmer's algorithm
+
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n);                  // modular inverse of large numbers
 
-void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n);             // modular exponentiation of large numbers
+void mod_inverse_ws(mpz_t o, mpz_t a, mpz_t n, numtheory_ws_t *ws);   // mod_inverse using the workspace for its temporaries; extended Lehmer
+
+void gcd_euclid(mpz_t d, mpz_t a, mpz_t b);                   // textbook Euclid, one division per step; reference for gcd
+
+void mod_inverse_euclid(mpz_t o, mpz_t a, mpz_t n);           // textbook extended Euclid; reference for mod_inverse
+
+void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n);             // modular exponentiation of large numbers; Montgomery form for odd n
 
-bool is_prime(mpz_t n, uint64_t iters);                       // prime checking based on the Miller-Rabin primality test
+void pow_mod_ws(mpz_t o, mpz_t a, mpz_t d, mpz_t n, numtheory_ws_t *ws);   // pow_mod keeping the Montgomery context in the workspace while n stays the same
+
+void pow_mod_ladder(mpz_t o, mpz_t a, mpz_t d, mpz_t n);      // bit-by-bit modular exponentiation using division; reference for pow_mod
+
+void pow_mod_sec(mpz_t o, mpz_t a, mpz_t d, mpz_t n);         // pow_mod for a secret exponent: constant time for odd n, see mont_pow_sec
+
+void pow_mod_sec_ws(mpz_t o, mpz_t a, mpz_t d, mpz_t n, numtheory_ws_t *ws);   // pow_mod_sec keeping the Montgomery context in the workspace while n stays the same
+
+uint64_t prime_rounds(uint64_t bits);                         // Miller-Rabin rounds that keep the error on a random bits-bit candidate below 2^-80
+
+bool is_prime(mpz_t n, uint64_t iters);                       // Miller-Rabin test of iters rounds, the first with base 2; or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW
+
+bool is_prime_r(mpz_t n, uint64_t iters, gmp_randstate_t rs); // is_prime drawing its bases from the given random state
+
+bool is_prime_ws(mpz_t n, uint64_t iters, gmp_randstate_t rs, numtheory_ws_t *ws);   // is_prime_r using the workspace for its temporaries and Montgomery context
 
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);      // prime number generation through random seeding
+
+bool make_prime_r(mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rs, atomic_bool *cancel);   // make_prime from the given random state; returns false once *cancel is set
@@ -0,0 +1,199 @@
+/*********************************************************************************
+* pipeline.c
+* Ordered multi-threaded block pipeline used by file encryption and decryption.
+* The calling thread reads batches into a ring of slots, workers exponentiate
+* any filled slot, and a writer thread drains slots strictly in sequence.
+*********************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pipeline.h"
+#include "stats.h"
+
+enum { SLOT_FREE, SLOT_FILLED, SLOT_BUSY, SLOT_DONE };
+
+typedef struct {
+  mpz_t in[PIPELINE_BATCH];
+  mpz_t out[PIPELINE_BATCH];
+  size_t count;                            // blocks held in this slot
+  int status;
+} slot_t;
+
+typedef struct {
+  pipeline_t *pipe;
+  slot_t *slots;
+  uint64_t nslots;
+  uint64_t next_work;                      // sequence number of the next batch a worker should take
+  uint64_t filled;                         // number of batches read so far
+  bool eof;                                // set once the reader has seen the end of input
+  pthread_mutex_t lock;
+  pthread_cond_t changed;                  // broadcast on every slot state change
+} ring_t;
+
+static void apply_batch(pipeline_t *pipe, slot_t *slot, void *local) {       // exponentiates every block of one slot
+  if (pipe->apply_many != NULL) {                                          // e.g. several blocks side by side in vector lanes
+    uint64_t start = stats_start();
+    pipe->apply_many(slot->out, slot->in, slot->count, pipe->key, local);
+    stats_stop(STATS_POW, start, slot->count);
+    return;
+  }
+  for (size_t i = 0; i < slot->count; i++) {
+    uint64_t start = stats_start();
+    pipe->apply(slot->out[i], slot->in[i], pipe->key, local);
+    stats_stop(STATS_POW, start, 1);
+  }
+}
+
+static void *worker(void *arg) {                                           // takes filled slots in sequence and processes them
+  ring_t *ring = (ring_t *)arg;
+  pipeline_t *pipe = ring->pipe;
+  void *local = pipe->local_init != NULL ? pipe->local_init(pipe->key) : NULL;
+  pthread_mutex_lock(&ring->lock);
+  while (1) {
+    while (ring->next_work == ring->filled && !ring->eof) {
+      pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    if (ring->next_work == ring->filled) {                                 // end of input and nothing left to take
+      break;
+    }
+    slot_t *slot = &ring->slots[ring->next_work % ring->nslots];
+    ring->next_work += 1;
+    slot->status = SLOT_BUSY;
+    pthread_mutex_unlock(&ring->lock);
+
+    apply_batch(pipe, slot, local);
+
+    pthread_mutex_lock(&ring->lock);
+    slot->status = SLOT_DONE;
+    pthread_cond_broadcast(&ring->changed);
+  }
+  pthread_mutex_unlock(&ring->lock);
+  if (local != NULL && pipe->local_clear != NULL) {
+    pipe->local_clear(local);
+  }
+  return NULL;
+}
+
+static void *writer(void *arg) {                                           // writes finished slots in their original order
+  ring_t *ring = (ring_t *)arg;
+  uint64_t seq = 0;
+  pthread_mutex_lock(&ring->lock);
+  while (1) {
+    slot_t *slot = &ring->slots[seq % ring->nslots];
+    while (!(seq < ring->filled && slot->status == SLOT_DONE) && !(ring->eof && seq == ring->filled)) {
+      pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    if (seq == ring->filled) {                                             // everything read has been written
+      break;
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    uint64_t start = stats_start();
+    ring->pipe->write(ring->pipe->io, slot->out, slot->count);
+    stats_stop(STATS_WRITE, start, slot->count);
+
+    pthread_mutex_lock(&ring->lock);
+    slot->status = SLOT_FREE;
+    seq += 1;
+    pthread_cond_broadcast(&ring->changed);
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return NULL;
+}
+
+static void run_inline(pipeline_t *pipe) {                                 // single-threaded pipeline: read, apply, write in turn
+  slot_t slot;
+  for (size_t i = 0; i < PIPELINE_BATCH; i++) {
+    mpz_inits(slot.in[i], slot.out[i], NULL);
+  }
+  void *local = pipe->local_init != NULL ? pipe->local_init(pipe->key) : NULL;
+  while (1) {
+    uint64_t start = stats_start();
+    slot.count = pipe->read(pipe->io, slot.in, PIPELINE_BATCH);
+    stats_stop(STATS_READ, start, slot.count);
+    if (slot.count == 0) {
+      break;
+    }
+    apply_batch(pipe, &slot, local);
+    start = stats_start();
+    pipe->write(pipe->io, slot.out, slot.count);
+    stats_stop(STATS_WRITE, start, slot.count);
+  }
+  if (local != NULL && pipe->local_clear != NULL) {
+    pipe->local_clear(local);
+  }
+  for (size_t i = 0; i < PIPELINE_BATCH; i++) {
+    mpz_clears(slot.in[i], slot.out[i], NULL);
+  }
+}
+
+void pipeline_run(pipeline_t *pipe, uint64_t threads) {                    // runs a pipeline until the end of input
+  if (threads <= 1) {
+    run_inline(pipe);
+    return;
+  }
+  ring_t ring;
+  ring.pipe = pipe;
+  ring.nslots = 2 * threads;                                               // lets the reader stay a batch ahead of every worker
+  ring.slots = (slot_t *)malloc(ring.nslots * sizeof(slot_t));
+  ring.next_work = 0;
+  ring.filled = 0;
+  ring.eof = false;
+  pthread_mutex_init(&ring.lock, NULL);
+  pthread_cond_init(&ring.changed, NULL);
+  for (uint64_t s = 0; s < ring.nslots; s++) {
+    for (size_t i = 0; i < PIPELINE_BATCH; i++) {
+      mpz_inits(ring.slots[s].in[i], ring.slots[s].out[i], NULL);
+    }
+    ring.slots[s].count = 0;
+    ring.slots[s].status = SLOT_FREE;
+  }
+
+  pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  pthread_t writer_thread;
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_create(&workers[t], NULL, worker, &ring);
+  }
+  pthread_create(&writer_thread, NULL, writer, &ring);
+
+  pthread_mutex_lock(&ring.lock);                                          // the calling thread is the reader
+  while (1) {
+    slot_t *slot = &ring.slots[ring.filled % ring.nslots];
+    while (slot->status != SLOT_FREE) {
+      pthread_cond_wait(&ring.changed, &ring.lock);
+    }
+    pthread_mutex_unlock(&ring.lock);
+
+    uint64_t start = stats_start();
+    size_t count = pipe->read(pipe->io, slot->in, PIPELINE_BATCH);
+    stats_stop(STATS_READ, start, count);
+
+    pthread_mutex_lock(&ring.lock);
+    if (count == 0) {
+      ring.eof = true;
+      pthread_cond_broadcast(&ring.changed);
+      break;
+    }
+    slot->count = count;
+    slot->status = SLOT_FILLED;
+    ring.filled += 1;
+    pthread_cond_broadcast(&ring.changed);
+  }
+  pthread_mutex_unlock(&ring.lock);
+
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_join(workers[t], NULL);
+  }
+  pthread_join(writer_thread, NULL);
+
+  for (uint64_t s = 0; s < ring.nslots; s++) {
+    for (size_t i = 0; i < PIPELINE_BATCH; i++) {
+      mpz_clears(ring.slots[s].in[i], ring.slots[s].out[i], NULL);
+    }
+  }
+  free(workers);
+  free(ring.slots);
+  pthread_mutex_destroy(&ring.lock);
+  pthread_cond_destroy(&ring.changed);
+}
@@ -0,0 +1,38 @@
+/*********************************************************************************
+* pipeline.h
+* Interface for pipeline.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPELINE_BATCH 32                  // blocks handed to a worker at a time
+
+//
+// Callbacks that drive a block pipeline.
+// read and write are only ever called from one thread at a time, in block
+// order; apply (or apply_many) runs concurrently on the worker threads.
+//
+typedef struct {
+  void *io;                                                     // state shared by read and write
+  size_t (*read)(void *io, mpz_t in[], size_t max);             // fills up to max blocks; returns how many, 0 at end of input
+  void (*write)(void *io, mpz_t out[], size_t count);           // emits finished blocks in input order
+  void *key;                                                    // read-only state shared by every worker
+  void *(*local_init)(void *key);                               // optional per-worker state; may be NULL
+  void (*local_clear)(void *local);                             // frees per-worker state; may be NULL
+  void (*apply)(mpz_t out, mpz_t in, void *key, void *local);   // the per-block exponentiation
+  void (*apply_many)(mpz_t out[], mpz_t in[], size_t count, void *key, void *local);   // optional; exponentiates a whole batch at once instead of apply
+} pipeline_t;
+
+//
+// Runs a pipeline until read reports the end of input.
+// A reader stage cuts the input into batches, worker threads exponentiate
+// whole batches, and a writer stage emits them in their original order.
+//
+// pipe: the callbacks to run.
+// threads: number of worker threads; 1 runs every stage on the calling thread.
+//
+void pipeline_run(pipeline_t *pipe, uint64_t threads);
@@ -0,0 +1,89 @@
+/*********************************************************************************
+* primegen.c
+* Parallel prime search for key generation
+*********************************************************************************/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "primegen.h"
+#include "numtheory.h"
+#include "randstate.h"
+
+typedef struct {                                          // one prime being searched for by a group of threads
+  mpz_ptr out;
+  uint64_t bits;
+  uint64_t iters;
+  uint64_t fixed_e;
+  atomic_bool found;                                      // set by the winner; the other threads stop at their next candidate
+  pthread_mutex_t lock;
+} prime_job_t;
+
+typedef struct {
+  prime_job_t *job;
+  uint64_t stream;                                        // random stream number, unique across both groups
+} prime_worker_t;
+
+static void *prime_worker(void *arg) {                    // searches until this thread or another in its group finds a prime
+  prime_worker_t *w = (prime_worker_t *)arg;
+  prime_job_t *job = w->job;
+  gmp_randstate_t rs;
+  randstate_derive(rs, w->stream);
+  mpz_t cand, minus1;
+  mpz_inits(cand, minus1, NULL);
+  while (make_prime_r(cand, job->bits, job->iters, rs, &job->found)) {
+    if (job->fixed_e != 0) {                              // e must be coprime to prime - 1
+      mpz_sub_ui(minus1, cand, 1);
+      if (mpz_gcd_ui(NULL, minus1, job->fixed_e) != 1) {
+        continue;
+      }
+    }
+    pthread_mutex_lock(&job->lock);
+    if (!atomic_load(&job->found)) {                      // only the first winner stores its prime
+      mpz_set(job->out, cand);
+      atomic_store(&job->found, true);
+    }
+    pthread_mutex_unlock(&job->lock);
+    break;
+  }
+  mpz_clears(cand, minus1, NULL);
+  gmp_randclear(rs);
+  return NULL;
+}
+
+static void job_init(prime_job_t *job, mpz_t out, uint64_t bits, uint64_t iters, uint64_t fixed_e) {
+  job->out = out;
+  job->bits = bits;
+  job->iters = iters;
+  job->fixed_e = fixed_e;
+  atomic_init(&job->found, false);
+  pthread_mutex_init(&job->lock, NULL);
+}
+
+void primegen_pair(mpz_t p, uint64_t pbits, mpz_t q, uint64_t qbits, uint64_t iters, uint64_t fixed_e, uint64_t threads, uint64_t stream) {
+  prime_job_t jobs[2];
+  job_init(&jobs[0], p, pbits, iters, fixed_e);
+  job_init(&jobs[1], q, qbits, iters, fixed_e);
+  uint64_t np = threads / 2;                              // threads searching for p; the rest search for q
+  if (np < 1) {
+    np = 1;
+  }
+  if (threads < np + 1) {
+    threads = np + 1;
+  }
+
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  prime_worker_t *workers = (prime_worker_t *)malloc(threads * sizeof(prime_worker_t));
+  for (uint64_t t = 0; t < threads; t++) {
+    workers[t].job = t < np ? &jobs[0] : &jobs[1];
+    workers[t].stream = stream + t;
+    pthread_create(&tids[t], NULL, prime_worker, &workers[t]);
+  }
+  for (uint64_t t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+  }
+  free(tids);
+  free(workers);
+  pthread_mutex_destroy(&jobs[0].lock);
+  pthread_mutex_destroy(&jobs[1].lock);
+}
@@ -0,0 +1,29 @@
+/*********************************************************************************
+* primegen.h
+* Interface for primegen.c
+*********************************************************************************/
+
+#pragma once
+
+#include <gmp.h>
+#include <stdint.h>
+
+//
+// Finds the two primes of an RSA modulus on several threads at once.
+// Half of the threads search for p and the other half for q, each drawing
+// from its own random state derived from the seed given to randstate_init:
+// streams stream to stream + threads - 1, so that several pairs made from
+// one seed do not repeat each other's primes.
+// The first thread in a group to find a prime cancels the rest of its group,
+// so which stream's prime is kept depends on thread timing: the same seed
+// can give different primes from one run to the next.
+// All mpz_t arguments are expected to be initialized.
+//
+// p: will store a prime of pbits bits.
+// q: will store a prime of qbits bits.
+// iters: number of Miller-Rabin iterations per candidate, or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW.
+// fixed_e: if not 0, primes where fixed_e shares a factor with prime - 1 are skipped.
+// threads: total number of search threads; at least 2.
+// stream: first random stream the threads use.
+//
+void primegen_pair(mpz_t p, uint64_t pbits, mpz_t q, uint64_t qbits, uint64_t iters, uint64_t fixed_e, uint64_t threads, uint64_t stream);
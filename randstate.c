@@ -7,8 +7,10 @@
 #include "randstate.h"
 
 gmp_randstate_t state;
+static uint64_t base_seed;                                 // seed given to randstate_init, reused by randstate_derive
 
 void randstate_init(uint64_t seed) {                       // Initializes the random state needed for RSA key generation operations; can be seeded
+  base_seed = seed;
   gmp_randinit_mt(state);
   gmp_randseed_ui(state, seed);
   srandom(seed);
@@ -16,3 +18,13 @@ void randstate_init(uint64_t seed) {                       // Initializes the ra
 
 void randstate_clear(void) { gmp_randclear(state); }       // Frees any memory used by the initialized random state
 
+void randstate_derive(gmp_randstate_t rs, uint64_t stream) {   // Initializes an independent state for one thread
+  mpz_t seed;
+  mpz_init_set_ui(seed, base_seed);
+  mpz_mul_2exp(seed, seed, 64);
+  mpz_add_ui(seed, seed, stream + 1);                      // seed * 2^64 + stream + 1 never equals a plain seed
+  gmp_randinit_mt(rs);
+  gmp_randseed(rs, seed);
+  mpz_clear(seed);
+}
+
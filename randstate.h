@@ -13,3 +13,5 @@ extern gmp_randstate_t state;
 void randstate_init(uint64_t seed);        // Initializes the random state needed for RSA key generation operations; can be seeded
 
 void randstate_clear(void);                // Frees any memory used by the initialized random state
+
+void randstate_derive(gmp_randstate_t rs, uint64_t stream);   // Initializes an independent state for one thread, derived from the seed and a stream number
@@ -3,41 +3,75 @@
 * Contains RSA key generation, encryption, and decryption functionality
 *********************************************************************************/
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "rsa.h"
+#include "chunk.h"
+#include "container.h"
+#include "hybrid.h"
+#include "keyfile.h"
+#include "mapfile.h"
+#include "mont.h"
+#include "montvec.h"
 #include "numtheory.h"
+#include "pipeline.h"
+#include "primegen.h"
 #include "randstate.h"
+#include "stats.h"
 
-void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters) {           // makes a public key and stores it in mpz vars
-  mpz_t lambda, phi, den, pminus1, qminus1, rand2;
-  mpz_inits(lambda, phi, den, pminus1, qminus1, rand2, NULL);
+bool rsa_is_fermat_prime(uint64_t e) {                                      // 2^(2^k) + 1 for k = 0..4
+  return e == 3 || e == 5 || e == 17 || e == 257 || e == 65537;
+}
 
-  uint64_t pbits, qbits, rand;
-  uint64_t lower = nbits / 4;                                       // lower bound for rand num = n / 4
-  uint64_t upper = (nbits * 3) / 4;                                 // upper bound for rand num = 3n / 4
+static void rsa_make_primes(mpz_ptr primes[], uint64_t bits[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads, gmp_randstate_t rs) {   // makes a public key once the bits of every prime are chosen
+  mpz_t lambda, den, minus1, rand2;
+  mpz_inits(lambda, den, minus1, rand2, NULL);
 
-  while (1) {                             // finds random num between lower and upper bounds
-    rand = random() % upper;
-    if (rand < lower) {
+  for (uint64_t i = 0; i < count; i += 2) {
+    if (threads > 1 && i + 1 < count) {   // two primes are searched for at the same time, fixed_e already respected; each pair gets its own streams
+      primegen_pair(primes[i], bits[i], primes[i + 1], bits[i + 1], iters, fixed_e, threads, i / 2 * threads);
       continue;
     }
-    break;
+    make_prime_r(primes[i], bits[i], iters, rs, NULL);   // make a prime and store it
+    if (i + 1 < count) {
+      make_prime_r(primes[i + 1], bits[i + 1], iters, rs, NULL);
+    }
+  }
+  for (uint64_t i = 0; i < count; i++) {  // e shares a factor with lambda(n) only if it shares one with some prime - 1
+    while (1) {
+      bool repeat = false;                // two primes of the same size can coincide, most likely for small primes
+      for (uint64_t j = 0; j < i; j++) {
+        repeat |= mpz_cmp(primes[i], primes[j]) == 0;
+      }
+      mpz_sub_ui(minus1, primes[i], 1);
+      if (!repeat && (fixed_e == 0 || mpz_gcd_ui(NULL, minus1, fixed_e) == 1)) {
+        break;
+      }
+      make_prime_r(primes[i], bits[i], iters, rs, NULL);
+    }
+  }
+  mpz_set(n, primes[0]);                  // n = product of the primes
+  for (uint64_t i = 1; i < count; i++) {
+    mpz_mul(n, n, primes[i]);
+  }
+  if (fixed_e != 0) {
+    mpz_set_ui(e, fixed_e);
+    mpz_clears(lambda, den, minus1, rand2, NULL);
+    return;
   }
-  pbits = rand;                           // pbits = newfound rand num
-  qbits = nbits - pbits;                  // qbits gets the remaining bits, nbits - pbits
-  make_prime(p, pbits, iters);            // make a prime and store it in p
-  make_prime(q, qbits, iters);            // make a prime and store it in q
-  mpz_mul(n, p, q);                       // n = product of p and q
 
-  mpz_sub_ui(pminus1, p, 1);
-  mpz_sub_ui(qminus1, q, 1);
-  mpz_mul(phi, pminus1, qminus1);         // equivalent to totient(n)
-  gcd(den, pminus1, qminus1);
-  mpz_fdiv_q(lambda, phi, den);           // calculating lambda(n) with Carmichael's function
+  mpz_set_ui(lambda, 1);                  // calculating lambda(n) with Carmichael's function: lcm of every prime - 1
+  for (uint64_t i = 0; i < count; i++) {
+    mpz_sub_ui(minus1, primes[i], 1);
+    gcd(den, lambda, minus1);
+    mpz_mul(lambda, lambda, minus1);
+    mpz_fdiv_q(lambda, lambda, den);
+  }
 
   while (1) {                             // find a public exponent e
-    mpz_urandomb(rand2, state, nbits);
+    mpz_urandomb(rand2, rs, nbits);
     if (mpz_sizeinbase(rand2, 2) == nbits) {
       gcd(e, rand2, lambda);
       if (mpz_cmp_ui(e, 1) == 0) {        // break once e is found; e coprime to lambda(n)
@@ -46,102 +80,1317 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
       }
     }
   }
-  mpz_clears(lambda, phi, den, pminus1, qminus1, rand2, NULL);
+  mpz_clears(lambda, den, minus1, rand2, NULL);
+}
+
+static void rsa_make_pub_split(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t pbits, uint64_t iters, uint64_t fixed_e, uint64_t threads, gmp_randstate_t rs) {   // makes a two-prime public key once the bits of p are chosen
+  mpz_ptr primes[2] = { p, q };
+  uint64_t bits[2] = { pbits, nbits - pbits };   // qbits gets the remaining bits, nbits - pbits
+  rsa_make_primes(primes, bits, 2, n, e, nbits, iters, fixed_e, threads, rs);
+}
+
+void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads) {   // makes a public key and stores it in mpz vars
+  rsa_make_pub_split(p, q, n, e, nbits, nbits - nbits / 2, iters, fixed_e, threads, state);   // balanced, so both CRT halves cost the same
+}
+
+void rsa_make_pub_r(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, gmp_randstate_t rs) {   // rsa_make_pub drawing everything from rs
+  rsa_make_pub_split(p, q, n, e, nbits, nbits - nbits / 2, iters, fixed_e, 1, rs);
+}
+
+static void rsa_make_multi_split(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads, gmp_randstate_t rs) {   // balanced primes, the first nbits % count one bit longer
+  mpz_ptr ptrs[RSA_MAX_PRIMES];
+  uint64_t bits[RSA_MAX_PRIMES];
+  for (uint64_t i = 0; i < count; i++) {
+    ptrs[i] = primes[i];
+    bits[i] = nbits / count + (i < nbits % count ? 1 : 0);
+  }
+  rsa_make_primes(ptrs, bits, count, n, e, nbits, iters, fixed_e, threads, rs);
+}
+
+void rsa_make_pub_multi(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads) {   // makes a multi-prime public key
+  rsa_make_multi_split(primes, count, n, e, nbits, iters, fixed_e, threads, state);
+}
+
+void rsa_make_pub_multi_r(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, gmp_randstate_t rs) {   // rsa_make_pub_multi drawing everything from rs
+  rsa_make_multi_split(primes, count, n, e, nbits, iters, fixed_e, 1, rs);
+}
+
+void rsa_make_family(mpz_t p, mpz_t q, mpz_t n, uint64_t e[], uint64_t count, uint64_t nbits, uint64_t iters, uint64_t threads) {   // one modulus for the first count Fermat primes
+  uint64_t product = 1;
+  for (uint64_t i = 0; i < count; i++) {
+    e[i] = (1ULL << (1ULL << i)) + 1;                                      // 3, 5, 17, 257, 65537
+    product *= e[i];
+  }
+  mpz_t ep;
+  mpz_init(ep);
+  rsa_make_pub(p, q, n, ep, nbits, iters, product, threads);               // primes are redrawn until the product is coprime to p - 1 and q - 1
+  mpz_clear(ep);
 }
 
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {                  // writes public key to a specified file
   gmp_fprintf(pbfile, "%Zx\n%Zx\n%Zx\n%s\n", n, e, s, username);
 }
 
-void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {                   // reads public key from a specified file
-  gmp_fscanf(pbfile, "%Zx\n%Zx\n%Zx\n%s\n", n, e, s, username);
+bool rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char **username, FILE *pbfile) {                   // reads public key from a specified file
+  if (keyfile_is_binary(pbfile)) {
+    keyfile_pub_t kp;
+    keyfile_pub_init(&kp);
+    bool ok = keyfile_read_pub(&kp, pbfile);
+    mpz_swap(n, kp.n);
+    mpz_swap(e, kp.e);
+    mpz_swap(s, kp.s);
+    free(*username);
+    *username = kp.username;                                                 // handed over, not copied
+    kp.username = NULL;
+    keyfile_pub_clear(&kp);
+    return ok;
+  }
+  free(*username);
+  *username = NULL;
+  if (gmp_fscanf(pbfile, "%Zx\n%Zx\n%Zx\n", n, e, s) != 3) {
+    return false;
+  }
+  size_t cap = 0;
+  ssize_t len = getline(username, &cap, pbfile);                           // any length, where %s needed a fixed buffer
+  if (len <= 0) {
+    return false;
+  }
+  if ((*username)[len - 1] == '\n') {
+    (*username)[len - 1] = '\0';
+  }
+  return true;
+}
+
+void rsa_priv_init(rsa_priv_t *key) {                                      // initializes every field of a private key to 0
+  mpz_inits(key->n, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+  key->extra = 0;
+  for (int i = 0; i < RSA_MAX_PRIMES - 2; i++) {
+    mpz_inits(key->r[i], key->dr[i], key->tr[i], NULL);
+  }
+}
+
+void rsa_priv_clear(rsa_priv_t *key) {                                     // frees memory used by a private key
+  mpz_clears(key->n, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+  for (int i = 0; i < RSA_MAX_PRIMES - 2; i++) {
+    mpz_clears(key->r[i], key->dr[i], key->tr[i], NULL);
+  }
+}
+
+void rsa_priv_swap(rsa_priv_t *a, rsa_priv_t *b) {                         // exchanges every field of two private keys
+  mpz_swap(a->n, b->n);
+  mpz_swap(a->d, b->d);
+  mpz_swap(a->p, b->p);
+  mpz_swap(a->q, b->q);
+  mpz_swap(a->dp, b->dp);
+  mpz_swap(a->dq, b->dq);
+  mpz_swap(a->qinv, b->qinv);
+  uint64_t extra = a->extra;
+  a->extra = b->extra;
+  b->extra = extra;
+  for (int i = 0; i < RSA_MAX_PRIMES - 2; i++) {
+    mpz_swap(a->r[i], b->r[i]);
+    mpz_swap(a->dr[i], b->dr[i]);
+    mpz_swap(a->tr[i], b->tr[i]);
+  }
+}
+
+bool rsa_priv_has_crt(rsa_priv_t *key) {                                   // CRT values are present when p is known
+  return mpz_cmp_ui(key->p, 0) != 0;
+}
+
+static void rsa_make_priv_primes(rsa_priv_t *key, mpz_t e, mpz_ptr primes[], uint64_t count) {   // makes a private key from its primes, p and q first
+  mpz_t lambda, den, minus1, prod;
+  mpz_inits(lambda, den, minus1, prod, NULL);
+  mpz_set_ui(lambda, 1);                                                   // calculating lambda(n) with Carmichael's function: lcm of every prime - 1
+  for (uint64_t i = 0; i < count; i++) {
+    mpz_sub_ui(minus1, primes[i], 1);
+    gcd(den, lambda, minus1);
+    mpz_mul(lambda, lambda, minus1);
+    mpz_fdiv_q(lambda, lambda, den);
+  }
+  mod_inverse(key->d, e, lambda);                                          // private key d = modulo inverse of e and lambda(n)
+
+  mpz_set(key->p, primes[0]);
+  mpz_set(key->q, primes[1]);
+  mpz_sub_ui(minus1, key->p, 1);
+  mpz_mod(key->dp, key->d, minus1);                                        // dp = d mod (p - 1)
+  mpz_sub_ui(minus1, key->q, 1);
+  mpz_mod(key->dq, key->d, minus1);                                        // dq = d mod (q - 1)
+  mod_inverse(key->qinv, key->q, key->p);                                  // qinv = q^-1 mod p
+  mpz_mul(prod, key->p, key->q);
+  key->extra = count - 2;
+  for (uint64_t i = 0; i < key->extra; i++) {                              // each further prime after the ones before it, as in RFC 8017
+    mpz_set(key->r[i], primes[i + 2]);
+    mpz_sub_ui(minus1, key->r[i], 1);
+    mpz_mod(key->dr[i], key->d, minus1);                                   // dr = d mod (r - 1)
+    mod_inverse(key->tr[i], prod, key->r[i]);                              // tr = (p * q * ...)^-1 mod r
+    mpz_mul(prod, prod, key->r[i]);
+  }
+  mpz_set(key->n, prod);
+  mpz_clears(lambda, den, minus1, prod, NULL);
+}
+
+void rsa_make_priv(rsa_priv_t *key, mpz_t e, mpz_t p, mpz_t q) {          // makes a private key and stores it in the key struct
+  mpz_ptr primes[2] = { p, q };
+  rsa_make_priv_primes(key, e, primes, 2);
+}
+
+void rsa_make_priv_multi(rsa_priv_t *key, mpz_t e, mpz_t primes[], uint64_t count) {   // makes a multi-prime private key
+  mpz_ptr ptrs[RSA_MAX_PRIMES];
+  for (uint64_t i = 0; i < count; i++) {
+    ptrs[i] = primes[i];
+  }
+  rsa_make_priv_primes(key, e, ptrs, count);
+}
+
+void rsa_write_priv(rsa_priv_t *key, FILE *pvfile) {                       // writes private key to specified file
+  gmp_fprintf(pvfile, "%Zx\n%Zx\n", key->n, key->d);
+  if (rsa_priv_has_crt(key)) {                                             // CRT values follow n and d so older readers still work
+    gmp_fprintf(pvfile, "%Zx\n%Zx\n%Zx\n%Zx\n%Zx\n", key->p, key->q, key->dp, key->dq, key->qinv);
+    for (uint64_t i = 0; i < key->extra; i++) {                            // then r, dr and tr of each further prime
+      gmp_fprintf(pvfile, "%Zx\n%Zx\n%Zx\n", key->r[i], key->dr[i], key->tr[i]);
+    }
+  }
+}
+
+bool rsa_read_priv(rsa_priv_t *key, FILE *pvfile) {                        // reads private key from specified file
+  if (keyfile_is_binary(pvfile)) {
+    keyfile_priv_t kp;
+    keyfile_priv_init(&kp);
+    bool ok = keyfile_read_priv(&kp, pvfile);
+    rsa_priv_swap(key, &kp.key);
+    keyfile_priv_clear(&kp);
+    return ok;
+  }
+  key->extra = 0;
+  if (gmp_fscanf(pvfile, "%Zx\n%Zx\n", key->n, key->d) != 2) {
+    return false;
+  }
+  int read = gmp_fscanf(pvfile, "%Zx\n%Zx\n%Zx\n%Zx\n%Zx\n", key->p, key->q, key->dp, key->dq, key->qinv);
+  if (read != 5) {                                                         // two-field key file; no CRT values
+    mpz_set_ui(key->p, 0);
+    return true;
+  }
+  while (key->extra < RSA_MAX_PRIMES - 2
+         && gmp_fscanf(pvfile, "%Zx\n%Zx\n%Zx\n", key->r[key->extra], key->dr[key->extra], key->tr[key->extra]) == 3) {
+    key->extra += 1;                                                       // a multi-prime key's further primes
+  }
+  mpz_t pq;
+  mpz_init(pq);
+  mpz_mul(pq, key->p, key->q);
+  for (uint64_t i = 0; i < key->extra; i++) {
+    mpz_mul(pq, pq, key->r[i]);
+  }
+  if (mpz_cmp(pq, key->n) != 0) {                                          // ignore CRT values that do not match n
+    mpz_set_ui(key->p, 0);
+    key->extra = 0;
+  }
+  mpz_clear(pq);
+  return true;
+}
+
+static void rsa_priv_ws_init(rsa_priv_ws_t *ws, rsa_priv_t *key) {         // sizes every temporary for the key's modulus
+  uint64_t bits = mpz_sizeinbase(key->n, 2);
+  numtheory_ws_init(&ws->wp, bits);
+  numtheory_ws_init(&ws->wq, bits);
+  mpz_init2(ws->ap, bits);
+  mpz_init2(ws->m1, bits);
+  ws->extra = key->extra;
+  for (uint64_t i = 0; i < ws->extra; i++) {
+    numtheory_ws_init(&ws->wr[i], bits);
+  }
+  for (uint64_t i = 0; i <= ws->extra; i++) {
+    mpz_init(ws->c[i]);
+  }
+  mp_size_t s = mpz_size(key->n);
+  mp_size_t itch = 0;
+  if (rsa_priv_has_crt(key)) {                                             // reduced once here, so each step multiplies numbers of its prime's length
+    mpz_mod(ws->c[0], key->qinv, key->p);
+    mpz_ptr primes[RSA_MAX_PRIMES] = { key->p, key->q };
+    for (uint64_t i = 0; i < ws->extra; i++) {
+      mpz_mod(ws->c[i + 1], key->tr[i], key->r[i]);
+      primes[i + 2] = key->r[i];
+    }
+    mp_size_t sum = 0;
+    for (uint64_t i = 0; i < ws->extra + 2; i++) {
+      sum += mpz_size(primes[i]);
+    }
+    s = sum > s ? sum : s;
+    for (uint64_t i = 0; i < ws->extra + 2; i++) {
+      mp_size_t div = mpn_sec_div_r_itch(2 * s, mpz_size(primes[i]));
+      itch = div > itch ? div : itch;
+    }
+  }
+  ws->limbs = s;
+  mp_size_t mul = mpn_sec_mul_itch(s, s);
+  itch = mul > itch ? mul : itch;
+  ws->a = (mp_limb_t *)malloc(s * sizeof(mp_limb_t));
+  ws->o = (mp_limb_t *)malloc(s * sizeof(mp_limb_t));
+  ws->prod = (mp_limb_t *)malloc(s * sizeof(mp_limb_t));
+  ws->t = (mp_limb_t *)malloc(2 * s * sizeof(mp_limb_t));
+  ws->u = (mp_limb_t *)malloc(s * sizeof(mp_limb_t));
+  ws->w = (mp_limb_t *)malloc(2 * s * sizeof(mp_limb_t));
+  ws->sec = (mp_limb_t *)malloc((itch + 1) * sizeof(mp_limb_t));
+}
+
+static void rsa_priv_ws_clear(rsa_priv_ws_t *ws) {
+  numtheory_ws_clear(&ws->wp);
+  numtheory_ws_clear(&ws->wq);
+  for (uint64_t i = 0; i < ws->extra; i++) {
+    numtheory_ws_clear(&ws->wr[i]);
+  }
+  for (uint64_t i = 0; i <= ws->extra; i++) {
+    mpz_clear(ws->c[i]);
+  }
+  mpz_clears(ws->ap, ws->m1, NULL);
+  free(ws->a);
+  free(ws->o);
+  free(ws->prod);
+  free(ws->t);
+  free(ws->u);
+  free(ws->w);
+  free(ws->sec);
+}
+
+static void rsa_sec_load(mp_limb_t *r, mpz_t x, mp_size_t size) {          // copies the limbs of x into r, zero-padded to size limbs
+  mp_size_t used = mpz_size(x);
+  mpn_copyi(r, mpz_limbs_read(x), used);
+  mpn_zero(r + used, size - used);
+}
+
+static void rsa_sec_mul(mp_limb_t *r, const mp_limb_t *a, mp_size_t an, const mp_limb_t *b, mp_size_t bn, mp_limb_t *sec) {   // mpn_sec_mul with the longer operand first
+  if (an >= bn) {
+    mpn_sec_mul(r, a, an, b, bn, sec);
+  } else {
+    mpn_sec_mul(r, b, bn, a, an, sec);
+  }
+}
+
+static void rsa_sec_reduce(rsa_priv_ws_t *ws, mpz_t m) {                   // ws->ap = a % m for the input a; the time depends on the lengths only
+  mp_size_t mn = mpz_size(m);
+  mpn_copyi(ws->t, ws->a, ws->limbs);
+  mpn_sec_div_r(ws->t, ws->limbs, mpz_limbs_read(m), mn, ws->sec);
+  mpn_copyi(mpz_limbs_write(ws->ap, mn), ws->t, mn);
+  mpz_limbs_finish(ws->ap, mn);
 }
 
-void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {                   // makes a private key and stores it in mpz vars
-  mpz_t lambda, phi, gcd2, pminus1, qminus1;
-  mpz_inits(lambda, phi, gcd2, pminus1, qminus1, NULL);
-  mpz_sub_ui(pminus1, p, 1);
-  mpz_sub_ui(qminus1, q, 1);
-  mpz_mul(phi, pminus1, qminus1);                                          // equivalent to totient(n, or pq)
-  gcd(gcd2, pminus1, qminus1);
-  mpz_fdiv_q(lambda, phi, gcd2);                                           // calculating lambda(n) with Carmichael's function
-  mod_inverse(d, e, lambda);                                               // private key d = modulo inverse of e and lambda(n)
-  mpz_clears(lambda, phi, gcd2, pminus1, qminus1, NULL);
+static mp_size_t rsa_sec_garner(rsa_priv_ws_t *ws, mp_size_t on, mpz_t m, mpz_t r, mpz_t c) {   // Garner's step o += prod * (c * (m - o) % r), then prod *= r, for o < prod of on limbs; returns their new length
+  mp_size_t rn = mpz_size(r);
+  const mp_limb_t *rp = mpz_limbs_read(r);
+  mp_size_t tn = on > rn ? on : rn;
+  mpn_copyi(ws->t, ws->o, on);
+  mpn_zero(ws->t + on, tn - on);
+  mpn_sec_div_r(ws->t, tn, rp, rn, ws->sec);                               // o % r
+  rsa_sec_load(ws->u, m, rn);
+  mp_limb_t borrow = mpn_sub_n(ws->u, ws->u, ws->t, rn);
+  mpn_cnd_add_n(borrow, ws->u, ws->u, rp, rn);                             // (m - o) % r, adding r back without a branch
+  rsa_sec_load(ws->t, c, rn);
+  mpn_sec_mul(ws->w, ws->u, rn, ws->t, rn, ws->sec);
+  mpn_sec_div_r(ws->w, 2 * rn, rp, rn, ws->sec);                           // h = c * (m - o) % r
+  rsa_sec_mul(ws->t, ws->prod, on, ws->w, rn, ws->sec);
+  mpn_zero(ws->o + on, rn);
+  mpn_add_n(ws->o, ws->o, ws->t, on + rn);                                 // o + h * prod < prod * r, so no carry out
+  rsa_sec_mul(ws->w, ws->prod, on, rp, rn, ws->sec);
+  mpn_copyi(ws->prod, ws->w, on + rn);
+  return on + rn;
 }
 
-void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {                      // writes private key to specified file
-  gmp_fprintf(pvfile, "%Zx\n%Zx\n", n, d);
+static void rsa_priv_pow(mpz_t o, mpz_t a, rsa_priv_t *key, rsa_priv_ws_t *ws) {   // computes a^d % n, as one exponentiation per prime given CRT values; no secret value ever steers a branch, a table read or the length of an operation
+  if (!rsa_priv_has_crt(key)) {
+    pow_mod_sec_ws(o, a, key->d, key->n, &ws->wp);
+    return;
+  }
+  if (mpz_sgn(a) < 0 || mpz_cmp(a, key->n) >= 0) {                        // the input is public, e.g. a ciphertext
+    mpz_mod(ws->ap, a, key->n);
+    rsa_sec_load(ws->a, ws->ap, ws->limbs);
+  } else {
+    rsa_sec_load(ws->a, a, ws->limbs);                                     // o may be a, so a is read only from here on
+  }
+  rsa_sec_reduce(ws, key->q);
+  pow_mod_sec_ws(ws->m1, ws->ap, key->dq, key->q, &ws->wq);                // o = a^dq % q, prod = q
+  mp_size_t on = mpz_size(key->q);
+  rsa_sec_load(ws->o, ws->m1, on);
+  rsa_sec_load(ws->prod, key->q, on);
+  rsa_sec_reduce(ws, key->p);
+  pow_mod_sec_ws(ws->m1, ws->ap, key->dp, key->p, &ws->wp);                // m = a^dp % p
+  on = rsa_sec_garner(ws, on, ws->m1, key->p, ws->c[0]);                   // o = o + q * (qinv * (m - o) % p)
+  for (uint64_t i = 0; i < key->extra; i++) {                              // Garner's step for each further prime r
+    rsa_sec_reduce(ws, key->r[i]);
+    pow_mod_sec_ws(ws->m1, ws->ap, key->dr[i], key->r[i], &ws->wr[i]);     // m = a^dr % r
+    on = rsa_sec_garner(ws, on, ws->m1, key->r[i], ws->c[i + 1]);
+  }
+  mpn_copyi(mpz_limbs_write(o, on), ws->o, on);
+  mpz_limbs_finish(o, on);
 }
 
-void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {                       // reads private key from specified file
-  gmp_fscanf(pvfile, "%Zx\n%Zx\n", n, d);
+static void rsa_priv_pow_once(mpz_t o, mpz_t a, rsa_priv_t *key) {         // rsa_priv_pow with a workspace made for this call only
+  rsa_priv_ws_t ws;
+  rsa_priv_ws_init(&ws, key);
+  rsa_priv_pow(o, a, key, &ws);
+  rsa_priv_ws_clear(&ws);
 }
 
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {                     // encrypts message m and stores it in ciphertext c using n and e
   pow_mod(c, m, e, n);
 }
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {     // encrypts input file and writes to output file using n and e
-  mpz_t m, c;
-  mpz_inits(m, c, NULL);
+typedef struct {                                                           // file state shared by the pipeline's read and write stages
+  FILE *infile;
+  FILE *outfile;
+  uint64_t k;                                                              // block size, in bytes
+  uint8_t *block;                                                          // k + 1 bytes; a stray ciphertext can decrypt to one byte more than k
+  uint32_t modbytes;                                                       // binary ciphertext block width, in bytes
+  uint8_t *cblock;                                                         // one binary ciphertext block
+  char *hex;                                                               // one ciphertext block as a hexstring
+  uint64_t blocks;                                                         // binary blocks written, or left to read
+  mapfile_t inmap;                                                         // mapped input, when infile is a regular file
+  mapfile_t outmap;                                                        // mapped output, when its final size is known up front
+  size_t inpos;                                                            // bytes consumed from inmap
+  size_t outpos;                                                           // bytes produced into outmap
+  chunk_hdr_t chunk;                                                       // chunked stream header, replaced at each concatenated stream
+  chunk_info_t info;                                                       // record of the chunk being filled or handed out
+  uint8_t *chunkbuf;                                                       // the blocks of that chunk
+  uint32_t chunkcap;                                                       // blocks chunkbuf holds
+  uint32_t used;                                                           // blocks filled into or handed out of chunkbuf
+  uint64_t seq;                                                            // sequence number the next chunk must carry
+  uint64_t plainpos;                                                       // plaintext bytes read, or covered by the chunks read
+  uint64_t flushed;                                                        // plaintext bytes covered by the chunks written
+  uint64_t end;                                                            // plaintext offset where a chunked read may stop
+  uint64_t skip;                                                           // leading plaintext bytes to drop
+  uint64_t remain;                                                         // plaintext bytes still to write
+  bool have_info;                                                          // info was read ahead and its blocks are next
+  bool final;                                                              // the current stream's final chunk was read
+  bool done;                                                               // no more chunks will be read
+  bool ok;                                                                 // no damage found in the input
+} rsa_file_io_t;
+
+typedef struct {                                                           // one thread's exponentiation contexts for n
+  mont_ctx_t *ctx;
+  montvec_ctx_t *vec;                                                      // NULL when no vector kernel beats ctx for n; set up on first use
+} rsa_pub_lane_t;
 
-  uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;                             // size of the block, in bytes
-  uint8_t *block = (uint8_t *)malloc(k);                                   // allocating k bytes for the block itself
-  block[0] = 0xFF;                                                         // prepends a byte of 1's to the block
-  uint64_t j;
+typedef struct {                                                           // public key shared by the encryption workers
+  mpz_ptr n;
+  mpz_ptr e;
+  mont_plan_t *plan;                                                       // e recoded once for every block
+  rsa_pub_lane_t lane;                                                     // a prepared key's contexts, or NULLs for one set per worker
+} rsa_pub_op_t;
 
-  while (feof(infile) != 1) {                                              // while EOF is not reached, loop
-    j = fread(block + 1, 1, k - 1, infile);                                // j is set to num of bytes actually read from the input file
-    if (j == 0) { // if no bytes are read, break
+typedef struct {                                                           // the contexts one encryption worker owns
+  rsa_pub_lane_t lane;                                                     // points at the two below
+  mont_ctx_t ctx;
+  montvec_ctx_t vec;
+} rsa_pub_worker_t;
+
+typedef struct {                                                           // private key shared by the decryption workers
+  rsa_priv_t *key;
+  rsa_priv_ws_t *ws;                                                       // a prepared key's workspace, or NULL for one per worker
+} rsa_priv_op_t;
+
+static size_t rsa_read_plain(void *io, mpz_t in[], size_t max) {          // reads up to max plaintext blocks, each prefixed with 0xFF
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max) {
+    size_t j = fread(f->block + 1, 1, f->k - 1, f->infile);               // j is set to num of bytes actually read from the input file
+    if (j == 0) {                                                          // if no bytes are read, stop
       break;
     }
-    mpz_import(m, j + 1, 1, sizeof(char), 1, 0, block);                    // write j + 1 bytes from m into the block
-    if (mpz_cmp_ui(m, 0) == 0 || mpz_cmp_ui(m, 1) == 0) {                  // can't encrypt blocks that are 0 or 1 in value
+    f->plainpos += j;
+    mpz_import(in[count], j + 1, 1, sizeof(char), 1, 0, f->block);        // block of j + 1 bytes becomes message m
+    if (mpz_cmp_ui(in[count], 0) == 0 || mpz_cmp_ui(in[count], 1) == 0) { // can't encrypt blocks that are 0 or 1 in value
       gmp_fprintf(stderr, "cannot encrypt block that has value of 0 or 1\n");
       continue;
     }
-    rsa_encrypt(c, m, e, n);                                               // encrypts message m into ciphertext c
-    gmp_fprintf(outfile, "%Zx\n", c);                                      // writes hexstring to outfile
+    count += 1;
   }
-  mpz_clears(m, c, NULL);
-  free(block);
+  return count;
 }
 
-void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {                     // decrypts ciphertext c into message m
-  pow_mod(m, c, d, n);
+static size_t rsa_read_plain_map(void *io, mpz_t in[], size_t max) {      // imports plaintext blocks straight from the mapped input
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max && f->inpos < f->inmap.size) {
+    size_t j = f->inmap.size - f->inpos;
+    if (j > f->k - 1) {
+      j = f->k - 1;
+    }
+    mpz_import(in[count], j, 1, sizeof(char), 1, 0, f->inmap.data + f->inpos);
+    for (int b = 0; b < 8; b++) {                                          // prepends the byte of 1's above the j data bytes
+      mpz_setbit(in[count], 8 * j + b);
+    }
+    f->inpos += j;
+    f->plainpos += j;
+    count += 1;
+  }
+  return count;
+}
+
+static void rsa_write_hex(void *io, mpz_t out[], size_t count) {          // writes ciphertext blocks as hexstrings, one per line
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t start = stats_start();
+    mpz_get_str(f->hex, 16, out[i]);                                       // formatted apart from the I/O so the two can be timed
+    stats_stop(STATS_FORMAT, start, 1);
+    fputs(f->hex, f->outfile);
+    putc('\n', f->outfile);
+  }
+}
+
+static void rsa_write_bin(void *io, mpz_t out[], size_t count) {          // writes ciphertext blocks as fixed-width big-endian bytes
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  for (size_t i = 0; i < count; i++) {
+    container_put_block(f->cblock, out[i], f->modbytes);
+    fwrite(f->cblock, 1, f->modbytes, f->outfile);
+  }
+  f->blocks += count;
+}
+
+static void rsa_write_bin_map(void *io, mpz_t out[], size_t count) {      // exports ciphertext blocks straight into the mapped output
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  for (size_t i = 0; i < count; i++) {
+    container_put_block(f->outmap.data + f->outpos, out[i], f->modbytes);
+    f->outpos += f->modbytes;
+  }
+  f->blocks += count;
+}
+
+static void rsa_flush_chunk(rsa_file_io_t *f, uint8_t flags) {           // writes the buffered blocks as the next chunk
+  f->info.bytes = (flags & CHUNK_FINAL) ? f->plainpos - f->flushed : f->used * f->chunk.block_bytes;   // only the last block can be short
+  f->info.blocks = f->used;
+  f->info.flags = flags;
+  chunk_write(f->outfile, &f->info, f->chunkbuf, f->modbytes);
+  f->flushed += f->info.bytes;
+  f->info.seq += 1;
+  f->used = 0;
+}
+
+static void rsa_write_chunk(void *io, mpz_t out[], size_t count) {        // collects ciphertext blocks into chunks
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  for (size_t i = 0; i < count; i++) {
+    if (f->used == f->chunk.chunk_blocks) {                                // a full chunk is written once more blocks follow it
+      rsa_flush_chunk(f, 0);
+    }
+    container_put_block(f->chunkbuf + (size_t)f->used * f->modbytes, out[i], f->modbytes);
+    f->used += 1;
+  }
+}
+
+static size_t rsa_read_bin(void *io, mpz_t in[], size_t max) {            // reads up to max fixed-width ciphertext blocks
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max && f->blocks > 0 && fread(f->cblock, 1, f->modbytes, f->infile) == f->modbytes) {
+    container_get_block(in[count], f->cblock, f->modbytes);
+    count += 1;
+    if (f->blocks != CONTAINER_UNKNOWN_COUNT) {
+      f->blocks -= 1;
+    }
+  }
+  return count;
+}
+
+static size_t rsa_read_bin_map(void *io, mpz_t in[], size_t max) {        // imports ciphertext blocks straight from the mapped input
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max && f->blocks > 0) {                                   // blocks was capped to what the mapping holds
+    container_get_block(in[count], f->inmap.data + f->inpos, f->modbytes);
+    f->inpos += f->modbytes;
+    f->blocks -= 1;
+    count += 1;
+  }
+  return count;
+}
+
+static size_t rsa_read_hex(void *io, mpz_t in[], size_t max) {            // scans up to max hexstring ciphertext blocks
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max && gmp_fscanf(f->infile, "%Zx", in[count]) == 1) {    // stops cleanly on trailing whitespace or EOF
+    count += 1;
+  }
+  return count;
+}
+
+static bool rsa_chunk_stream(rsa_file_io_t *f) {                          // starts a stream whose header was just read; false if it is not for this key
+  if (f->chunk.modbytes != f->modbytes) {
+    gmp_fprintf(stderr, "ciphertext blocks do not match the size of the private key\n");
+    f->ok = false;
+    f->done = true;
+    return false;
+  }
+  if (f->chunk.chunk_blocks > f->chunkcap) {
+    f->chunkcap = f->chunk.chunk_blocks;
+    f->chunkbuf = (uint8_t *)realloc(f->chunkbuf, (size_t)f->chunkcap * f->modbytes);
+  }
+  f->seq = 0;
+  f->final = false;
+  f->info.blocks = 0;
+  f->used = 0;
+  return true;
+}
+
+static bool rsa_chunk_check(rsa_file_io_t *f, chunk_status_t status) {    // reports why chunks stopped; true only for CHUNK_OK
+  if (status == CHUNK_OK) {
+    return true;
+  }
+  if (status == CHUNK_END && !f->final) {
+    gmp_fprintf(stderr, "input ends before its final chunk, after %lu chunks\n", f->seq);
+    f->ok = false;
+  } else if (status == CHUNK_TRUNCATED) {
+    gmp_fprintf(stderr, "input is truncated in chunk %lu\n", f->seq);
+    f->ok = false;
+  } else if (status == CHUNK_CORRUPT) {
+    gmp_fprintf(stderr, "chunk %lu is damaged or out of order\n", f->seq);
+    f->ok = false;
+  }
+  f->done = true;
+  return false;
+}
+
+static chunk_status_t rsa_chunk_info(rsa_file_io_t *f) {                   // reads the next chunk record in sequence, crossing into concatenated streams
+  while (true) {
+    chunk_status_t status = chunk_read_info(f->infile, &f->chunk, &f->info);
+    if (status != CHUNK_NEXT) {
+      if (status == CHUNK_OK && (f->final || f->info.seq != f->seq)) {
+        status = CHUNK_CORRUPT;
+      }
+      return status;
+    }
+    if (!f->final) {                                                       // tolerated: the earlier stream just lost its tail
+      gmp_fprintf(stderr, "stream ends before its final chunk, after %lu chunks\n", f->seq);
+      f->ok = false;
+    }
+    if (!rsa_chunk_stream(f)) {
+      return CHUNK_END;
+    }
+  }
+}
+
+static bool rsa_next_chunk(rsa_file_io_t *f) {                             // loads the next checked chunk; false once the range or the usable input ends
+  while (!f->done) {
+    chunk_status_t status = f->have_info ? CHUNK_OK : rsa_chunk_info(f);
+    f->have_info = false;
+    if (status == CHUNK_OK) {
+      status = chunk_read_blocks(f->infile, &f->chunk, &f->info, f->chunkbuf);
+    }
+    if (!rsa_chunk_check(f, status)) {
+      return false;
+    }
+    f->seq += 1;
+    f->final = f->info.flags & CHUNK_FINAL;
+    f->plainpos += f->info.bytes;
+    f->used = 0;
+    f->done = f->plainpos >= f->end;
+    if (f->info.blocks > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t rsa_read_chunk(void *io, mpz_t in[], size_t max) {          // hands out the blocks of checked chunks, one chunk in memory at a time
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  size_t count = 0;
+  while (count < max) {
+    if ((f->have_info || f->used == f->info.blocks) && !rsa_next_chunk(f)) {   // a record read ahead still needs its blocks
+      break;
+    }
+    container_get_block(in[count], f->chunkbuf + (size_t)f->used * f->modbytes, f->modbytes);
+    f->used += 1;
+    count += 1;
+  }
+  return count;
+}
+
+static void rsa_chunk_seek(rsa_file_io_t *f, uint64_t offset) {           // positions a chunked input at the chunk holding plaintext offset
+  uint64_t span = (uint64_t)f->chunk.chunk_blocks * f->chunk.block_bytes;  // plaintext bytes of a full chunk
+  uint64_t first = offset / span;
+  long base = ftell(f->infile);
+  if (first > 0 && base >= 0 && fseek(f->infile, base + first * chunk_stride(&f->chunk), SEEK_SET) == 0) {
+    chunk_hdr_t hdr = f->chunk;
+    chunk_info_t info;
+    if (chunk_read_info(f->infile, &hdr, &info) == CHUNK_OK && info.seq == first) {   // every chunk before a present chunk first is full
+      f->info = info;
+      f->seq = first;
+      f->plainpos = first * span;
+      f->have_info = true;
+    } else {                                                               // shorter than that, or concatenated: walk the records
+      fseek(f->infile, base, SEEK_SET);
+    }
+  }
+  while (!f->have_info) {                                                  // records only; the blocks skipped are never read on a seekable input
+    chunk_status_t status = rsa_chunk_info(f);
+    if (status == CHUNK_OK && f->plainpos + f->info.bytes > offset) {
+      f->have_info = true;
+      break;
+    }
+    if (status == CHUNK_OK) {
+      status = chunk_skip_blocks(f->infile, &f->chunk, &f->info, f->chunkbuf);
+    }
+    if (!rsa_chunk_check(f, status)) {
+      return;
+    }
+    f->seq += 1;
+    f->final = f->info.flags & CHUNK_FINAL;
+    f->plainpos += f->info.bytes;
+  }
+  f->skip = offset - f->plainpos;
 }
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {     // decrypts input file and writes to output file using n and d
-  mpz_t m, c;
-  mpz_inits(m, c, NULL);
+static void rsa_emit(rsa_file_io_t *f, const uint8_t *data, size_t len) { // writes the plaintext that falls inside the requested range
+  if (f->skip >= len) {
+    f->skip -= len;
+    return;
+  }
+  data += f->skip;
+  len -= f->skip;
+  f->skip = 0;
+  if (len > f->remain) {
+    len = f->remain;
+  }
+  fwrite(data, 1, len, f->outfile);
+  f->remain -= len;
+}
 
-  uint64_t k = (mpz_sizeinbase(n, 2) - 1) / 8;                             // block size, in bytes
-  uint8_t *block = (uint8_t *)malloc(k);                                   // malloc size of block
+static void rsa_write_plain(void *io, mpz_t out[], size_t count) {        // writes decrypted blocks without their 0xFF prefix
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
   size_t j = 0;
+  for (size_t i = 0; i < count; i++) {
+    mpz_export(f->block, &j, 1, sizeof(char), 1, 0, out[i]);              // writes j bytes of m into the block
+    if (j > 1) {
+      rsa_emit(f, f->block + 1, j - 1);                                    // write j - 1 bytes from the block into the output
+    }
+  }
+}
 
-  while (feof(infile) != 1) {                                               // while EOF not reached, loop
-    gmp_fscanf(infile, "%Zx\n", c);                                         // scan in hexstring
-    rsa_decrypt(m, c, d, n);                                                // decrypt hexstring into message m
-    mpz_export(block, &j, 1, sizeof(char), 1, 0, m);                        // writes j byes from the block into m
-    fwrite(block + 1, 1, j - 1, outfile);                                   // write j - 1 bytes from the block into the output
+static void rsa_write_plain_map(void *io, mpz_t out[], size_t count) {    // writes decrypted blocks straight into the mapped output
+  rsa_file_io_t *f = (rsa_file_io_t *)io;
+  for (size_t i = 0; i < count; i++) {
+    size_t j = (mpz_sizeinbase(out[i], 2) + 7) / 8;                        // block length including the 0xFF prefix
+    if (mpz_sgn(out[i]) == 0 || j < 2) {
+      continue;
+    }
+    if (j - 1 > f->k - 1) {                                                // cannot come from rsa_encrypt_file; would overrun the map
+      gmp_fprintf(stderr, "skipping ciphertext block that decrypts to more than one block\n");
+      continue;
+    }
+    mpz_tdiv_r_2exp(out[i], out[i], 8 * (j - 1));                         // drops the prefix byte
+    container_put_block(f->outmap.data + f->outpos, out[i], j - 1);        // keeps leading zero bytes of the plaintext
+    f->outpos += j - 1;
   }
-  mpz_clears(m, c, NULL);
-  free(block);
 }
 
-void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {                         // performs RSA signing on m using d and n
-  pow_mod(s, m, d, n);
+static void rsa_pub_pow_many(mpz_t out[], mpz_t in[], size_t count, mont_plan_t *plan, rsa_pub_lane_t *lane) {   // full vector groups first, then any remainder too small to pay for one
+  size_t i = 0;
+  if (lane->vec != NULL && lane->vec->kind == MONTVEC_NONE && count > 1) {   // lanes that only ever see single blocks never pay for it
+    montvec_init(lane->vec, lane->ctx->n, montvec_best(mpz_sizeinbase(lane->ctx->n, 2)));
+  }
+  if (lane->vec != NULL && lane->vec->kind != MONTVEC_NONE) {
+    while (count - i >= (size_t)lane->vec->fill) {
+      size_t group = count - i < (size_t)lane->vec->lanes ? count - i : (size_t)lane->vec->lanes;
+      montvec_pow_plan(out + i, in + i, group, plan, lane->vec);
+      i += group;
+    }
+  }
+  for (; i < count; i++) {
+    mont_pow_plan(out[i], in[i], plan, lane->ctx);
+  }
 }
 
-bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {                       // signature verification
+static void *rsa_pub_local_init(void *key) {                               // each encryption worker owns a Montgomery context for n, and a vector one if it pays
+  rsa_pub_op_t *op = (rsa_pub_op_t *)key;
+  rsa_pub_worker_t *w = (rsa_pub_worker_t *)calloc(1, sizeof(rsa_pub_worker_t));   // vec starts out MONTVEC_NONE
+  mont_init(&w->ctx, op->n);
+  w->lane.ctx = &w->ctx;
+  w->lane.vec = montvec_best(mpz_sizeinbase(op->n, 2)) != MONTVEC_NONE ? &w->vec : NULL;
+  return w;
+}
+
+static void rsa_pub_local_clear(void *local) {
+  rsa_pub_worker_t *w = (rsa_pub_worker_t *)local;
+  if (w->vec.kind != MONTVEC_NONE) {
+    montvec_clear(&w->vec);
+  }
+  mont_clear(&w->ctx);
+  free(w);
+}
+
+static void *rsa_pub_local_prepared(void *key) {                           // the single worker borrows a prepared key's contexts
+  return &((rsa_pub_op_t *)key)->lane;
+}
+
+static void rsa_pub_apply(mpz_t out, mpz_t in, void *key, void *local) {  // encrypts message m into ciphertext c
+  mont_pow_plan(out, in, ((rsa_pub_op_t *)key)->plan, ((rsa_pub_lane_t *)local)->ctx);
+}
+
+static void rsa_pub_apply_many(mpz_t out[], mpz_t in[], size_t count, void *key, void *local) {   // encrypts a batch of messages, several at a time where vectors pay
+  rsa_pub_pow_many(out, in, count, ((rsa_pub_op_t *)key)->plan, (rsa_pub_lane_t *)local);
+}
+
+static void *rsa_priv_local_init(void *key) {                              // each decryption worker owns the workspaces for p and q
+  rsa_priv_ws_t *ws = (rsa_priv_ws_t *)malloc(sizeof(rsa_priv_ws_t));
+  rsa_priv_ws_init(ws, ((rsa_priv_op_t *)key)->key);
+  return ws;
+}
+
+static void rsa_priv_local_clear(void *local) {
+  rsa_priv_ws_clear((rsa_priv_ws_t *)local);
+  free(local);
+}
+
+static void *rsa_priv_local_prepared(void *key) {                          // the single worker borrows a prepared key's workspace
+  return ((rsa_priv_op_t *)key)->ws;
+}
+
+static void rsa_priv_apply(mpz_t out, mpz_t in, void *key, void *local) { // decrypts ciphertext c into message m
+  rsa_priv_pow(out, in, ((rsa_priv_op_t *)key)->key, (rsa_priv_ws_t *)local);
+}
+
+static rsa_pub_lane_t rsa_pub_key_lane(rsa_pub_key_t *key, uint64_t lane) {   // a prepared key's contexts for one lane
+  rsa_pub_lane_t l = { &key->ctx[lane], key->vec != NULL ? &key->vec[lane] : NULL };
+  return l;
+}
+
+static void rsa_encrypt_run(FILE *infile, FILE *outfile, mpz_t n, pipeline_t *pipe, uint64_t threads, rsa_format_t format) {   // encrypts a file with the workers set up in pipe
+  rsa_file_io_t io;
+  io.infile = infile;
+  io.outfile = outfile;
+  io.k = (mpz_sizeinbase(n, 2) - 1) / 8;                                   // size of the block, in bytes
+  io.block = (uint8_t *)malloc(io.k + 1);
+  io.block[0] = 0xFF;                                                      // prepends a byte of 1's to the block
+  io.modbytes = container_modbytes(n);
+  io.cblock = (uint8_t *)malloc(io.modbytes);
+  io.hex = (char *)malloc(2 * io.modbytes + 1);
+  io.blocks = 0;
+  io.inpos = 0;
+  io.outpos = 0;
+  io.plainpos = 0;
+
+  pipe->io = &io;
+  pipe->read = rsa_read_plain;
+  pipe->write = rsa_write_hex;
+  bool mapped_in = mapfile_open_read(&io.inmap, infile);                   // regular files are read through their pages
+  if (mapped_in) {
+    pipe->read = rsa_read_plain_map;
+  }
+  if (format == RSA_FORMAT_BIN) {
+    container_hdr_t hdr = { CONTAINER_VERSION, io.modbytes, CONTAINER_UNKNOWN_COUNT };
+    if (mapped_in) {                                                       // every block is full except possibly the last
+      hdr.blocks = (io.inmap.size + io.k - 2) / (io.k - 1);
+    }
+    long offset = ftell(outfile);                                          // -1 on a pipe; the count then stays unknown
+    container_write_header(outfile, &hdr);
+    if (mapped_in && mapfile_open_write(&io.outmap, outfile, hdr.blocks * io.modbytes)) {
+      pipe->write = rsa_write_bin_map;                                     // the output size is exact, so blocks go straight to its pages
+      pipeline_run(pipe, threads);
+      mapfile_close(&io.outmap, io.outpos);
+    } else {
+      pipe->write = rsa_write_bin;
+      pipeline_run(pipe, threads);
+      container_patch_count(outfile, offset, io.blocks);
+    }
+  } else if (format == RSA_FORMAT_CHUNKED) {
+    io.chunk = (chunk_hdr_t){ CHUNK_VERSION, io.modbytes, CHUNK_BLOCKS, io.k - 1 };
+    io.chunkbuf = (uint8_t *)malloc((size_t)CHUNK_BLOCKS * io.modbytes);
+    io.info.seq = 0;
+    io.used = 0;
+    io.flushed = 0;
+    chunk_write_header(outfile, &io.chunk);
+    pipe->write = rsa_write_chunk;
+    pipeline_run(pipe, threads);
+    rsa_flush_chunk(&io, CHUNK_FINAL);                                     // always written, so a cut at a chunk boundary is noticed
+    free(io.chunkbuf);
+  } else {
+    pipeline_run(pipe, threads);
+  }
+  if (mapped_in) {
+    mapfile_close(&io.inmap, io.inpos);
+  }
+  free(io.block);
+  free(io.cblock);
+  free(io.hex);
+}
+
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, uint64_t threads, rsa_format_t format) {   // encrypts input file and writes to output file using n and e
+  if (format == RSA_FORMAT_HYBRID) {                                       // one exponentiation in all, so no workers
+    return hybrid_encrypt_file(infile, outfile, n, e);
+  }
+  mont_plan_t plan;
+  mont_plan_init(&plan, e);
+  rsa_pub_op_t op = { n, e, &plan, { NULL, NULL } };
+  pipeline_t pipe = { NULL, NULL, NULL, &op, rsa_pub_local_init, rsa_pub_local_clear, rsa_pub_apply, rsa_pub_apply_many };
+  rsa_encrypt_run(infile, outfile, n, &pipe, threads, format);
+  mont_plan_clear(&plan);
+  return true;
+}
+
+bool rsa_encrypt_file_key(FILE *infile, FILE *outfile, rsa_pub_key_t *key, uint64_t lane, rsa_format_t format) {   // rsa_encrypt_file on the calling thread with a prepared key
+  if (format == RSA_FORMAT_HYBRID) {
+    return hybrid_encrypt_file(infile, outfile, key->n, key->e);
+  }
+  rsa_pub_op_t op = { key->n, key->e, &key->plan, rsa_pub_key_lane(key, lane) };
+  pipeline_t pipe = { NULL, NULL, NULL, &op, rsa_pub_local_prepared, NULL, rsa_pub_apply, rsa_pub_apply_many };
+  rsa_encrypt_run(infile, outfile, key->n, &pipe, 1, format);
+  return true;
+}
+
+void rsa_decrypt(mpz_t m, mpz_t c, rsa_priv_t *key) {                      // decrypts ciphertext c into message m
+  rsa_priv_pow_once(m, c, key);
+}
+
+typedef struct {                                                           // Fiat's batch tree, nodes numbered heap-style over halves of the batch
+  mpz_ptr n;
+  numtheory_ws_t ws;                                                       // one Montgomery context for n serves every node
+  mpz_t *v;                                                                // product of c_i^(E / e_i) over the node's messages
+  mpz_t *E;                                                                // product of e_i over the node's messages
+  size_t *idx;                                                             // leaf i holds ciphertext idx[i]
+} rsa_fiat_t;
+
+static void rsa_fiat_up(rsa_fiat_t *f, size_t node, size_t lo, size_t hi, mpz_t c[], uint64_t e[]) {   // v = vL^ER * vR^EL, so v is the E-th power of the node's message product
+  if (hi - lo == 1) {
+    mpz_mod(f->v[node], c[f->idx[lo]], f->n);
+    mpz_set_ui(f->E[node], e[f->idx[lo]]);
+    return;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  size_t l = 2 * node + 1;
+  size_t r = 2 * node + 2;
+  rsa_fiat_up(f, l, lo, mid, c, e);
+  rsa_fiat_up(f, r, mid, hi, c, e);
   mpz_t t;
   mpz_init(t);
+  pow_mod_ws(t, f->v[l], f->E[r], f->n, &f->ws);                           // ciphertexts and exponents are public
+  pow_mod_ws(f->v[node], f->v[r], f->E[l], f->n, &f->ws);
+  mpz_mul(f->v[node], f->v[node], t);
+  mpz_mod(f->v[node], f->v[node], f->n);
+  mpz_mul(f->E[node], f->E[l], f->E[r]);
+  mpz_clear(t);
+}
 
-  pow_mod(t, s, e, n);
-  if (mpz_cmp(t, m) == 0) {
+//
+// Splits x, the product of the node's messages, into the products mL and mR
+// over its halves. With X = 0 mod EL and X = 1 mod ER,
+// x^X = A * mR for A = vL^(X / EL) * vR^((X - 1) / ER), so mR = x^X / A and
+// mL = x / mR = x * A / x^X. Both divisions share one inversion of A * x^X.
+// Returns false if EL and ER share a factor.
+//
+static bool rsa_fiat_down(rsa_fiat_t *f, size_t node, size_t lo, size_t hi, mpz_t x, mpz_t m[]) {
+  if (hi - lo == 1) {
+    mpz_set(m[f->idx[lo]], x);
     return true;
-  } else {
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  size_t l = 2 * node + 1;
+  size_t r = 2 * node + 2;
+  mpz_t X, t, a, xx, ml, mr;
+  mpz_inits(X, t, a, xx, ml, mr, NULL);
+  mod_inverse_ws(X, f->E[l], f->E[r], &f->ws);
+  bool ok = mpz_sgn(X) != 0;
+  if (ok) {
+    mpz_mul(X, X, f->E[l]);                                                // X = EL * (EL^-1 mod ER)
+    pow_mod_ws(xx, x, X, f->n, &f->ws);                                    // x^X
+    mpz_divexact(t, X, f->E[l]);
+    pow_mod_ws(a, f->v[l], t, f->n, &f->ws);                               // mL^X
+    mpz_sub_ui(t, X, 1);
+    mpz_divexact(t, t, f->E[r]);
+    pow_mod_ws(ml, f->v[r], t, f->n, &f->ws);                              // mR^(X - 1)
+    mpz_mul(a, a, ml);
+    mpz_mod(a, a, f->n);                                                   // A
+    mpz_mul(t, a, xx);
+    mod_inverse_ws(t, t, f->n, &f->ws);                                    // 1 / (A * x^X)
+    ok = mpz_sgn(t) != 0;
+    mpz_mul(mr, xx, xx);                                                   // mR = x^2X / (A * x^X)
+    mpz_mod(mr, mr, f->n);
+    mpz_mul(mr, mr, t);
+    mpz_mod(mr, mr, f->n);
+    mpz_mul(ml, a, a);                                                     // mL = x * A^2 / (A * x^X)
+    mpz_mod(ml, ml, f->n);
+    mpz_mul(ml, ml, x);
+    mpz_mod(ml, ml, f->n);
+    mpz_mul(ml, ml, t);
+    mpz_mod(ml, ml, f->n);
+    ok = ok && rsa_fiat_down(f, l, lo, mid, ml, m) && rsa_fiat_down(f, r, mid, hi, mr, m);
+  }
+  mpz_clears(X, t, a, xx, ml, mr, NULL);
+  return ok;
+}
+
+static bool rsa_fiat_key(rsa_priv_t *root, rsa_priv_t *key, mpz_t E) {   // the key's primes with d = E^-1 in place of the key's own; false unless E is coprime to each prime - 1
+  mpz_set(root->n, key->n);
+  mpz_set(root->p, key->p);
+  mpz_set(root->q, key->q);
+  mpz_set(root->qinv, key->qinv);
+  mpz_sub_ui(root->d, key->p, 1);
+  mod_inverse(root->dp, E, root->d);
+  mpz_sub_ui(root->d, key->q, 1);
+  mod_inverse(root->dq, E, root->d);
+  bool ok = mpz_sgn(root->dp) != 0 && mpz_sgn(root->dq) != 0;
+  root->extra = key->extra;
+  for (uint64_t i = 0; i < key->extra; i++) {
+    mpz_set(root->r[i], key->r[i]);
+    mpz_set(root->tr[i], key->tr[i]);
+    mpz_sub_ui(root->d, key->r[i], 1);
+    mod_inverse(root->dr[i], E, root->d);
+    ok &= mpz_sgn(root->dr[i]) != 0;
+  }
+  return ok;
+}
+
+bool rsa_decrypt_fiat(mpz_t m[], mpz_t c[], uint64_t e[], size_t count, rsa_priv_t *key) {   // one private-key exponentiation for the whole batch
+  if (count == 0) {
+    return true;
+  }
+  if (!rsa_priv_has_crt(key)) {
     return false;
   }
+  rsa_fiat_t f;
+  f.n = key->n;
+  f.idx = (size_t *)malloc(count * sizeof(size_t));
+  size_t batched = 0;
+  bool ok = true;
+  rsa_priv_t root;
+  rsa_priv_init(&root);
+  mpz_t g, E;
+  mpz_inits(g, E, NULL);
+  for (size_t i = 0; i < count && ok; i++) {
+    mpz_mod(E, c[i], key->n);
+    gcd(g, E, key->n);
+    if (mpz_cmp_ui(g, 1) == 0) {
+      f.idx[batched++] = i;
+      continue;
+    }
+    mpz_set_ui(E, e[i]);                                                   // 0 or a multiple of a prime has no inverse mod n, so it cannot join the tree
+    ok = rsa_fiat_key(&root, key, E);
+    if (ok) {
+      rsa_priv_pow_once(m[i], c[i], &root);
+    }
+  }
+  mpz_clears(g, E, NULL);
+  if (!ok || batched == 0) {
+    rsa_priv_clear(&root);
+    free(f.idx);
+    return ok;
+  }
+
+  numtheory_ws_init(&f.ws, mpz_sizeinbase(key->n, 2));
+  size_t nodes = 4 * batched;                                              // enough for any heap-numbered split of batched leaves
+  f.v = (mpz_t *)malloc(nodes * sizeof(mpz_t));
+  f.E = (mpz_t *)malloc(nodes * sizeof(mpz_t));
+  for (size_t i = 0; i < nodes; i++) {
+    mpz_inits(f.v[i], f.E[i], NULL);
+  }
+  rsa_fiat_up(&f, 0, 0, batched, c, e);
+  ok = rsa_fiat_key(&root, key, f.E[0]);                                   // every e_i must be coprime to each prime - 1
+  if (ok) {
+    mpz_t x;
+    mpz_init(x);
+    rsa_priv_pow_once(x, f.v[0], &root);                                   // the product of every batched message
+    ok = rsa_fiat_down(&f, 0, 0, batched, x, m);
+    mpz_clear(x);
+  }
+  rsa_priv_clear(&root);
+  for (size_t i = 0; i < nodes; i++) {
+    mpz_clears(f.v[i], f.E[i], NULL);
+  }
+  free(f.v);
+  free(f.E);
+  free(f.idx);
+  numtheory_ws_clear(&f.ws);
+  return ok;
+}
+
+static bool rsa_decrypt_run(FILE *infile, FILE *outfile, mpz_t n, pipeline_t *pipe, uint64_t threads, rsa_format_t format, uint64_t offset, uint64_t length) {   // decrypts a file with the workers set up in pipe; false if the input is unusable or damaged
+  rsa_file_io_t io;
+  io.infile = infile;
+  io.outfile = outfile;
+  io.k = (mpz_sizeinbase(n, 2) - 1) / 8;                                   // block size, in bytes
+  io.block = (uint8_t *)malloc(io.k + 1);
+  io.modbytes = container_modbytes(n);
+  io.cblock = (uint8_t *)malloc(io.modbytes);
+  io.inpos = 0;
+  io.outpos = 0;
+  io.skip = 0;
+  io.remain = length;
+
+  if (format == RSA_FORMAT_AUTO) {                                         // every binary format starts with 'R', which no hexstring does
+    int first = getc(infile);
+    ungetc(first, infile);
+    format = first == CONTAINER_MAGIC[0] ? RSA_FORMAT_BIN : RSA_FORMAT_HEX;
+  }
+  pipe->io = &io;
+  pipe->read = rsa_read_hex;
+  pipe->write = rsa_write_plain;
+  bool ok = true;
+  bool ranged = offset > 0 || length != UINT64_MAX;
+  if (format != RSA_FORMAT_HEX) {                                          // the magic tells the binary formats apart
+    char magic[4];
+    container_hdr_t hdr;
+    bool read = fread(magic, 1, 4, infile) == 4;
+    if (read && memcmp(magic, CHUNK_MAGIC, 4) == 0) {
+      io.chunkbuf = NULL;
+      io.chunkcap = 0;
+      io.plainpos = 0;
+      io.end = length < UINT64_MAX - offset ? offset + length : UINT64_MAX;
+      io.have_info = false;
+      io.done = length == 0;
+      io.ok = true;
+      if (!chunk_read_fields(infile, &io.chunk)) {
+        gmp_fprintf(stderr, "input is not a chunked ciphertext stream\n");
+        io.ok = false;
+      } else if (rsa_chunk_stream(&io)) {
+        if (offset > 0) {
+          rsa_chunk_seek(&io, offset);
+        }
+        pipe->read = rsa_read_chunk;
+        pipeline_run(pipe, threads);
+      }
+      free(io.chunkbuf);
+      ok = io.ok;
+    } else if (ranged) {
+      gmp_fprintf(stderr, "byte ranges need a chunked ciphertext stream\n");
+      ok = false;
+    } else if (read && memcmp(magic, HYBRID_MAGIC, 4) == 0) {
+      ok = hybrid_decrypt_file(infile, outfile, ((rsa_priv_op_t *)pipe->key)->key);
+    } else if (!read || memcmp(magic, CONTAINER_MAGIC, 4) != 0 || !container_read_fields(infile, &hdr)) {
+      gmp_fprintf(stderr, "input is not a binary ciphertext container\n");
+      ok = false;
+    } else if (hdr.modbytes != io.modbytes) {
+      gmp_fprintf(stderr, "ciphertext blocks do not match the size of the private key\n");
+      ok = false;
+    } else if (mapfile_open_read(&io.inmap, infile)) {                    // regular file: blocks come straight from its pages
+      uint64_t available = io.inmap.size / io.modbytes;
+      io.blocks = hdr.blocks < available ? hdr.blocks : available;
+      pipe->read = rsa_read_bin_map;
+      if (mapfile_open_write(&io.outmap, outfile, io.blocks * (io.k - 1))) {   // upper bound; trimmed on close
+        pipe->write = rsa_write_plain_map;
+        pipeline_run(pipe, threads);
+        mapfile_close(&io.outmap, io.outpos);
+      } else {
+        pipeline_run(pipe, threads);
+      }
+      mapfile_close(&io.inmap, io.inpos);
+    } else {
+      io.blocks = hdr.blocks;
+      pipe->read = rsa_read_bin;
+      pipeline_run(pipe, threads);
+    }
+  } else if (ranged) {
+    gmp_fprintf(stderr, "byte ranges need a chunked ciphertext stream\n");
+    ok = false;
+  } else {
+    pipeline_run(pipe, threads);
+  }
+  free(io.block);
+  free(io.cblock);
+  return ok;
+}
+
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key, uint64_t threads, rsa_format_t format) {   // decrypts input file and writes to output file using the private key
+  rsa_priv_op_t op = { key, NULL };
+  pipeline_t pipe = { NULL, NULL, NULL, &op, rsa_priv_local_init, rsa_priv_local_clear, rsa_priv_apply, NULL };
+  return rsa_decrypt_run(infile, outfile, key->n, &pipe, threads, format, 0, UINT64_MAX);
+}
+
+bool rsa_decrypt_range(FILE *infile, FILE *outfile, rsa_priv_t *key, uint64_t threads, uint64_t offset, uint64_t length) {   // decrypts one plaintext byte range of a chunked stream
+  rsa_priv_op_t op = { key, NULL };
+  pipeline_t pipe = { NULL, NULL, NULL, &op, rsa_priv_local_init, rsa_priv_local_clear, rsa_priv_apply, NULL };
+  return rsa_decrypt_run(infile, outfile, key->n, &pipe, threads, RSA_FORMAT_CHUNKED, offset, length);
+}
+
+bool rsa_decrypt_file_key(FILE *infile, FILE *outfile, rsa_priv_key_t *key, uint64_t lane, rsa_format_t format) {   // rsa_decrypt_file on the calling thread with a prepared key
+  rsa_priv_op_t op = { &key->key, &key->ws[lane] };
+  pipeline_t pipe = { NULL, NULL, NULL, &op, rsa_priv_local_prepared, NULL, rsa_priv_apply, NULL };
+  return rsa_decrypt_run(infile, outfile, key->key.n, &pipe, 1, format, 0, UINT64_MAX);
+}
+
+void rsa_sign(mpz_t s, mpz_t m, rsa_priv_t *key) {                          // performs RSA signing on m using the private key
+  rsa_priv_pow_once(s, m, key);
+}
+
+bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {                       // signature verification
+  mpz_t t;
+  mpz_init(t);
+
+  pow_mod(t, s, e, n);
+  bool verified = mpz_cmp(t, m) == 0;
   mpz_clear(t);
+  return verified;
+}
+
+void rsa_pub_prepare(rsa_pub_key_t *key, mpz_t n, mpz_t e, uint64_t threads) {   // recodes e and builds a Montgomery context per thread
+  rsa_pub_prepare_ctx(key, n, e, threads, NULL, NULL);
+}
+
+void rsa_pub_prepare_ctx(rsa_pub_key_t *key, mpz_t n, mpz_t e, uint64_t threads, mont_plan_t *plan, mont_ctx_t *mont) {   // rsa_pub_prepare reusing whatever was loaded
+  if (threads < 1) {
+    threads = 1;
+  }
+  mpz_init_set(key->n, n);
+  mpz_init_set(key->e, e);
+  key->threads = threads;
+  if (plan != NULL) {
+    mont_plan_copy(&key->plan, plan);
+  } else {
+    mont_plan_init(&key->plan, e);
+  }
+  key->ctx = (mont_ctx_t *)malloc(threads * sizeof(mont_ctx_t));
+  key->vec = NULL;
+  if (montvec_best(mpz_sizeinbase(n, 2)) != MONTVEC_NONE) {              // zeroed, so every lane starts out MONTVEC_NONE
+    key->vec = (montvec_ctx_t *)calloc(threads, sizeof(montvec_ctx_t));
+  }
+  key->tmp = (mpz_t *)malloc(threads * sizeof(mpz_t));
+  for (uint64_t t = 0; t < threads; t++) {
+    if (mont != NULL) {
+      mont_init2(&key->ctx[t], mont->size);
+      mont_set_consts(&key->ctx[t], n, mont->ninv, mont->one, mont->r2);
+    } else {
+      mont_init(&key->ctx[t], n);
+    }
+    mpz_init2(key->tmp[t], mpz_sizeinbase(n, 2));
+  }
+}
+
+void rsa_pub_key_clear(rsa_pub_key_t *key) {                                     // frees any memory used by a prepared key
+  for (uint64_t t = 0; t < key->threads; t++) {
+    mont_clear(&key->ctx[t]);
+    mpz_clear(key->tmp[t]);
+    if (key->vec != NULL && key->vec[t].kind != MONTVEC_NONE) {
+      montvec_clear(&key->vec[t]);
+    }
+  }
+  free(key->ctx);
+  free(key->vec);
+  free(key->tmp);
+  mont_plan_clear(&key->plan);
+  mpz_clears(key->n, key->e, NULL);
+}
+
+typedef struct {                                                           // one thread's share of a batch
+  rsa_pub_key_t *key;
+  uint64_t lane;                                                           // which of the key's contexts this thread owns
+  mpz_t *out;                                                              // encryption: ciphertexts; NULL when verifying
+  mpz_t *in;                                                               // messages to encrypt, or signatures to verify
+  mpz_t *expect;                                                           // verification: expected messages
+  bool *ok;                                                                // verification: per-signature results; may be NULL
+  size_t begin;
+  size_t end;
+  size_t verified;                                                         // signatures in [begin, end) that verified
+} rsa_batch_t;
+
+static void *rsa_batch_worker(void *arg) {                                  // runs the exponentiations for one contiguous range, a vector group at a time
+  rsa_batch_t *b = (rsa_batch_t *)arg;
+  b->verified = 0;
+  rsa_pub_lane_t lane = rsa_pub_key_lane(b->key, b->lane);
+  if (b->out != NULL) {
+    rsa_pub_pow_many(b->out + b->begin, b->in + b->begin, b->end - b->begin, &b->key->plan, &lane);
+    return NULL;
+  }
+  mpz_t t[MONTVEC_MAX_LANES];
+  for (size_t j = 0; j < MONTVEC_MAX_LANES; j++) {
+    mpz_init2(t[j], mpz_sizeinbase(b->key->n, 2));
+  }
+  for (size_t i = b->begin; i < b->end; i += MONTVEC_MAX_LANES) {
+    size_t group = b->end - i < MONTVEC_MAX_LANES ? b->end - i : MONTVEC_MAX_LANES;
+    rsa_pub_pow_many(t, b->in + i, group, &b->key->plan, &lane);
+    for (size_t j = 0; j < group; j++) {
+      bool verified = mpz_cmp(t[j], b->expect[i + j]) == 0;
+      if (b->ok != NULL) {
+        b->ok[i + j] = verified;
+      }
+      b->verified += verified;
+    }
+  }
+  for (size_t j = 0; j < MONTVEC_MAX_LANES; j++) {
+    mpz_clear(t[j]);
+  }
+  return NULL;
+}
+
+static size_t rsa_batch_run(rsa_batch_t *job, size_t count) {               // splits a batch evenly over the key's threads
+  uint64_t lanes = job->key->threads < count ? job->key->threads : count;
+  if (lanes <= 1) {                                                        // small batches stay on the calling thread
+    job->lane = 0;
+    job->begin = 0;
+    job->end = count;
+    rsa_batch_worker(job);
+    return job->verified;
+  }
+  pthread_t *tids = (pthread_t *)malloc(lanes * sizeof(pthread_t));
+  rsa_batch_t *parts = (rsa_batch_t *)malloc(lanes * sizeof(rsa_batch_t));
+  for (uint64_t t = 0; t < lanes; t++) {
+    parts[t] = *job;
+    parts[t].lane = t;
+    parts[t].begin = count * t / lanes;
+    parts[t].end = count * (t + 1) / lanes;
+    pthread_create(&tids[t], NULL, rsa_batch_worker, &parts[t]);
+  }
+  size_t verified = 0;
+  for (uint64_t t = 0; t < lanes; t++) {
+    pthread_join(tids[t], NULL);
+    verified += parts[t].verified;
+  }
+  free(tids);
+  free(parts);
+  return verified;
+}
+
+void rsa_encrypt_batch(mpz_t c[], mpz_t m[], size_t count, rsa_pub_key_t *key) {   // encrypts count messages with one prepared key
+  rsa_batch_t job = { key, 0, c, m, NULL, NULL, 0, 0, 0 };
+  rsa_batch_run(&job, count);
+}
+
+size_t rsa_verify_batch(bool ok[], mpz_t m[], mpz_t s[], size_t count, rsa_pub_key_t *key) {   // verifies count signatures with one prepared key
+  rsa_batch_t job = { key, 0, NULL, s, m, ok, 0, 0, 0 };
+  return rsa_batch_run(&job, count);
+}
+
+bool rsa_verify_key(mpz_t m, mpz_t s, rsa_pub_key_t *key, uint64_t lane) {   // rsa_verify with a prepared key
+  mont_pow_plan(key->tmp[lane], s, &key->plan, &key->ctx[lane]);
+  return mpz_cmp(key->tmp[lane], m) == 0;
+}
+
+void rsa_priv_prepare(rsa_priv_key_t *key, rsa_priv_t *priv, uint64_t threads) {   // copies the key and builds a workspace per thread
+  rsa_priv_prepare_ctx(key, priv, threads, NULL, NULL);
+}
+
+void rsa_priv_prepare_ctx(rsa_priv_key_t *key, rsa_priv_t *priv, uint64_t threads, mont_ctx_t *mp, mont_ctx_t *mq) {   // rsa_priv_prepare reusing loaded constants
+  if (threads < 1) {
+    threads = 1;
+  }
+  rsa_priv_init(&key->key);
+  mpz_set(key->key.n, priv->n);
+  mpz_set(key->key.d, priv->d);
+  mpz_set(key->key.p, priv->p);
+  mpz_set(key->key.q, priv->q);
+  mpz_set(key->key.dp, priv->dp);
+  mpz_set(key->key.dq, priv->dq);
+  mpz_set(key->key.qinv, priv->qinv);
+  key->key.extra = priv->extra;
+  for (uint64_t i = 0; i < priv->extra; i++) {
+    mpz_set(key->key.r[i], priv->r[i]);
+    mpz_set(key->key.dr[i], priv->dr[i]);
+    mpz_set(key->key.tr[i], priv->tr[i]);
+  }
+  key->threads = threads;
+  key->ws = (rsa_priv_ws_t *)malloc(threads * sizeof(rsa_priv_ws_t));
+  bool crt = rsa_priv_has_crt(&key->key);
+  for (uint64_t t = 0; t < threads; t++) {
+    rsa_priv_ws_init(&key->ws[t], &key->key);
+    if (mp != NULL) {                                   // pow_mod_sec_ws then finds its context already set
+      mont_set_consts(&key->ws[t].wp.mont, crt ? key->key.p : key->key.n, mp->ninv, mp->one, mp->r2);
+    }
+    if (mq != NULL && crt) {
+      mont_set_consts(&key->ws[t].wq.mont, key->key.q, mq->ninv, mq->one, mq->r2);
+    }
+  }
+}
+
+void rsa_priv_key_clear(rsa_priv_key_t *key) {                              // frees any memory used by a prepared key
+  for (uint64_t t = 0; t < key->threads; t++) {
+    rsa_priv_ws_clear(&key->ws[t]);
+  }
+  free(key->ws);
+  rsa_priv_clear(&key->key);
+}
+
+void rsa_sign_key(mpz_t s, mpz_t m, rsa_priv_key_t *key, uint64_t lane) {   // rsa_sign with a prepared key
+  rsa_priv_pow(s, m, &key->key, &key->ws[lane]);
 }
@@ -9,21 +9,104 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "mont.h"
+#include "montvec.h"
+#include "numtheory.h"
+
+#define RSA_FAMILY_MAX 5           // members of a key family: one per Fermat prime exponent
+#define RSA_MAX_PRIMES 4           // prime factors a multi-prime key may have
+
+//
+// Ciphertext file formats.
+//
+typedef enum {
+  RSA_FORMAT_AUTO,         // decryption only: detect the format from the first byte
+  RSA_FORMAT_HEX,          // one hexstring per line
+  RSA_FORMAT_BIN,          // binary container of fixed-width blocks; see container.h
+  RSA_FORMAT_HYBRID,       // RSA-wrapped session key and ChaCha20-Poly1305 chunks; see hybrid.h
+  RSA_FORMAT_CHUNKED,      // numbered, checksummed chunks of fixed-width blocks; see chunk.h
+} rsa_format_t;
 
 //
 // Generates the components for a new public RSA key.
-// p and q will be large primes with n their product.
+// p and q will be large primes with n their product, each of nbits / 2 bits
+// (p one bit longer for odd nbits), so that the two CRT exponentiations of
+// the private key are equally cheap.
 // The product n will be of a specified minimum number of bits.
 // The primality is tested using Miller-Rabin.
-// The public exponent e will have around the same number of bits as n.
+// The public exponent e is either the given small Fermat prime, in which case
+// primes are redrawn until e is coprime to lambda(n), or a random number with
+// around the same number of bits as n.
 // All mpz_t arguments are expected to be initialized.
 //
 // p: will store the first large prime.
 // q: will store the second large prime.
 // n: will store the product of p and q.
 // e: will store the public exponent.
+// iters: Miller-Rabin rounds per prime candidate, or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW.
+// fixed_e: 3, 5, 17, 257 or 65537 to fix e, or 0 for a random e. A product of
+//          several of them keeps every one coprime to lambda(n); e is then set to the product.
+// threads: prime search threads; 1 searches for p then q on the calling thread.
+//
+void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads);
+
+//
+// Same as rsa_make_pub on one thread, but draws all of its randomness from
+// the given state instead of the shared one, so that several keys can be
+// generated at once.
+//
+// rs: an initialized random state owned by the caller.
+//
+void rsa_make_pub_r(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, gmp_randstate_t rs);
+
+//
+// Generates the components for a new multi-prime public RSA key: n is the
+// product of count distinct primes of nbits / count bits each, so every
+// prime is smaller, and faster to find, than either prime of a two-prime key.
+// The public exponent is chosen as in rsa_make_pub.
+// All mpz_t arguments are expected to be initialized.
+//
+// primes: will store the count primes.
+// count: number of primes, 2 to RSA_MAX_PRIMES.
+// n: will store the product of the primes.
+// e: will store the public exponent.
+// iters: Miller-Rabin rounds per prime candidate, or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW.
+// fixed_e: 3, 5, 17, 257 or 65537 to fix e, or 0 for a random e.
+// threads: prime search threads; 1 searches for one prime after another on the calling thread.
+//
+void rsa_make_pub_multi(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, uint64_t threads);
+
+//
+// Same as rsa_make_pub_multi on one thread, drawing all of its randomness
+// from the given state; see rsa_make_pub_r.
 //
-void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
+void rsa_make_pub_multi_r(mpz_t primes[], uint64_t count, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters, uint64_t fixed_e, gmp_randstate_t rs);
+
+//
+// Checks whether a number is a Fermat prime usable as a fixed public exponent.
+//
+// returns: true for 3, 5, 17, 257 and 65537, false otherwise.
+//
+bool rsa_is_fermat_prime(uint64_t e);
+
+//
+// Generates the primes of a key family: count keys sharing one modulus n,
+// whose public exponents are the first count Fermat primes. Primes are
+// redrawn until no exponent divides p - 1 or q - 1, so every member has a
+// private key (rsa_make_priv with its e) and rsa_decrypt_fiat can decrypt
+// for all of them at once. The members belong to one key holder: anyone
+// with one private key can factor n.
+// All mpz_t arguments are expected to be initialized.
+//
+// p: will store the first large prime.
+// q: will store the second large prime.
+// n: will store the product of p and q.
+// e: will store the count public exponents, 3, 5, 17, 257 and 65537 in turn.
+// count: number of keys, 2 to RSA_FAMILY_MAX.
+// iters: Miller-Rabin rounds per prime candidate, or PRIME_ITERS_AUTO or PRIME_ITERS_BPSW.
+// threads: prime search threads; 1 searches for p then q on the calling thread.
+//
+void rsa_make_family(mpz_t p, mpz_t q, mpz_t n, uint64_t e[], uint64_t count, uint64_t nbits, uint64_t iters, uint64_t threads);
 
 //
 // Writes a public RSA key to a file.
@@ -38,49 +121,129 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 //
-// Reads a public RSA key from a file.
+// Reads a public RSA key from a file, in the text format rsa_write_pub
+// writes or the binary format of keyfile.h.
 // Public key contents: n, e, signature, username.
 // All mpz_t arguments are expected to be initialized.
 //
 // n: will store the public modulus.
 // e: will store the public exponent.
 // s: will store the signature.
-// username: an allocated array to hold the username.
+// username: *username (NULL or allocated) is freed and replaced by the
+//           username, newly allocated for the caller to free.
 // pbfile: the file containing the public key
+// returns: true if a whole key was read, false otherwise.
+//
+bool rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char **username, FILE *pbfile);
+
+//
+// A private RSA key.
+// Keys made by rsa_make_priv also carry the prime factors of n and the
+// Chinese Remainder Theorem values, which rsa_decrypt and rsa_sign use to
+// replace one full-width exponentiation with two half-width ones.
+// Multi-prime keys carry up to RSA_MAX_PRIMES - 2 further primes with their
+// own CRT values (as in RFC 8017), one smaller exponentiation each.
+// Keys read from older two-field files only have n and d; p is then 0.
+//
+typedef struct {
+  mpz_t n;                 // public modulus
+  mpz_t d;                 // private exponent
+  mpz_t p;                 // first prime factor of n, or 0 when unknown
+  mpz_t q;                 // second prime factor of n
+  mpz_t dp;                // d mod (p - 1)
+  mpz_t dq;                // d mod (q - 1)
+  mpz_t qinv;              // q^-1 mod p
+  uint64_t extra;          // prime factors beyond p and q
+  mpz_t r[RSA_MAX_PRIMES - 2];     // the further prime factors of n
+  mpz_t dr[RSA_MAX_PRIMES - 2];    // d mod (r_i - 1)
+  mpz_t tr[RSA_MAX_PRIMES - 2];    // (p * q * r_0 * ... * r_(i-1))^-1 mod r_i
+} rsa_priv_t;
+
+//
+// Initializes every field of a private key to 0.
 //
-void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
+void rsa_priv_init(rsa_priv_t *key);
+
+//
+// Frees any memory used by a private key.
+//
+void rsa_priv_clear(rsa_priv_t *key);
+
+//
+// Exchanges every field of two private keys.
+//
+void rsa_priv_swap(rsa_priv_t *a, rsa_priv_t *b);
+
+//
+// Checks whether a private key carries its CRT values.
+//
+// returns: true if p, q, dp, dq and qinv (and any further primes' values) are present, false otherwise.
+//
+bool rsa_priv_has_crt(rsa_priv_t *key);
 
 //
 // Generates the components for a new private RSA key.
 // Requires an accompanying RSA public key to complete the pair.
 // All mpz_t arguments are expected to be initialized.
 //
-// d: will store the RSA private key.
+// key: will store n, d and the CRT values.
 // e: the precomputed public exponent.
 // p: the first large prime from the public key generation.
-// p: the second large prime from the public key generation.
+// q: the second large prime from the public key generation.
+//
+void rsa_make_priv(rsa_priv_t *key, mpz_t e, mpz_t p, mpz_t q);
+
+//
+// Same as rsa_make_priv for the primes of a multi-prime key.
+// The first two primes become p and q, the rest the further primes.
 //
-void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q);
+// key: will store n, d and the CRT values.
+// e: the precomputed public exponent.
+// primes: the count primes from rsa_make_pub_multi.
+// count: number of primes, 2 to RSA_MAX_PRIMES.
+//
+void rsa_make_priv_multi(rsa_priv_t *key, mpz_t e, mpz_t primes[], uint64_t count);
 
 //
 // Writes a private RSA key to a file.
-// Private key contents: n, d.
-// All mpz_t arguments are expected to be initialized.
+// Private key contents: n, d, and if present p, q, dp, dq, qinv, then
+// r, dr and tr for every further prime.
 //
-// n: the public modulus.
-// d: the private key.
+// key: the private key.
 // pvfile: the file to write the private key to.
 //
-void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile);
+void rsa_write_priv(rsa_priv_t *key, FILE *pvfile);
 
 //
-// Reads a private RSA key from a file.
-// Private key contents: n, d.
-// All mpz_t arguments are expected to be initialized.
+// Reads a private RSA key from a file, in the text format rsa_write_priv
+// writes or the binary format of keyfile.h.
+// Private key contents: n, d, and if present p, q, dp, dq, qinv, then
+// r, dr and tr for every further prime.
+// Files holding only n and d load without CRT values.
 //
-// n: will store the public modulus.
-// d: will store the private key.
-void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
+// key: will store the private key; expected to be initialized.
+// pvfile: the file containing the private key.
+// returns: true if at least n and d were read, false otherwise.
+//
+bool rsa_read_priv(rsa_priv_t *key, FILE *pvfile);
+
+//
+// Scratch for private-key operations with one key: a workspace for each
+// prime (or for n when the key has no CRT values) and the CRT temporaries.
+//
+typedef struct {
+  numtheory_ws_t wp;       // Montgomery context for p, or for n without CRT values
+  numtheory_ws_t wq;       // Montgomery context for q
+  uint64_t extra;          // workspaces in wr, one per further prime of the key
+  numtheory_ws_t wr[RSA_MAX_PRIMES - 2];   // Montgomery contexts for the further primes
+  mpz_t ap, m1;            // the input reduced mod one prime, and its power mod that prime
+  mpz_t c[RSA_MAX_PRIMES - 1];   // Garner coefficients reduced mod their primes: qinv, then each tr
+  mp_size_t limbs;         // limbs of the primes together, enough for n and every partial product
+  mp_limb_t *a;            // the input reduced mod n, zero-padded to limbs
+  mp_limb_t *o, *prod;     // the recombined result so far and the product of the primes it covers
+  mp_limb_t *t, *u, *w;    // recombination temporaries
+  mp_limb_t *sec;          // mpn_sec_* scratch
+} rsa_priv_ws_t;
 
 //
 // Encrypts a message given an RSA public exponent and modulus.
@@ -102,42 +265,88 @@ void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 // outfile: the output file to write the encrypted input to.
 // n: the public modulus.
 // e: the public exponent.
+// threads: worker threads for the block exponentiations; 1 stays on the calling thread.
+// format: any format but RSA_FORMAT_AUTO.
+// returns: false if no hybrid session key could be drawn, true otherwise.
 //
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+bool rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, uint64_t threads, rsa_format_t format);
 
 //
-// Decrypts some ciphertext given an RSA private key and public modulus.
+// Decrypts some ciphertext given an RSA private key.
+// Uses the CRT values when the key has them, for every prime of a multi-prime key.
+// Runs in constant time: the exponentiations with mont_pow_sec, the
+// reductions mod each prime and the CRT recombination with mpn_sec_*.
 // All mpz_t arguments are expected to be initialized.
 //
 // m: will store the decrypted message.
 // c: the ciphertext to decrypt.
-// d: the private key.
-// n: the public modulus.
+// key: the private key.
 //
-void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
+void rsa_decrypt(mpz_t m, mpz_t c, rsa_priv_t *key);
 
 //
-// Decrypts an entire file given an RSA public modulus and private key.
+// Decrypts a batch of ciphertexts for the members of a key family with
+// Fiat's batch RSA. A product tree over the ciphertexts raises their product
+// to a single E-th root, E the product of the exponents, with one CRT
+// exponentiation; the root is then split back into the messages down the
+// tree with exponentiations by small public values. Gives the same messages
+// as rsa_decrypt with each member's key. Ciphertexts sharing a factor with
+// n, such as 0, have no inverse mod n and are decrypted one at a time.
 // All mpz_t arguments are expected to be initialized.
+//
+// m: will store the count messages.
+// c: the count ciphertexts; c[i] was encrypted with exponent e[i].
+// e: the public exponents, pairwise coprime and coprime to p - 1 and q - 1,
+//    e.g. distinct members of one rsa_make_family family.
+// count: number of ciphertexts.
+// key: a private key for the shared n with CRT values; its own d is not used.
+// returns: false if the key has no CRT values or the exponents do not qualify.
+//
+bool rsa_decrypt_fiat(mpz_t m[], mpz_t c[], uint64_t e[], size_t count, rsa_priv_t *key);
+
+//
+// Decrypts an entire file given an RSA private key.
 // All FILE * arguments are expected to be properly opened.
 //
 // infile: the input file to decrypt.
 // outfile: the output file to write the decrypted input to.
-// n: the public modulus.
-// d: the private key.
+// key: the private key.
+// threads: worker threads for the block exponentiations; 1 stays on the calling thread.
+// format: the ciphertext format, or RSA_FORMAT_AUTO to detect it.
+// returns: false if the input is not a container for this key, fails authentication, or is a
+//          truncated or damaged chunked stream; true otherwise.
+//
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, rsa_priv_t *key, uint64_t threads, rsa_format_t format);
+
+//
+// Decrypts part of a chunked ciphertext stream given an RSA private key.
+// Only the chunks that overlap the range are read and decrypted; on a
+// seekable input the first of them is found without reading the others.
+// Damaged or truncated chunks stop the output at the last good chunk.
+// All FILE * arguments are expected to be properly opened.
+//
+// infile: the chunked ciphertext, possibly several streams concatenated.
+// outfile: the output file to write the decrypted range to.
+// key: the private key.
+// threads: worker threads for the block exponentiations; 1 stays on the calling thread.
+// offset: first plaintext byte to write.
+// length: number of plaintext bytes to write; UINT64_MAX for the rest of the input.
+// returns: false if the input is not a chunked stream for this key or is damaged, true otherwise.
 //
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
+bool rsa_decrypt_range(FILE *infile, FILE *outfile, rsa_priv_t *key, uint64_t threads, uint64_t offset, uint64_t length);
 
 //
-// Signs some message given an RSA private key and public modulus.
+// Signs some message given an RSA private key.
+// Uses the CRT values when the key has them, for every prime of a multi-prime key.
+// Runs in constant time: the exponentiations with mont_pow_sec, the
+// reductions mod each prime and the CRT recombination with mpn_sec_*.
 // All mpz_t arguments are expected to be initialized.
 //
 // s: will store the signed message (the signature).
 // m: the message to sign.
-// d: the private key.
-// n: the public modulus.
+// key: the private key.
 //
-void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
+void rsa_sign(mpz_t s, mpz_t m, rsa_priv_t *key);
 
 //
 // Verifies some signature given an RSA public exponent and modulus.
@@ -152,3 +361,160 @@ void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 //
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
 
+//
+// A public key prepared for many operations.
+// The exponent is recoded once and each thread gets its own Montgomery
+// context for n, so batches skip all per-call setup. Where montvec has a
+// kernel that beats mont.h for n, each thread also gets a vector context,
+// set up the first time that thread exponentiates several blocks at once.
+//
+typedef struct {
+  mpz_t n;                 // public modulus
+  mpz_t e;                 // public exponent
+  uint64_t threads;        // threads a batch is split over
+  mont_plan_t plan;        // e recoded for mont_pow_plan
+  mont_ctx_t *ctx;         // one context per thread
+  montvec_ctx_t *vec;      // one vector context per thread, kind MONTVEC_NONE until used; NULL without a kernel for n
+  mpz_t *tmp;              // one scratch integer per thread, for verification
+} rsa_pub_key_t;
+
+//
+// Prepares a public key for the batch functions.
+//
+// key: will store the prepared key.
+// n: the public modulus; must be odd.
+// e: the public exponent.
+// threads: threads each batch is split over; 1 stays on the calling thread.
+//
+void rsa_pub_prepare(rsa_pub_key_t *key, mpz_t n, mpz_t e, uint64_t threads);
+
+//
+// Prepares a public key from values loaded with it, e.g. by keyfile_read_pub,
+// instead of working them out again.
+//
+// key: will store the prepared key.
+// n: the public modulus; must be odd.
+// e: the public exponent.
+// threads: threads each batch is split over; 1 stays on the calling thread.
+// plan: e recoded by mont_plan_init, copied into the key; NULL to recode e.
+// mont: a context set for n whose constants each thread copies; NULL to derive them.
+//
+void rsa_pub_prepare_ctx(rsa_pub_key_t *key, mpz_t n, mpz_t e, uint64_t threads, mont_plan_t *plan, mont_ctx_t *mont);
+
+//
+// Frees any memory used by a prepared public key.
+//
+void rsa_pub_key_clear(rsa_pub_key_t *key);
+
+//
+// Encrypts many messages with one prepared key.
+// Gives the same ciphertexts as calling rsa_encrypt on each message.
+// All mpz_t arguments are expected to be initialized.
+//
+// c: will store the count ciphertexts.
+// m: the count messages to encrypt.
+// count: number of messages.
+// key: the prepared public key.
+//
+void rsa_encrypt_batch(mpz_t c[], mpz_t m[], size_t count, rsa_pub_key_t *key);
+
+//
+// Verifies many signatures with one prepared key.
+// Each result matches rsa_verify on the same message and signature.
+// All mpz_t arguments are expected to be initialized.
+//
+// ok: will store whether each signature verified; may be NULL.
+// m: the count expected messages.
+// s: the count signatures to verify.
+// count: number of signatures.
+// key: the prepared public key.
+// returns: the number of signatures that verified.
+//
+size_t rsa_verify_batch(bool ok[], mpz_t m[], mpz_t s[], size_t count, rsa_pub_key_t *key);
+
+//
+// Verifies one signature with a prepared key.
+// All mpz_t arguments are expected to be initialized.
+//
+// m: the expected message.
+// s: the signature to verify.
+// key: the prepared public key.
+// lane: which of the key's per-thread contexts to use; one thread per lane at a time.
+// returns: true if signature is verified, false otherwise.
+//
+bool rsa_verify_key(mpz_t m, mpz_t s, rsa_pub_key_t *key, uint64_t lane);
+
+//
+// Encrypts an entire file on the calling thread with a prepared key.
+// Output is the same as rsa_encrypt_file with the key's n and e.
+//
+// infile: the input file to encrypt.
+// outfile: the output file to write the encrypted input to.
+// key: the prepared public key.
+// lane: which of the key's per-thread contexts to use; one thread per lane at a time.
+// format: any format but RSA_FORMAT_AUTO.
+// returns: false if no hybrid session key could be drawn, true otherwise.
+//
+bool rsa_encrypt_file_key(FILE *infile, FILE *outfile, rsa_pub_key_t *key, uint64_t lane, rsa_format_t format);
+
+//
+// A private key prepared for many operations.
+// Holds its own copy of the key and one workspace per thread, so that each
+// operation skips all per-call setup.
+//
+typedef struct {
+  rsa_priv_t key;          // copy of the private key
+  uint64_t threads;        // number of workspaces
+  rsa_priv_ws_t *ws;       // one workspace per thread
+} rsa_priv_key_t;
+
+//
+// Prepares a private key for repeated use.
+//
+// key: will store the prepared key.
+// priv: the private key to copy.
+// threads: number of threads that will use the key at once.
+//
+void rsa_priv_prepare(rsa_priv_key_t *key, rsa_priv_t *priv, uint64_t threads);
+
+//
+// Prepares a private key from Montgomery constants loaded with it, e.g. by
+// keyfile_read_priv, instead of working them out again.
+//
+// key: will store the prepared key.
+// priv: the private key to copy.
+// threads: number of threads that will use the key at once.
+// mp: a context set for p, or for n if the key has no CRT values; NULL to derive.
+// mq: a context set for q; NULL to derive. Unused without CRT values.
+//
+void rsa_priv_prepare_ctx(rsa_priv_key_t *key, rsa_priv_t *priv, uint64_t threads, mont_ctx_t *mp, mont_ctx_t *mq);
+
+//
+// Frees any memory used by a prepared private key.
+//
+void rsa_priv_key_clear(rsa_priv_key_t *key);
+
+//
+// Signs some message with a prepared key.
+// All mpz_t arguments are expected to be initialized.
+//
+// s: will store the signature.
+// m: the message to sign.
+// key: the prepared private key.
+// lane: which of the key's workspaces to use; one thread per lane at a time.
+//
+void rsa_sign_key(mpz_t s, mpz_t m, rsa_priv_key_t *key, uint64_t lane);
+
+//
+// Decrypts an entire file on the calling thread with a prepared key.
+// Output is the same as rsa_decrypt_file with the key.
+//
+// infile: the input file to decrypt.
+// outfile: the output file to write the decrypted input to.
+// key: the prepared private key.
+// lane: which of the key's workspaces to use; one thread per lane at a time.
+// format: the ciphertext format, or RSA_FORMAT_AUTO to detect it.
+// returns: false if the input is not a container for this key, fails authentication, or is a
+//          truncated or damaged chunked stream; true otherwise.
+//
+bool rsa_decrypt_file_key(FILE *infile, FILE *outfile, rsa_priv_key_t *key, uint64_t lane, rsa_format_t format);
@@ -0,0 +1,389 @@
+/*********************************************************************************
+* rsad.c
+* Long-running encryption daemon: loads a key pair once and serves encrypt,
+* decrypt, sign and verify requests over a Unix domain socket
+* Usage guide in README.md
+*********************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "container.h"
+#include "keycache.h"
+#include "keyfile.h"
+#include "keystore.h"
+#include "rsa.h"
+#include "service.h"
+
+#define OPTIONS "s:n:d:k:c:t:i:vh"
+
+typedef struct {                                        // keys and settings shared by every worker
+  int listen_fd;
+  bool have_pub;
+  bool have_priv;
+  rsa_pub_key_t pub;
+  rsa_priv_key_t priv;
+  bool have_store;
+  keystore_t store;                                     // keys looked up by label, for the *_TO and *_AS requests
+  keycache_t cache;
+  uint64_t idle;                                        // seconds a connection may wait on a read or write before it is dropped
+  int verbose;
+} rsad_t;
+
+typedef struct {
+  rsad_t *d;
+  uint64_t lane;                                        // the key contexts this worker owns
+} rsad_worker_t;
+
+static bool reply_text(int fd, uint8_t status, const char *text) {   // answers with a status and a short explanation
+  return service_send(fd, status, 0, (const uint8_t *)text, strlen(text));
+}
+
+static bool reply_stream(int fd, uint8_t status, const char *why, char *data, size_t len) {   // answers with the contents of a memory stream, or with why the operation failed, and frees it
+  if (status == SERVICE_OK && len > SERVICE_MAX_PAYLOAD) {   // e.g. hex ciphertext of a request near the limit; the client would drop the frame
+    status = SERVICE_BAD_REQUEST;
+    why = "response exceeds frame limit";
+  }
+  bool sent = status == SERVICE_OK ? service_send(fd, SERVICE_OK, 0, (uint8_t *)data, (uint32_t)len) : reply_text(fd, status, why);
+  free(data);
+  return sent;
+}
+
+static char *request_label(uint8_t **payload, uint32_t *len) {   // splits a u32 length and label off the front of a payload; NULL if malformed
+  uint32_t label_len = *len < 4 ? 0 : (uint32_t)(*payload)[0] << 24 | (uint32_t)(*payload)[1] << 16 | (uint32_t)(*payload)[2] << 8 | (*payload)[3];
+  if (*len < 4 || label_len == 0 || label_len > *len - 4 || memchr(*payload + 4, '\0', label_len) != NULL) {
+    return NULL;
+  }
+  char *label = strndup((char *)*payload + 4, label_len);
+  *payload += 4 + label_len;
+  *len -= 4 + label_len;
+  return label;
+}
+
+static bool handle(int fd, rsad_worker_t *w, uint8_t type, uint8_t flags, uint8_t *payload, uint32_t len, mpz_t m, mpz_t s) {   // answers one request
+  rsad_t *d = w->d;
+  char *out = NULL;
+  size_t out_len = 0;
+  switch (type) {
+  case SERVICE_ENCRYPT: {
+    if (!d->have_pub) {
+      return reply_text(fd, SERVICE_NO_KEY, "no public key loaded");
+    }
+    if (flags == RSA_FORMAT_AUTO || flags > RSA_FORMAT_CHUNKED) {
+      return reply_text(fd, SERVICE_BAD_REQUEST, "encryption format must be hex, bin, hybrid or chunked");
+    }
+    FILE *in = fmemopen(payload, len, "r");             // the payload read as a file; empty input gives an empty stream
+    FILE *outs = open_memstream(&out, &out_len);
+    bool ok = rsa_encrypt_file_key(in, outs, &d->pub, w->lane, (rsa_format_t)flags);
+    fclose(in);
+    fclose(outs);
+    return reply_stream(fd, ok ? SERVICE_OK : SERVICE_FAILED, "could not draw a session key", out, out_len);
+  }
+  case SERVICE_DECRYPT: {
+    if (!d->have_priv) {
+      return reply_text(fd, SERVICE_NO_KEY, "no private key loaded");
+    }
+    if (flags > RSA_FORMAT_CHUNKED || len == 0) {
+      return reply_text(fd, SERVICE_BAD_REQUEST, "bad decryption request");
+    }
+    FILE *in = fmemopen(payload, len, "r");
+    FILE *outs = open_memstream(&out, &out_len);
+    bool ok = rsa_decrypt_file_key(in, outs, &d->priv, w->lane, (rsa_format_t)flags);
+    fclose(in);
+    fclose(outs);
+    return reply_stream(fd, ok ? SERVICE_OK : SERVICE_BAD_REQUEST, "input is not a ciphertext for this key", out, out_len);
+  }
+  case SERVICE_SIGN: {
+    if (!d->have_priv) {
+      return reply_text(fd, SERVICE_NO_KEY, "no private key loaded");
+    }
+    mpz_import(m, len, 1, 1, 1, 0, payload);
+    if (mpz_cmp(m, d->priv.key.n) >= 0) {
+      return reply_text(fd, SERVICE_BAD_REQUEST, "message is not below n");
+    }
+    rsa_sign_key(s, m, &d->priv, w->lane);
+    uint32_t modbytes = container_modbytes(d->priv.key.n);
+    uint8_t *block = (uint8_t *)malloc(modbytes);
+    container_put_block(block, s, modbytes);
+    bool sent = service_send(fd, SERVICE_OK, 0, block, modbytes);
+    free(block);
+    return sent;
+  }
+  case SERVICE_VERIFY: {
+    if (!d->have_pub) {
+      return reply_text(fd, SERVICE_NO_KEY, "no public key loaded");
+    }
+    uint32_t mlen = len < 4 ? 0 : (uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16 | (uint32_t)payload[2] << 8 | payload[3];
+    if (len < 4 || mlen > len - 4) {
+      return reply_text(fd, SERVICE_BAD_REQUEST, "malformed verification request");
+    }
+    mpz_import(m, mlen, 1, 1, 1, 0, payload + 4);
+    mpz_import(s, len - 4 - mlen, 1, 1, 1, 0, payload + 4 + mlen);
+    if (!rsa_verify_key(m, s, &d->pub, w->lane)) {
+      return reply_text(fd, SERVICE_FAILED, "could not verify signature");
+    }
+    return service_send(fd, SERVICE_OK, 0, NULL, 0);
+  }
+  case SERVICE_ENCRYPT_TO:
+  case SERVICE_DECRYPT_AS: {
+    bool encrypt = type == SERVICE_ENCRYPT_TO;
+    if (!d->have_store) {
+      return reply_text(fd, SERVICE_NO_KEY, "no keystore loaded");
+    }
+    char *label = request_label(&payload, &len);
+    if (label == NULL || flags > RSA_FORMAT_CHUNKED || (encrypt && flags == RSA_FORMAT_AUTO) || (!encrypt && len == 0)) {
+      free(label);
+      return reply_text(fd, SERVICE_BAD_REQUEST, encrypt ? "bad encryption request" : "bad decryption request");
+    }
+    keycache_entry_t *key = keycache_get(&d->cache, label, encrypt ? KEYCACHE_PUB : KEYCACHE_PRIV);
+    free(label);
+    if (key == NULL) {
+      return reply_text(fd, SERVICE_NO_KEY, "no usable key for that label");
+    }
+    FILE *in = fmemopen(payload, len, "r");
+    FILE *outs = open_memstream(&out, &out_len);
+    bool ok;
+    if (encrypt) {
+      ok = rsa_encrypt_file_key(in, outs, &key->pub, w->lane, (rsa_format_t)flags);
+    } else {
+      ok = rsa_decrypt_file_key(in, outs, &key->priv, w->lane, (rsa_format_t)flags);
+    }
+    keycache_release(&d->cache, key);
+    fclose(in);
+    fclose(outs);
+    uint8_t failed = encrypt ? SERVICE_FAILED : SERVICE_BAD_REQUEST;
+    return reply_stream(fd, ok ? SERVICE_OK : failed, encrypt ? "could not draw a session key" : "input is not a ciphertext for this key", out, out_len);
+  }
+  default:
+    return reply_text(fd, SERVICE_BAD_REQUEST, "unknown request type");
+  }
+}
+
+static void *rsad_worker(void *arg) {                   // accepts connections and serves each one until the client hangs up
+  rsad_worker_t *w = (rsad_worker_t *)arg;
+  uint8_t *buf = NULL;
+  size_t cap = 0;
+  mpz_t m, s;
+  mpz_inits(m, s, NULL);
+  while (1) {
+    int fd = accept(w->d->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {   // would fail again at once until something is freed
+        usleep(100000);
+      }
+      continue;
+    }
+    struct timeval tv = { (time_t)w->d->idle, 0 };    // an idle or stalled client must not hold this worker for good
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t len = 0;
+    uint64_t served = 0;
+    while (service_recv(fd, &type, &flags, &buf, &cap, &len) && handle(fd, w, type, flags, buf, len, m, s)) {
+      served += 1;
+    }
+    if (w->d->verbose == 1) {
+      gmp_fprintf(stderr, "worker %lu: connection closed after %lu requests\n", w->lane, served);
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  char *socket_path = SERVICE_DEFAULT_SOCKET;   // default socket path
+  char *pub_file = NULL;                        // public key file; encrypt and verify need it
+  char *priv_file = NULL;                       // private key file; decrypt and sign need it
+  char *store_file = NULL;                      // keystore; the labelled requests need it
+  uint64_t cache_entries = 4096;                // default num of prepared keystore keys kept
+  uint64_t threads = 1;                         // default num of worker threads
+  rsad_t d;
+  d.idle = 10;                                  // default idle timeout: 10 seconds
+  d.verbose = 0;                                // verbose set to false
+  int opt = 0;
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 's':                                   // specify socket path to listen on
+      socket_path = optarg;
+      break;
+    case 'n':                                   // specify file containing public key
+      pub_file = optarg;
+      break;
+    case 'd':                                   // specify file containing private key
+      priv_file = optarg;
+      break;
+    case 'k':                                   // specify keystore to serve labelled requests from
+      store_file = optarg;
+      break;
+    case 'c':                                   // specify keystore cache size and exit if input is invalid
+      cache_entries = strtoul(optarg, NULL, 10);
+      if (cache_entries < 1) {
+        gmp_fprintf(stderr, "cache size must be at least 1.\n");
+        return 1;
+      }
+      break;
+    case 't':                                   // specify num of worker threads and exit if input is invalid
+      threads = strtoul(optarg, NULL, 10);
+      if (threads < 1 || threads > 1024) {
+        gmp_fprintf(stderr, "number of threads must be within 1-1024, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'i':                                   // specify idle timeout and exit if input is invalid
+      d.idle = strtoul(optarg, NULL, 10);
+      if (d.idle < 1 || d.idle > 86400) {
+        gmp_fprintf(stderr, "idle timeout must be within 1-86400 seconds, inclusive.\n");
+        return 1;
+      }
+      break;
+    case 'v':                                   // enable verbose output
+      d.verbose = 1;
+      break;
+    case 'h':                                   // prints program usage and synopsis
+      gmp_fprintf(
+          stderr,
+          "Usage: ./rsad [options]\n  ./rsad loads a key pair once and serves "
+          "encrypt, decrypt, sign and verify\n  requests on a Unix domain "
+          "socket until interrupted.\n    -s <socket> : Listen on <socket>. "
+          "Default: rsad.sock.\n    -n <keyfile>: Public key is in <keyfile>.\n"
+          "    -d <keyfile>: Private key is in <keyfile>.\n    -k <store>  : Serve "
+          "requests for any label in keystore <store>.\n    -c <entries>: Keep "
+          "<entries> prepared keystore keys cached. Default: 4096.\n    -t <threads>: "
+          "Serve <threads> connections at once. Default: 1.\n    -i <secs>   : "
+          "Drop a connection idle for <secs> seconds. Default: 10.\n    -v          : "
+          "Enable verbose output.\n    -h          : Display program synopsis "
+          "and usage.\n");
+      return 0;
+    default:                                    // prints -h output and exit program on bad option
+      gmp_fprintf(
+          stderr,
+          "Usage: ./rsad [options]\n  ./rsad loads a key pair once and serves "
+          "encrypt, decrypt, sign and verify\n  requests on a Unix domain "
+          "socket until interrupted.\n    -s <socket> : Listen on <socket>. "
+          "Default: rsad.sock.\n    -n <keyfile>: Public key is in <keyfile>.\n"
+          "    -d <keyfile>: Private key is in <keyfile>.\n    -k <store>  : Serve "
+          "requests for any label in keystore <store>.\n    -c <entries>: Keep "
+          "<entries> prepared keystore keys cached. Default: 4096.\n    -t <threads>: "
+          "Serve <threads> connections at once. Default: 1.\n    -i <secs>   : "
+          "Drop a connection idle for <secs> seconds. Default: 10.\n    -v          : "
+          "Enable verbose output.\n    -h          : Display program synopsis "
+          "and usage.\n");
+      return 1;
+    }
+  }
+  if (pub_file == NULL && priv_file == NULL && store_file == NULL) {
+    gmp_fprintf(stderr, "at least one of -n, -d and -k is required\n");
+    return 1;
+  }
+
+  d.have_pub = false;
+  d.have_priv = false;
+  if (pub_file != NULL) {                       // the username signature is checked once here, not per request
+    FILE *pub_fs = fopen(pub_file, "r");
+    if (pub_fs == NULL) {
+      gmp_fprintf(stderr, "cannot open specified public key file\n");
+      return 1;
+    }
+    keyfile_pub_t kp;                           // binary key files may carry the plan and Montgomery constants
+    keyfile_pub_init(&kp);
+    bool loaded = keyfile_read_pub(&kp, pub_fs);
+    fclose(pub_fs);
+    mpz_t username;
+    mpz_init(username);
+    if (loaded) {
+      mpz_set_str(username, kp.username, 62);
+    }
+    if (!loaded || rsa_verify(username, kp.s, kp.e, kp.n) == false) {
+      gmp_fprintf(stderr, loaded ? "could not verify signature\n" : "cannot read specified public key file\n");
+      mpz_clear(username);
+      keyfile_pub_clear(&kp);
+      return 1;
+    }
+    rsa_pub_prepare_ctx(&d.pub, kp.n, kp.e, threads, kp.has_plan ? &kp.plan : NULL, kp.has_mont ? &kp.mont : NULL);
+    d.have_pub = true;
+    mpz_clear(username);
+    keyfile_pub_clear(&kp);
+  }
+  if (priv_file != NULL) {
+    FILE *priv_fs = fopen(priv_file, "r");
+    if (priv_fs == NULL) {
+      gmp_fprintf(stderr, "cannot open specified private key file\n");
+      return 1;
+    }
+    keyfile_priv_t kp;
+    keyfile_priv_init(&kp);
+    bool loaded = keyfile_read_priv(&kp, priv_fs);
+    fclose(priv_fs);
+    if (!loaded) {
+      gmp_fprintf(stderr, "cannot read specified private key file\n");
+      keyfile_priv_clear(&kp);
+      return 1;
+    }
+    rsa_priv_prepare_ctx(&d.priv, &kp.key, threads, kp.has_mp ? &kp.mp : NULL, kp.has_mq ? &kp.mq : NULL);
+    d.have_priv = true;
+    keyfile_priv_clear(&kp);
+  }
+
+  d.have_store = false;
+  if (store_file != NULL) {                     // keys are read and prepared on first use, then cached
+    FILE *store_fs = fopen(store_file, "r");
+    if (store_fs == NULL) {
+      gmp_fprintf(stderr, "cannot open specified keystore file\n");
+      return 1;
+    }
+    if (!keystore_open(&d.store, store_fs)) {
+      fclose(store_fs);
+      return 1;
+    }
+    keycache_init(&d.cache, &d.store, cache_entries, threads);
+    d.have_store = true;
+  }
+
+  d.listen_fd = service_listen(socket_path);
+  if (d.listen_fd < 0) {
+    gmp_fprintf(stderr, "cannot listen on %s: %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+  struct stat bound;                            // the socket file made here, so shutdown removes only that
+  bool have_bound = lstat(socket_path, &bound) == 0;
+  sigset_t stop;                                // workers never see SIGINT or SIGTERM; main waits for them
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  rsad_worker_t *workers = (rsad_worker_t *)malloc(threads * sizeof(rsad_worker_t));
+  for (uint64_t t = 0; t < threads; t++) {
+    workers[t].d = &d;
+    workers[t].lane = t;
+    pthread_create(&tids[t], NULL, rsad_worker, &workers[t]);
+  }
+  if (d.verbose == 1) {
+    gmp_fprintf(stderr, "listening on %s with %lu workers\n", socket_path, threads);
+  }
+  int sig = 0;
+  sigwait(&stop, &sig);
+  struct stat st;                               // workers are blocked in accept or mid-request; exiting ends them
+  if (have_bound && lstat(socket_path, &st) == 0 && st.st_dev == bound.st_dev && st.st_ino == bound.st_ino) {
+    unlink(socket_path);
+  }
+  close(d.listen_fd);
+  if (d.verbose == 1) {
+    gmp_fprintf(stderr, "stopped by signal %d\n", sig);
+    if (d.have_store) {
+      pthread_mutex_lock(&d.cache.lock);
+      gmp_fprintf(stderr, "keystore cache: %lu hits, %lu misses\n", d.cache.hits, d.cache.misses);
+      pthread_mutex_unlock(&d.cache.lock);
+    }
+  }
+  return 0;
+}
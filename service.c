@@ -0,0 +1,194 @@
+/*********************************************************************************
+* service.c
+* Framed request protocol between the rsad daemon and its clients over a
+* Unix domain socket
+*********************************************************************************/
+
+#include <errno.h>
+#include <gmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "service.h"
+
+static bool socket_addr(struct sockaddr_un *addr, const char *path) {   // fills in a Unix socket address; false if path is too long
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+int service_listen(const char *path) {                  // binds and listens on path
+  struct sockaddr_un addr;
+  if (!socket_addr(&addr, path)) {
+    return -1;
+  }
+  struct stat st;
+  if (lstat(path, &st) == 0) {                          // only a socket left behind by a server that is gone is replaced
+    if (!S_ISSOCK(st.st_mode)) {
+      errno = EEXIST;
+      return -1;
+    }
+    int live = service_connect(path);
+    if (live >= 0) {                                    // another server still answers on it
+      close(live);
+      errno = EADDRINUSE;
+      return -1;
+    }
+    unlink(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int service_connect(const char *path) {                 // connects to the server listening on path
+  struct sockaddr_un addr;
+  if (!socket_addr(&addr, path)) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool write_full(int fd, const uint8_t *data, size_t len) {   // writes every byte, retrying short writes
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);     // a closed peer is an error, not a SIGPIPE
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_full(int fd, uint8_t *data, size_t len) {   // reads exactly len bytes; false at end of stream
+  while (len > 0) {
+    ssize_t n = read(fd, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool service_send(int fd, uint8_t type, uint8_t flags, const uint8_t *data, uint32_t len) {   // writes the header, then the payload
+  uint8_t header[SERVICE_HEADER_SIZE] = { SERVICE_VERSION, type, flags, 0, len >> 24, len >> 16, len >> 8, len };
+  return write_full(fd, header, SERVICE_HEADER_SIZE) && write_full(fd, data, len);
+}
+
+bool service_recv(int fd, uint8_t *type, uint8_t *flags, uint8_t **buf, size_t *cap, uint32_t *len) {   // reads a frame; the payload buffer only grows
+  uint8_t header[SERVICE_HEADER_SIZE];
+  if (!read_full(fd, header, SERVICE_HEADER_SIZE) || header[0] != SERVICE_VERSION) {
+    return false;
+  }
+  *type = header[1];
+  *flags = header[2];
+  *len = (uint32_t)header[4] << 24 | (uint32_t)header[5] << 16 | (uint32_t)header[6] << 8 | header[7];
+  if (*len > SERVICE_MAX_PAYLOAD) {
+    return false;
+  }
+  if (*len > *cap || *buf == NULL) {
+    *cap = *len > 0 ? *len : 1;
+    *buf = (uint8_t *)realloc(*buf, *cap);
+  }
+  return read_full(fd, *buf, *len);
+}
+
+bool service_call(int fd, uint8_t op, uint8_t flags, const uint8_t *req, uint32_t len, uint8_t *status, uint8_t **resp, size_t *cap, uint32_t *resp_len) {
+  uint8_t rflags = 0;
+  return service_send(fd, op, flags, req, len) && service_recv(fd, status, &rflags, resp, cap, resp_len);
+}
+
+bool service_read_all(FILE *file, uint8_t **data, size_t *len) {   // reads a whole stream into memory
+  size_t cap = 65536;
+  *data = (uint8_t *)malloc(cap);
+  *len = 0;
+  size_t n = 0;
+  while ((n = fread(*data + *len, 1, cap - *len, file)) > 0) {
+    *len += n;
+    if (*len > SERVICE_MAX_PAYLOAD) {
+      return false;
+    }
+    if (*len == cap) {
+      cap *= 2;
+      *data = (uint8_t *)realloc(*data, cap);
+    }
+  }
+  return true;
+}
+
+bool service_run_file(const char *path, uint8_t op, uint8_t flags, const char *label, FILE *infile, FILE *outfile) {   // one request carrying all of infile
+  uint8_t *req = NULL;
+  size_t len = 0;
+  if (!service_read_all(infile, &req, &len)) {
+    gmp_fprintf(stderr, "input is larger than the %u byte request limit\n", SERVICE_MAX_PAYLOAD);
+    free(req);
+    return false;
+  }
+  if (label != NULL) {                                  // the label goes in front of the data
+    uint32_t label_len = strlen(label);
+    if (len + 4 + label_len > SERVICE_MAX_PAYLOAD) {
+      gmp_fprintf(stderr, "input is larger than the %u byte request limit\n", SERVICE_MAX_PAYLOAD);
+      free(req);
+      return false;
+    }
+    req = (uint8_t *)realloc(req, len + 4 + label_len);
+    memmove(req + 4 + label_len, req, len);
+    uint8_t prefix[4] = { label_len >> 24, label_len >> 16, label_len >> 8, label_len };
+    memcpy(req, prefix, 4);
+    memcpy(req + 4, label, label_len);
+    len += 4 + label_len;
+  }
+  int fd = service_connect(path);
+  if (fd < 0) {
+    gmp_fprintf(stderr, "cannot connect to %s\n", path);
+    free(req);
+    return false;
+  }
+  uint8_t status = 0;
+  uint8_t *resp = NULL;
+  size_t cap = 0;
+  uint32_t resp_len = 0;
+  bool ok = service_call(fd, op, flags, req, len, &status, &resp, &cap, &resp_len);
+  if (!ok) {
+    gmp_fprintf(stderr, "lost connection to %s\n", path);
+  } else if (status != SERVICE_OK) {
+    gmp_fprintf(stderr, "server refused request: %.*s\n", (int)resp_len, (char *)resp);
+    ok = false;
+  } else {
+    fwrite(resp, 1, resp_len, outfile);
+  }
+  close(fd);
+  free(req);
+  free(resp);
+  return ok;
+}
@@ -0,0 +1,69 @@
+/*********************************************************************************
+* service.h
+* Interface for service.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SERVICE_VERSION 1
+#define SERVICE_HEADER_SIZE 8                    // version, type, flags, reserved byte, payload length
+#define SERVICE_MAX_PAYLOAD (64u << 20)          // largest frame either side accepts
+#define SERVICE_DEFAULT_SOCKET "rsad.sock"
+
+//
+// Framed protocol between rsad and its clients over a Unix stream socket.
+// Every request and every response is one frame: an 8-byte header (u8
+// version, u8 type, u8 flags, u8 reserved, big-endian u32 payload length)
+// followed by the payload. A connection carries any number of requests,
+// each answered by exactly one response, in order.
+//
+// Request types and payloads:
+//   SERVICE_ENCRYPT  plaintext bytes; flags is any rsa_format_t but AUTO.
+//                    Answered with the ciphertext encrypt would have written.
+//   SERVICE_DECRYPT  ciphertext bytes; flags is an rsa_format_t, AUTO to detect.
+//                    Answered with the plaintext.
+//   SERVICE_SIGN     a big-endian message below n. Answered with the
+//                    signature, a big-endian block as wide as n.
+//   SERVICE_VERIFY   big-endian u32 message length, the message, then the
+//                    signature. Answered with an empty payload.
+//   SERVICE_ENCRYPT_TO  big-endian u32 label length, a keystore label, then
+//                    plaintext; as SERVICE_ENCRYPT with that label's public key.
+//   SERVICE_DECRYPT_AS  big-endian u32 label length, a keystore label, then
+//                    ciphertext; as SERVICE_DECRYPT with that label's private key.
+// The response type is a service_status_t; failed requests may carry a
+// short text explanation as their payload.
+//
+typedef enum {
+  SERVICE_ENCRYPT = 1,
+  SERVICE_DECRYPT = 2,
+  SERVICE_SIGN = 3,
+  SERVICE_VERIFY = 4,
+  SERVICE_ENCRYPT_TO = 5,
+  SERVICE_DECRYPT_AS = 6,
+} service_op_t;
+
+typedef enum {
+  SERVICE_OK = 0,
+  SERVICE_FAILED = 1,                            // well-formed request that did not succeed, e.g. a bad signature
+  SERVICE_BAD_REQUEST = 2,                       // unknown type, bad flags or a malformed payload
+  SERVICE_NO_KEY = 3,                            // the server has no key for this operation
+} service_status_t;
+
+int service_listen(const char *path);                                  // binds and listens on a socket path, replacing a socket no server answers on; -1 with errno set on error, e.g. EEXIST for a file that is not a socket
+
+int service_connect(const char *path);                                 // connects to a socket path; -1 on error
+
+bool service_send(int fd, uint8_t type, uint8_t flags, const uint8_t *data, uint32_t len);   // writes one frame; false on error
+
+bool service_recv(int fd, uint8_t *type, uint8_t *flags, uint8_t **buf, size_t *cap, uint32_t *len);   // reads one frame into a buffer grown as needed; false at end of stream or on error
+
+bool service_call(int fd, uint8_t op, uint8_t flags, const uint8_t *req, uint32_t len, uint8_t *status, uint8_t **resp, size_t *cap, uint32_t *resp_len);   // sends a request and waits for its response
+
+bool service_read_all(FILE *file, uint8_t **data, size_t *len);        // reads a stream to its end into a new buffer; false past SERVICE_MAX_PAYLOAD
+
+bool service_run_file(const char *path, uint8_t op, uint8_t flags, const char *label, FILE *infile, FILE *outfile);   // client mode: sends a whole file as one request, after a u32 length and label unless label is NULL, and writes the response; false on any failure, reported on stderr
@@ -0,0 +1,105 @@
+/*********************************************************************************
+* sha256.c
+* SHA-256, the key derivation function of the hybrid file format
+*********************************************************************************/
+
+#include <string.h>
+#include "sha256.h"
+
+#define ROTR(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_block(sha256_t *s, const uint8_t *p) {   // compresses one 64-byte block into the chaining value
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3];
+  uint32_t e = s->h[4], f = s->h[5], g = s->h[6], h = s->h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  s->h[0] += a;
+  s->h[1] += b;
+  s->h[2] += c;
+  s->h[3] += d;
+  s->h[4] += e;
+  s->h[5] += f;
+  s->h[6] += g;
+  s->h[7] += h;
+}
+
+void sha256_init(sha256_t *s) {                         // initial hash value from FIPS 180-4
+  static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  memcpy(s->h, iv, sizeof(iv));
+  s->bytes = 0;
+  s->left = 0;
+}
+
+void sha256_update(sha256_t *s, const uint8_t *data, size_t len) {   // buffers partial blocks between calls
+  s->bytes += len;
+  while (len > 0) {
+    if (s->left == 0 && len >= 64) {                    // whole blocks skip the buffer
+      sha256_block(s, data);
+      data += 64;
+      len -= 64;
+      continue;
+    }
+    size_t n = 64 - s->left < len ? 64 - s->left : len;
+    memcpy(s->buf + s->left, data, n);
+    s->left += n;
+    data += n;
+    len -= n;
+    if (s->left == 64) {
+      sha256_block(s, s->buf);
+      s->left = 0;
+    }
+  }
+}
+
+void sha256_finish(sha256_t *s, uint8_t out[SHA256_SIZE]) {   // appends 0x80, zeros and the bit length
+  uint64_t bits = s->bytes * 8;
+  uint8_t pad[72] = { 0x80 };
+  size_t padlen = s->left < 56 ? 56 - s->left : 120 - s->left;
+  for (int i = 0; i < 8; i++) {
+    pad[padlen + i] = bits >> (56 - 8 * i);
+  }
+  sha256_update(s, pad, padlen + 8);
+  for (int i = 0; i < 8; i++) {
+    out[4 * i] = s->h[i] >> 24;
+    out[4 * i + 1] = s->h[i] >> 16;
+    out[4 * i + 2] = s->h[i] >> 8;
+    out[4 * i + 3] = s->h[i];
+  }
+}
+
+void sha256(uint8_t out[SHA256_SIZE], const uint8_t *data, size_t len) {
+  sha256_t s;
+  sha256_init(&s);
+  sha256_update(&s, data, len);
+  sha256_finish(&s, out);
+}
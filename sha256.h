@@ -0,0 +1,29 @@
+/*********************************************************************************
+* sha256.h
+* Interface for sha256.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+//
+// Incremental SHA-256 (FIPS 180-4).
+//
+typedef struct {
+  uint32_t h[8];                           // chaining value
+  uint64_t bytes;                          // message length so far
+  uint8_t buf[64];                         // partial block awaiting more input
+  size_t left;                             // bytes held in buf
+} sha256_t;
+
+void sha256_init(sha256_t *s);                                         // starts a new digest
+
+void sha256_update(sha256_t *s, const uint8_t *data, size_t len);      // absorbs data
+
+void sha256_finish(sha256_t *s, uint8_t out[SHA256_SIZE]);             // pads the message and writes the digest
+
+void sha256(uint8_t out[SHA256_SIZE], const uint8_t *data, size_t len);   // one-shot digest of data
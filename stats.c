@@ -0,0 +1,86 @@
+/*********************************************************************************
+* stats.c
+* Process-wide counters and phase timers, reported as JSON. Disabled
+* counters cost one branch per call
+*********************************************************************************/
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+typedef struct {
+  atomic_uint_fast64_t count;
+  atomic_uint_fast64_t ns;                              // cumulative time, for timed counters
+} stats_counter_t;
+
+bool stats_enabled = false;
+static stats_counter_t counters[STATS_COUNT];
+static uint64_t wall_start = 0;
+
+static const char *names[STATS_COUNT] = {               // JSON keys, in stats_id_t order
+  "key_load", "key_verify", "pow", "read", "write", "format", "cipher",
+  "candidates", "sieved", "prime_test", "mr_rounds", "lucas", "primes",
+  "product_tree", "remainder_tree",
+};
+
+static const bool timed[STATS_COUNT] = {
+  true, true, true, true, true, true, true,
+  false, false, true, false, false, false,
+  true, true,
+};
+
+static uint64_t now_ns(void) {                          // monotonic clock, in nanoseconds
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_enable(void) {                               // starts counting and the wall clock
+  stats_enabled = true;
+  wall_start = now_ns();
+}
+
+uint64_t stats_start(void) {                            // the clock is only read when counting
+  return stats_enabled ? now_ns() : 0;
+}
+
+void stats_stop(stats_id_t id, uint64_t start, uint64_t count) {   // adds count and the time since start
+  if (!stats_enabled) {
+    return;
+  }
+  atomic_fetch_add_explicit(&counters[id].ns, now_ns() - start, memory_order_relaxed);
+  atomic_fetch_add_explicit(&counters[id].count, count, memory_order_relaxed);
+}
+
+void stats_add(stats_id_t id, uint64_t count) {         // adds to a plain counter
+  if (stats_enabled) {
+    atomic_fetch_add_explicit(&counters[id].count, count, memory_order_relaxed);
+  }
+}
+
+void stats_report(FILE *outfile, const char *program) { // one JSON object; timed counters also carry seconds
+  fprintf(outfile, "{\"program\": \"%s\", \"wall_seconds\": %.6f, \"counters\": {", program, (now_ns() - wall_start) / 1e9);
+  for (int i = 0; i < STATS_COUNT; i++) {
+    uint64_t count = atomic_load(&counters[i].count);
+    if (timed[i]) {
+      fprintf(outfile, "%s\"%s\": {\"count\": %lu, \"seconds\": %.6f}", i ? ", " : "", names[i], count, atomic_load(&counters[i].ns) / 1e9);
+    } else {
+      fprintf(outfile, "%s\"%s\": %lu", i ? ", " : "", names[i], count);
+    }
+  }
+  fprintf(outfile, "}}\n");
+}
+
+bool stats_write(const char *path, const char *program) {   // stats_report to path, or to stderr for "-"
+  FILE *outfile = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+  if (outfile == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  stats_report(outfile, program);
+  if (outfile != stderr) {
+    fclose(outfile);
+  }
+  return true;
+}
@@ -0,0 +1,47 @@
+/*********************************************************************************
+* stats.h
+* Interface for stats.c
+*********************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// Counters kept while a binary runs. Timed counters add the time spent in
+// each call next to their count; the others are plain counts.
+//
+typedef enum {
+  STATS_KEY_LOAD,          // reading and parsing key files (timed)
+  STATS_KEY_VERIFY,        // checking the username signature (timed)
+  STATS_POW,               // per-block exponentiations (timed)
+  STATS_READ,              // read stage: input I/O and parsing into blocks; counts blocks (timed)
+  STATS_WRITE,             // write stage: output I/O including formatting; counts blocks (timed)
+  STATS_FORMAT,            // hexstring conversion inside the write stage (timed)
+  STATS_CIPHER,            // symmetric encryption of hybrid chunks; counts chunks (timed)
+  STATS_CANDIDATES,        // prime candidates looked at
+  STATS_SIEVED,            // candidates rejected by the small-prime sieve
+  STATS_PRIME_TEST,        // Miller-Rabin tests of sieve survivors (timed)
+  STATS_MR_ROUNDS,         // Miller-Rabin rounds run
+  STATS_LUCAS,             // strong Lucas tests run by Baillie-PSW
+  STATS_PRIMES,            // primes found
+  STATS_TREE_PRODUCT,      // batch GCD product tree nodes (timed)
+  STATS_TREE_REMAINDER,    // batch GCD remainder tree nodes, leaves included (timed)
+  STATS_COUNT,
+} stats_id_t;
+
+extern bool stats_enabled;               // set once by stats_enable, before any worker thread starts
+
+void stats_enable(void);                                               // starts counting and the wall clock
+
+uint64_t stats_start(void);                                            // current time for stats_stop; 0 without touching the clock when disabled
+
+void stats_stop(stats_id_t id, uint64_t start, uint64_t count);        // adds count and the time since start to a timed counter
+
+void stats_add(stats_id_t id, uint64_t count);                         // adds to a plain counter
+
+void stats_report(FILE *outfile, const char *program);                 // writes every counter as one JSON object
+
+bool stats_write(const char *path, const char *program);               // stats_report to a new file, or to stderr for "-"; false if path cannot be opened